@@ -11,7 +11,7 @@ import xml.dom.minidom as xdm
 
 import numpy as np
 
-__all__ = ['run_ebtel', 'read_xml', 'write_xml']
+__all__ = ['run_ebtel', 'read_binary', 'read_xml', 'write_xml']
 
 
 class EbtelPlusPlusError(Exception):
@@ -45,7 +45,11 @@ def run_ebtel(config, ebtel_dir):
         )
         if cmd.stderr:
             raise EbtelPlusPlusError(f"{cmd.stderr.decode('utf-8')}")
-        data = np.loadtxt(results_filename)
+        if config.get('output_format', 'text') == 'binary':
+            load = read_binary
+        else:
+            load = np.loadtxt
+        data = load(results_filename)
 
         results = {
             'time': data[:, 0],
@@ -60,9 +64,9 @@ def run_ebtel(config, ebtel_dir):
 
         results_dem = {}
         if config['calculate_dem']:
-            results_dem['dem_tr'] = np.loadtxt(
+            results_dem['dem_tr'] = load(
                 config['output_filename'] + '.dem_tr')
-            results_dem['dem_corona'] = np.loadtxt(
+            results_dem['dem_corona'] = load(
                 config['output_filename'] + '.dem_corona')
             # The first row of both is the temperature bins
             results_dem['dem_temperature'] = results_dem['dem_tr'][0, :]
@@ -72,6 +76,30 @@ def run_ebtel(config, ebtel_dir):
     return {**results, **results_dem}
 
 
+def read_binary(filename):
+    """
+    Read an ebtel++ output file written with the binary output format
+
+    Parameters
+    ----------
+    filename : `str`
+
+    Returns
+    -------
+    data : `~numpy.ndarray`
+        Array with the same rows and columns as the equivalent text file
+    """
+    header_dtype = np.dtype([('magic', 'S8'), ('version', '=u4'),
+                             ('num_columns', '=u4'), ('num_rows', '=u8')])
+    with open(filename, 'rb') as f:
+        header = np.fromfile(f, dtype=header_dtype, count=1)[0]
+        if header['magic'] != b'EBTEL++':
+            raise EbtelPlusPlusError(f'{filename} is not an ebtel++ binary file')
+        shape = (int(header['num_rows']), int(header['num_columns']))
+        data = np.fromfile(f, dtype='=f8', count=shape[0]*shape[1])
+    return data.reshape(shape)
+
+
 def read_xml(input_filename,):
     """
     For all input variables, find them in the XML tree and return them to a
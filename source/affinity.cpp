@@ -0,0 +1,218 @@
+/*
+affinity.cpp
+Functions for placing ensemble workers on CPUs
+*/
+
+#include <sstream>
+#include "affinity.h"
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+std::vector<int> GetAvailableCpus(void)
+{
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if(sched_getaffinity(0,sizeof(allowed),&allowed) == 0)
+  {
+    // Group the allowed CPUs by node
+    std::vector<std::vector<int> > node_cpus;
+    for(int cpu=0;cpu<CPU_SETSIZE;cpu++)
+    {
+      if(!CPU_ISSET(cpu,&allowed))
+      {
+        continue;
+      }
+      int node = GetNumaNode(cpu);
+      if(node >= (int)node_cpus.size())
+      {
+        node_cpus.resize(node+1);
+      }
+      node_cpus[node].push_back(cpu);
+    }
+    // Interleave the nodes
+    for(std::size_t k=0;cpus.size()<(std::size_t)CPU_COUNT(&allowed);k++)
+    {
+      for(std::size_t node=0;node<node_cpus.size();node++)
+      {
+        if(k < node_cpus[node].size())
+        {
+          cpus.push_back(node_cpus[node][k]);
+        }
+      }
+    }
+  }
+  int quota = GetCpuQuota();
+  if(quota > 0 && quota < (int)cpus.size())
+  {
+    cpus.resize(quota);
+  }
+#endif
+  if(cpus.empty())
+  {
+    cpus.push_back(-1);
+  }
+  return cpus;
+}
+
+// Get the CPU quota set in a single cgroup directory
+// @directory cgroup directory
+// @unified if true, read the cgroup v2 `cpu.max`; otherwise the cgroup v1 `cpu.cfs_quota_us` and `cpu.cfs_period_us`
+//
+// @return number of CPUs allowed by the quota, not rounded; 0 if there is no quota
+//
+static double ReadCpuQuota(const std::string & directory, bool unified)
+{
+  double quota = -1.0;
+  double period = 0.0;
+  if(unified)
+  {
+    // The quota is "max" if there is none
+    std::ifstream f_max(directory + "/cpu.max");
+    std::string quota_text;
+    if((f_max >> quota_text >> period) && quota_text.compare("max") != 0)
+    {
+      std::istringstream(quota_text) >> quota;
+    }
+  }
+  else
+  {
+    // The quota is -1 if there is none
+    std::ifstream f_quota(directory + "/cpu.cfs_quota_us");
+    std::ifstream f_period(directory + "/cpu.cfs_period_us");
+    if(!(f_quota >> quota) || !(f_period >> period))
+    {
+      return 0.0;
+    }
+  }
+  if(quota <= 0.0 || period <= 0.0)
+  {
+    return 0.0;
+  }
+  return quota/period;
+}
+
+int GetCpuQuota(const std::string & root)
+{
+  // Mount point, cgroup version and path of each hierarchy this process is in
+  std::vector<std::string> mounts;
+  std::vector<bool> unified;
+  std::vector<std::string> paths;
+  // Each line is hierarchy-ID:controllers:path, with no controllers for cgroup v2
+  std::ifstream f_cgroup(root + "/proc/self/cgroup");
+  std::string line;
+  while(std::getline(f_cgroup,line))
+  {
+    std::size_t first = line.find(':');
+    std::size_t second = first == std::string::npos ? std::string::npos : line.find(':',first+1);
+    if(second == std::string::npos || line.compare(second+1,1,"/") != 0)
+    {
+      continue;
+    }
+    std::string controllers = line.substr(first+1,second-first-1);
+    std::string path = line.substr(second+1);
+    if(controllers.empty())
+    {
+      mounts.push_back(root + "/sys/fs/cgroup");
+      unified.push_back(true);
+      paths.push_back(path);
+      continue;
+    }
+    std::istringstream controller_list(controllers);
+    std::string controller;
+    while(std::getline(controller_list,controller,','))
+    {
+      if(controller.compare("cpu") == 0)
+      {
+        // Mounted under the joined controller names, e.g. cpu,cpuacct, usually linked from cpu
+        mounts.push_back(root + "/sys/fs/cgroup/" + controllers);
+        unified.push_back(false);
+        paths.push_back(path);
+        mounts.push_back(root + "/sys/fs/cgroup/cpu");
+        unified.push_back(false);
+        paths.push_back(path);
+        break;
+      }
+    }
+  }
+  // Without /proc, only the roots of the hierarchies can be read
+  if(mounts.empty())
+  {
+    mounts = {root + "/sys/fs/cgroup", root + "/sys/fs/cgroup/cpu"};
+    unified = {true, false};
+    paths = {"/", "/"};
+  }
+
+  // A quota applies to every cgroup below it, so walk up to the root and take the tightest
+  double tightest = 0.0;
+  for(std::size_t k=0;k<mounts.size();k++)
+  {
+    std::string path = paths[k];
+    while(true)
+    {
+      double cpus = ReadCpuQuota(mounts[k] + (path.compare("/") == 0 ? "" : path),unified[k]);
+      if(cpus > 0.0 && (tightest == 0.0 || cpus < tightest))
+      {
+        tightest = cpus;
+      }
+      if(path.compare("/") == 0)
+      {
+        break;
+      }
+      path = path.substr(0,std::max((std::size_t)1,path.find_last_of('/')));
+    }
+  }
+  if(tightest <= 0.0)
+  {
+    return 0;
+  }
+  return std::max(1,(int)std::ceil(tightest));
+}
+
+int GetNumaNode(int cpu)
+{
+#ifdef __linux__
+  // The CPU directory holds a link named after its node
+  std::string cpu_dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+  DIR * dir = opendir(cpu_dir.c_str());
+  if(dir == NULL)
+  {
+    return 0;
+  }
+  int node = 0;
+  struct dirent * entry;
+  while((entry = readdir(dir)) != NULL)
+  {
+    std::string name = entry->d_name;
+    if(name.compare(0,4,"node") == 0 && name.size() > 4 && isdigit(name[4]))
+    {
+      node = std::stoi(name.substr(4));
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+#else
+  return 0;
+#endif
+}
+
+void PinToCpu(int cpu)
+{
+#ifdef __linux__
+  if(cpu < 0)
+  {
+    return;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu,&cpu_set);
+  if(sched_setaffinity(0,sizeof(cpu_set),&cpu_set) != 0)
+  {
+    std::cerr << "Failed to pin worker to CPU " << cpu << std::endl;
+  }
+#endif
+}
@@ -0,0 +1,49 @@
+/*
+affinity.h
+Functions for placing ensemble workers on CPUs
+*/
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include "helper.h"
+
+// Get the CPUs available to this process
+//
+// Starts from the CPUs this process is allowed to run on and drops any beyond
+// the CPU quota of its cgroup. The CPUs are ordered so that consecutive entries
+// alternate between NUMA nodes; taking the first n then spreads n workers evenly
+// across the sockets of the machine.
+//
+// @return CPU numbers; a single -1 if they cannot be determined
+//
+std::vector<int> GetAvailableCpus(void);
+
+// Get the CPU quota of this process's cgroup
+// @root directory standing in for the root of the filesystem; empty for the real one
+//
+// Finds the cgroups of this process in `/proc/self/cgroup` and reads `cpu.max`
+// (cgroup v2) or `cpu.cfs_quota_us` and `cpu.cfs_period_us` (cgroup v1) in each
+// of them and in each of their parents, since a batch system may set the quota on
+// an enclosing cgroup. The tightest quota is rounded up to a whole number of CPUs.
+//
+// @return number of CPUs allowed by the quota; 0 if there is no quota
+//
+int GetCpuQuota(const std::string & root="");
+
+// Get the NUMA node of a CPU
+// @cpu CPU number
+//
+// @return node number; 0 if it cannot be determined
+//
+int GetNumaNode(int cpu);
+
+// Pin the calling process to a single CPU
+// @cpu CPU number; -1 leaves the affinity unchanged
+//
+// Memory is placed on the node of the CPU that first touches it, so results
+// allocated after pinning are local to the worker.
+//
+void PinToCpu(int cpu);
+
+#endif
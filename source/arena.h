@@ -0,0 +1,317 @@
+/*
+arena.h
+Chunked storage for results that grow during the integration
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <map>
+
+// Chunk pool object
+//
+// Recycles the chunks used by <Arena> objects. Chunks are never returned to
+// the heap; instead they are kept on a free list, one per chunk size, so that
+// the pool grows to the high-water mark of chunks in use at any one time. When
+// runs are repeated, e.g. in an ensemble, the storage for every run after the
+// first is then taken from the pool rather than the heap. There is one pool
+// per thread so no locking is needed.
+//
+template<typename T>
+class ChunkPool {
+private:
+  /* Free chunks of each size */
+  struct FreeLists {
+    std::map<std::size_t, std::vector<T*> > chunks;
+    ~FreeLists(void)
+    {
+      typename std::map<std::size_t, std::vector<T*> >::iterator it;
+      for(it=chunks.begin();it!=chunks.end();++it)
+      {
+        for(std::size_t k=0;k<it->second.size();k++)
+        {
+          delete [] it->second[k];
+        }
+      }
+      IsDestroyed() = true;
+    }
+  };
+
+  // @return true once the pool for this thread has been destroyed, e.g. when
+  // static arenas are cleared at exit
+  //
+  static bool & IsDestroyed(void)
+  {
+    static thread_local bool destroyed = false;
+    return destroyed;
+  }
+
+  // @return free list for chunks of <size> elements on this thread
+  //
+  static std::vector<T*> & GetFreeList(std::size_t size)
+  {
+    static thread_local FreeLists free_lists;
+    return free_lists.chunks[size];
+  }
+
+public:
+  // Take a chunk from the pool
+  // @size number of elements in the chunk
+  //
+  // @return pointer to a chunk of <size> uninitialized elements
+  //
+  static T * Get(std::size_t size)
+  {
+    if(IsDestroyed())
+    {
+      return new T[size];
+    }
+    std::vector<T*> & free_list = GetFreeList(size);
+    if(free_list.empty())
+    {
+      return new T[size];
+    }
+    T * chunk = free_list.back();
+    free_list.pop_back();
+    return chunk;
+  }
+
+  // Return a chunk to the pool
+  // @chunk pointer obtained from <Get>
+  // @size number of elements in the chunk
+  //
+  static void Put(T * chunk, std::size_t size)
+  {
+    if(IsDestroyed())
+    {
+      delete [] chunk;
+      return;
+    }
+    GetFreeList(size).push_back(chunk);
+  }
+};
+
+// Arena object
+//
+// Append-only container that stores its entries in fixed-size chunks. Unlike
+// `std::vector`, growing the arena never moves existing entries, so memory use
+// tracks the number of stored rows without the copy spikes of repeated
+// reallocation and pointers to stored rows remain valid. Chunks come from, and
+// are returned to, a <ChunkPool>. Each row holds
+// <width> consecutive elements; with the default width of 1, the arena can be
+// used in place of a `std::vector` for a single column of results.
+//
+// The oldest complete chunks can also be released, e.g. after they have been
+// written to disk, in which case their rows can no longer be accessed.
+//
+// If a capacity is set, the arena becomes a ring buffer: rows are still indexed
+// by the total number of rows appended, but only the last <capacity> are kept and
+// new rows overwrite the oldest ones, so memory stays constant however long the run.
+//
+template<typename T>
+class Arena {
+private:
+  /* Number of elements per row */
+  std::size_t __width;
+
+  /* Number of rows per chunk */
+  std::size_t __rows_per_chunk;
+
+  /* Number of rows appended */
+  std::size_t __size;
+
+  /* Maximum number of rows kept; 0 keeps every row */
+  std::size_t __capacity;
+
+  /* Number of rows in chunks that have been released */
+  std::size_t __released;
+
+  /* Pointers to the allocated chunks */
+  std::vector<T*> __chunks;
+
+  // Allocate chunks until there is room for <rows> rows
+  //
+  void Reserve(std::size_t rows)
+  {
+    if(__capacity > 0)
+    {
+      rows = std::min(rows,__capacity);
+    }
+    rows = rows > __released ? rows - __released : 0;
+    while(__chunks.size()*__rows_per_chunk < rows)
+    {
+      __chunks.push_back(ChunkPool<T>::Get(__rows_per_chunk*__width));
+    }
+  }
+
+public:
+  // Default constructor
+  // @width number of elements per row
+  // @rows_per_chunk number of rows allocated at a time
+  //
+  Arena(std::size_t width=1, std::size_t rows_per_chunk=4096) : __width(width), __rows_per_chunk(rows_per_chunk), __size(0), __capacity(0), __released(0) {}
+
+  /* Destructor */
+  ~Arena(void)
+  {
+    clear();
+  }
+
+  Arena(const Arena &) = delete;
+  Arena & operator=(const Arena &) = delete;
+
+  // Configure the row layout
+  // @width number of elements per row
+  // @rows_per_chunk number of rows allocated at a time
+  //
+  // Frees any stored rows.
+  //
+  void configure(std::size_t width, std::size_t rows_per_chunk)
+  {
+    clear();
+    __width = width;
+    __rows_per_chunk = rows_per_chunk;
+  }
+
+  // Keep only the most recent rows
+  // @capacity number of rows to keep; 0 keeps every row
+  //
+  // Frees any stored rows.
+  //
+  void set_capacity(std::size_t capacity)
+  {
+    clear();
+    __capacity = capacity;
+  }
+
+  // Return all chunks to the pool and set the size to zero
+  //
+  void clear(void)
+  {
+    for(std::size_t k=0;k<__chunks.size();k++)
+    {
+      ChunkPool<T>::Put(__chunks[k],__rows_per_chunk*__width);
+    }
+    __chunks.clear();
+    __size = 0;
+    __released = 0;
+  }
+
+  // @return number of rows appended, including any that have been overwritten
+  //
+  std::size_t size(void) const
+  {
+    return __size;
+  }
+
+  // @return index of the oldest row still stored
+  //
+  std::size_t first(void) const
+  {
+    if(__capacity > 0 && __size > __capacity)
+    {
+      return __size - __capacity;
+    }
+    return __released;
+  }
+
+  // @return number of rows allocated at a time
+  //
+  std::size_t rows_per_chunk(void) const
+  {
+    return __rows_per_chunk;
+  }
+
+  // @return bytes currently allocated for stored rows
+  //
+  std::size_t memory(void) const
+  {
+    return __chunks.size()*__rows_per_chunk*__width*sizeof(T);
+  }
+
+  // Return the chunk holding the oldest rows to the pool
+  //
+  // The chunk must be full. Rows in the chunk can no longer be accessed
+  // afterwards. Not available when a capacity is set.
+  //
+  void release_front(void)
+  {
+    ChunkPool<T>::Put(__chunks.front(),__rows_per_chunk*__width);
+    __chunks.erase(__chunks.begin());
+    __released += __rows_per_chunk;
+  }
+
+  // @return number of elements per row
+  //
+  std::size_t width(void) const
+  {
+    return __width;
+  }
+
+  // Grow or shrink to <rows> rows
+  // @rows new number of rows
+  //
+  // New rows are uninitialized. Shrinking does not release memory.
+  //
+  void resize(std::size_t rows)
+  {
+    Reserve(rows);
+    __size = rows;
+  }
+
+  // Append a row
+  //
+  // @return pointer to the first element of the new, uninitialized row
+  //
+  T * push_row(void)
+  {
+    Reserve(__size + 1);
+    __size++;
+    return row(__size - 1);
+  }
+
+  // Append a single value
+  // @value value to store; the arena must have a width of 1
+  //
+  void push_back(const T & value)
+  {
+    *push_row() = value;
+  }
+
+  // @return pointer to the first element of row <i>; must not be older than <first>
+  //
+  T * row(std::size_t i)
+  {
+    if(__capacity > 0)
+    {
+      i = i%__capacity;
+    }
+    else
+    {
+      i -= __released;
+    }
+    return __chunks[i/__rows_per_chunk] + (i%__rows_per_chunk)*__width;
+  }
+
+  const T * row(std::size_t i) const
+  {
+    return const_cast<Arena *>(this)->row(i);
+  }
+
+  // @return first element of row <i>
+  //
+  T & operator[](std::size_t i)
+  {
+    return *row(i);
+  }
+
+  const T & operator[](std::size_t i) const
+  {
+    return *row(i);
+  }
+};
+
+#endif
@@ -0,0 +1,487 @@
+/*
+binary.cpp
+Methods for reading and writing the binary output format
+*/
+
+#include "binary.h"
+#include <sstream>
+#include <cstdio>
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char BINARY_MAGIC[8] = {'E','B','T','E','L','+','+','\0'};
+static const uint32_t BINARY_VERSION = 1;
+
+BinaryWriter::BinaryWriter(void)
+{
+  // Default constructor
+}
+
+BinaryWriter::~BinaryWriter(void)
+{
+  if(IsOpen())
+  {
+    // Errors cannot be reported from a destructor
+    try
+    {
+      Close();
+    }
+    catch(std::exception &e)
+    {
+      f.close();
+    }
+  }
+}
+
+void BinaryWriter::Open(std::string filename, int num_columns)
+{
+  this->filename = filename;
+  std::copy(BINARY_MAGIC,BINARY_MAGIC+8,header.magic);
+  header.version = BINARY_VERSION;
+  header.num_columns = num_columns;
+  header.num_rows = 0;
+  f.open(filename.c_str(),std::ios::out | std::ios::binary | std::ios::trunc);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open binary file " + filename);
+  }
+  f.write(reinterpret_cast<const char *>(&header),sizeof(header));
+}
+
+void BinaryWriter::WriteRow(const double * row)
+{
+  f.write(reinterpret_cast<const char *>(row),header.num_columns*sizeof(double));
+  if(!f)
+  {
+    throw std::runtime_error("Failed to write to binary file " + filename);
+  }
+  header.num_rows++;
+}
+
+void BinaryWriter::Close(void)
+{
+  // Rewrite the header now that the number of rows is known
+  f.seekp(0);
+  f.write(reinterpret_cast<const char *>(&header),sizeof(header));
+  bool written = bool(f);
+  f.close();
+  if(!written || !f)
+  {
+    throw std::runtime_error("Failed to write to binary file " + filename);
+  }
+}
+
+void BinaryWriter::Discard(void)
+{
+  if(f.is_open())
+  {
+    f.close();
+  }
+  if(!filename.empty())
+  {
+    std::remove(filename.c_str());
+    filename.clear();
+  }
+}
+
+bool BinaryWriter::IsOpen(void)
+{
+  return f.is_open();
+}
+
+uint64_t BinaryWriter::GetOffset(void)
+{
+  return sizeof(header) + header.num_rows*header.num_columns*sizeof(double);
+}
+
+BinaryReader::BinaryReader(void)
+{
+  // Default constructor
+}
+
+void BinaryReader::Open(std::string filename)
+{
+  f.open(filename.c_str(),std::ios::in | std::ios::binary);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open binary file " + filename);
+  }
+  f.read(reinterpret_cast<char *>(&header),sizeof(header));
+  if(!f || !std::equal(BINARY_MAGIC,BINARY_MAGIC+8,header.magic))
+  {
+    throw std::runtime_error(filename + " is not an ebtel++ binary file");
+  }
+}
+
+bool BinaryReader::ReadRow(double * row)
+{
+  f.read(reinterpret_cast<char *>(row),header.num_columns*sizeof(double));
+  return bool(f);
+}
+
+void BinaryReader::Close(void)
+{
+  f.close();
+}
+
+int BinaryReader::GetNumColumns(void)
+{
+  return header.num_columns;
+}
+
+uint64_t BinaryReader::GetNumRows(void)
+{
+  return header.num_rows;
+}
+
+ResultsReader::ResultsReader(void)
+{
+  // Default constructor
+}
+
+int ResultsReader::ParseLine(const std::string & line, std::vector<double> & row)
+{
+  std::istringstream line_stream(line);
+  int k = 0;
+  double value;
+  while(line_stream >> value)
+  {
+    if(k < (int)row.size())
+    {
+      row[k] = value;
+    }
+    else
+    {
+      row.push_back(value);
+    }
+    k++;
+  }
+  return k;
+}
+
+void ResultsReader::Open(std::string filename)
+{
+  // Binary files start with the magic string
+  std::ifstream f_magic(filename.c_str(),std::ios::in | std::ios::binary);
+  if(!f_magic.is_open())
+  {
+    throw std::runtime_error("Failed to open results file " + filename);
+  }
+  char magic[8];
+  f_magic.read(magic,8);
+  binary = f_magic.gcount() == 8 && std::equal(BINARY_MAGIC,BINARY_MAGIC+8,magic);
+  f_magic.close();
+
+  if(binary)
+  {
+    f_binary.Open(filename);
+    num_columns = f_binary.GetNumColumns();
+    return;
+  }
+  f_text.open(filename.c_str());
+  std::string line;
+  first_row.clear();
+  num_columns = std::getline(f_text,line) ? ParseLine(line,first_row) : 0;
+  first_row_pending = num_columns > 0;
+}
+
+bool ResultsReader::ReadRow(double * row)
+{
+  if(binary)
+  {
+    return f_binary.ReadRow(row);
+  }
+  if(first_row_pending)
+  {
+    std::copy(first_row.begin(),first_row.end(),row);
+    first_row_pending = false;
+    return true;
+  }
+  std::string line;
+  while(std::getline(f_text,line))
+  {
+    std::vector<double> values(num_columns);
+    int num_values = ParseLine(line,values);
+    if(num_values == 0)
+    {
+      continue;
+    }
+    if(num_values < num_columns)
+    {
+      throw std::runtime_error("Malformed row in results file");
+    }
+    std::copy(values.begin(),values.begin()+num_columns,row);
+    return true;
+  }
+  return false;
+}
+
+void ResultsReader::Close(void)
+{
+  if(binary)
+  {
+    f_binary.Close();
+  }
+  else
+  {
+    f_text.close();
+  }
+}
+
+int ResultsReader::GetNumColumns(void)
+{
+  return num_columns;
+}
+
+MappedReader::MappedReader(void) : data(NULL), size(0), mapping(NULL), mapping_size(0), rows(NULL)
+{
+  // Default constructor
+}
+
+MappedReader::~MappedReader(void)
+{
+  if(IsOpen())
+  {
+    Close();
+  }
+}
+
+void MappedReader::Open(std::string filename, uint64_t offset, uint64_t length)
+{
+#if defined(__linux__) || defined(__APPLE__)
+  int fd = open(filename.c_str(),O_RDONLY);
+  if(fd < 0)
+  {
+    throw std::runtime_error("Failed to open binary file " + filename);
+  }
+  struct stat file_stat;
+  if(fstat(fd,&file_stat) != 0)
+  {
+    close(fd);
+    throw std::runtime_error("Failed to open binary file " + filename);
+  }
+  uint64_t file_size = file_stat.st_size;
+  if(offset > file_size || (length > 0 && length > file_size - offset))
+  {
+    close(fd);
+    throw std::runtime_error("Binary file at offset " + std::to_string(offset) + " runs past the end of " + filename);
+  }
+  size = length > 0 ? length : file_size - offset;
+  // Mappings must start on a page boundary
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t mapping_offset = offset - offset % page_size;
+  mapping_size = size + (offset - mapping_offset);
+  mapping = size > 0 ? mmap(NULL,mapping_size,PROT_READ,MAP_PRIVATE,fd,mapping_offset) : MAP_FAILED;
+  close(fd);
+  if(mapping == MAP_FAILED)
+  {
+    mapping = NULL;
+    mapping_size = 0;
+    size = 0;
+    throw std::runtime_error("Failed to map binary file " + filename);
+  }
+  data = static_cast<const char *>(mapping) + (offset - mapping_offset);
+#else
+  std::ifstream f(filename.c_str(),std::ios::in | std::ios::binary);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open binary file " + filename);
+  }
+  f.seekg(offset);
+  if(length > 0)
+  {
+    buffer.resize(length);
+    f.read(buffer.data(),length);
+    buffer.resize(f.gcount());
+  }
+  else
+  {
+    buffer.assign(std::istreambuf_iterator<char>(f),std::istreambuf_iterator<char>());
+  }
+  size = buffer.size();
+  data = buffer.data();
+#endif
+  if(size < sizeof(header) || !std::equal(BINARY_MAGIC,BINARY_MAGIC+8,data))
+  {
+    Close();
+    throw std::runtime_error(filename + " is not an ebtel++ binary file");
+  }
+  std::copy(data,data+sizeof(header),reinterpret_cast<char *>(&header));
+  if((size - sizeof(header))/sizeof(double)/std::max<uint64_t>(header.num_columns,1) < header.num_rows)
+  {
+    Close();
+    throw std::runtime_error("Binary file " + filename + " is shorter than its header says");
+  }
+  rows = reinterpret_cast<const double *>(data + sizeof(header));
+}
+
+void MappedReader::Close(void)
+{
+#if defined(__linux__) || defined(__APPLE__)
+  if(mapping != NULL)
+  {
+    munmap(mapping,mapping_size);
+  }
+#else
+  std::vector<char>().swap(buffer);
+#endif
+  data = NULL;
+  mapping = NULL;
+  mapping_size = 0;
+  rows = NULL;
+  size = 0;
+}
+
+bool MappedReader::IsOpen(void)
+{
+  return data != NULL;
+}
+
+int MappedReader::GetNumColumns(void)
+{
+  return header.num_columns;
+}
+
+uint64_t MappedReader::GetNumRows(void)
+{
+  return header.num_rows;
+}
+
+const double * MappedReader::GetRow(uint64_t i)
+{
+  return rows + i*header.num_columns;
+}
+
+uint64_t MappedReader::FindRow(double value, uint64_t first_row)
+{
+  // Binary search, touching only the pages of the rows compared
+  uint64_t low = first_row, high = header.num_rows;
+  while(low < high)
+  {
+    uint64_t middle = low + (high - low)/2;
+    if(GetRow(middle)[0] < value)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+TimeIndexWriter::TimeIndexWriter(void) : interval(0), first_row(0), row(0)
+{
+  // Default constructor
+}
+
+void TimeIndexWriter::Open(std::string filename, int interval_rows, uint64_t first_indexed_row)
+{
+  if(interval_rows < 1)
+  {
+    throw std::runtime_error("Time index interval must be at least one row.");
+  }
+  interval = interval_rows;
+  first_row = first_indexed_row;
+  row = first_indexed_row;
+  f.Open(filename + ".index",3);
+}
+
+bool TimeIndexWriter::IsDue(void)
+{
+  return f.IsOpen() && (row - first_row) % interval == 0;
+}
+
+void TimeIndexWriter::AddRow(double time, uint64_t offset)
+{
+  if(IsDue())
+  {
+    double entry[3] = {time,double(row),double(offset)};
+    f.WriteRow(entry);
+  }
+  row++;
+}
+
+void TimeIndexWriter::Close(void)
+{
+  if(f.IsOpen())
+  {
+    f.Close();
+  }
+}
+
+bool TimeIndexWriter::IsOpen(void)
+{
+  return f.IsOpen();
+}
+
+void TimeIndex::Open(std::string filename)
+{
+  BinaryReader f;
+  f.Open(filename + ".index");
+  if(f.GetNumColumns() != 3)
+  {
+    throw std::runtime_error("Unexpected number of columns in time index " + filename + ".index");
+  }
+  entries.resize(3*f.GetNumRows());
+  for(uint64_t k=0;k<f.GetNumRows();k++)
+  {
+    if(!f.ReadRow(&entries[3*k]))
+    {
+      throw std::runtime_error("Time index " + filename + ".index is shorter than its header says");
+    }
+  }
+  f.Close();
+}
+
+void TimeIndex::Open(MappedReader & index)
+{
+  if(index.GetNumColumns() != 3)
+  {
+    throw std::runtime_error("Unexpected number of columns in time index");
+  }
+  entries.assign(index.GetRow(0),index.GetRow(index.GetNumRows()));
+}
+
+std::size_t TimeIndex::GetNumEntries(void)
+{
+  return entries.size()/3;
+}
+
+double TimeIndex::GetTime(std::size_t k)
+{
+  return entries[3*k];
+}
+
+uint64_t TimeIndex::GetRow(std::size_t k)
+{
+  return uint64_t(entries[3*k+1]);
+}
+
+uint64_t TimeIndex::GetOffset(std::size_t k)
+{
+  return uint64_t(entries[3*k+2]);
+}
+
+std::size_t TimeIndex::FindEntry(double time)
+{
+  std::size_t low = 0, high = GetNumEntries();
+  while(low < high)
+  {
+    std::size_t middle = low + (high - low)/2;
+    if(GetTime(middle) <= time)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  return low > 0 ? low - 1 : 0;
+}
@@ -0,0 +1,362 @@
+/*
+binary.h
+Class definitions for reading and writing the binary output format
+*/
+
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <stdint.h>
+#include "helper.h"
+
+// Header at the start of every binary output file
+//
+// The header is followed by <num_rows> rows of <num_columns> doubles, stored
+// row by row in native byte order. The rows are the same as the rows of the
+// equivalent text output file.
+//
+struct BinaryHeader {
+  /* Identifies the file type; always "EBTEL++" followed by a null byte */
+  char magic[8];
+  /* Version of the format */
+  uint32_t version;
+  /* Number of doubles in each row */
+  uint32_t num_columns;
+  /* Number of rows */
+  uint64_t num_rows;
+};
+
+// Binary writer object
+//
+// Writes rows to a file in the binary output format. The header is written
+// when the file is opened and rewritten with the final number of rows when
+// the file is closed.
+//
+class BinaryWriter {
+private:
+  /* Output stream */
+  std::ofstream f;
+
+  /* Path to the file being written */
+  std::string filename;
+
+  /* Header of the file being written */
+  BinaryHeader header;
+
+public:
+  /* Default constructor */
+  BinaryWriter(void);
+
+  /* Destructor; closes the file if it is still open */
+  ~BinaryWriter(void);
+
+  // Open file for writing
+  // @filename path to the file
+  // @num_columns number of doubles in each row
+  //
+  void Open(std::string filename, int num_columns);
+
+  // Append a row
+  // @row pointer to <num_columns> doubles
+  //
+  void WriteRow(const double * row);
+
+  // Write the final header and close the file
+  //
+  void Close(void);
+
+  // Close the file without finishing it and delete it
+  //
+  // Also deletes a file that has already been closed. Does nothing if no file
+  // has been opened since the last call.
+  //
+  void Discard(void);
+
+  // @return true if a file is open for writing
+  //
+  bool IsOpen(void);
+
+  // @return byte offset in the file at which the next row will be written
+  //
+  uint64_t GetOffset(void);
+};
+
+// Binary reader object
+//
+// Reads rows one at a time from a file in the binary output format.
+//
+class BinaryReader {
+private:
+  /* Input stream */
+  std::ifstream f;
+
+  /* Header of the file being read */
+  BinaryHeader header;
+
+public:
+  /* Default constructor */
+  BinaryReader(void);
+
+  // Open file for reading
+  // @filename path to the file
+  //
+  // Throws if the file cannot be opened or is not in the binary output format.
+  //
+  void Open(std::string filename);
+
+  // Read the next row
+  // @row pointer to space for <num_columns> doubles
+  //
+  // @return false if there are no rows left
+  //
+  bool ReadRow(double * row);
+
+  // Close the file
+  //
+  void Close(void);
+
+  // @return number of doubles in each row
+  //
+  int GetNumColumns(void);
+
+  // @return number of rows in the file
+  //
+  uint64_t GetNumRows(void);
+};
+
+// Results reader object
+//
+// Reads rows one at a time from an output file in either the text or the
+// binary output format, telling them apart by the header of the binary format.
+//
+class ResultsReader {
+private:
+  /* Reader used if the file is in the binary output format */
+  BinaryReader f_binary;
+
+  /* Input stream used if the file is in the text output format */
+  std::ifstream f_text;
+
+  /* True if the file is in the binary output format */
+  bool binary;
+
+  /* Number of doubles in each row */
+  int num_columns;
+
+  /* First row of a text file, read to count its columns */
+  std::vector<double> first_row;
+
+  /* True until <first_row> has been returned */
+  bool first_row_pending;
+
+  // Parse one line of a text file into <row>
+  //
+  // @return number of values read
+  //
+  static int ParseLine(const std::string & line, std::vector<double> & row);
+
+public:
+  /* Default constructor */
+  ResultsReader(void);
+
+  // Open file for reading
+  // @filename path to the file
+  //
+  // Throws if the file cannot be opened.
+  //
+  void Open(std::string filename);
+
+  // Read the next row
+  // @row pointer to space for <num_columns> doubles
+  //
+  // Throws if a row of a text file has too few values.
+  //
+  // @return false if there are no rows left
+  //
+  bool ReadRow(double * row);
+
+  // Close the file
+  //
+  void Close(void);
+
+  // @return number of doubles in each row; 0 for an empty text file
+  //
+  int GetNumColumns(void);
+};
+
+// Memory-mapped reader object
+//
+// Maps a file in the binary output format into memory so that any row can be
+// read in place without reading the rest of the file; only the pages holding
+// the rows used are read from disk. The binary file may also be part of a
+// larger file, e.g. a member of an ensemble container, in which case only that
+// part is mapped. On systems without mmap the file is read into memory instead.
+//
+class MappedReader {
+private:
+  /* Start and length of the binary file */
+  const char * data;
+  std::size_t size;
+
+  /* Start and length of the mapping, which starts on a page boundary at or before <data> */
+  void * mapping;
+  std::size_t mapping_size;
+
+  /* Copy of the file on systems without mmap */
+  std::vector<char> buffer;
+
+  /* Header of the file */
+  BinaryHeader header;
+
+  /* First row of the file */
+  const double * rows;
+
+  /* Not copyable, since each copy would unmap the file */
+  MappedReader(const MappedReader &);
+  MappedReader & operator=(const MappedReader &);
+
+public:
+  /* Default constructor */
+  MappedReader(void);
+
+  /* Destructor; unmaps the file if it is still open */
+  ~MappedReader(void);
+
+  // Map a file
+  // @filename path to the file
+  // @offset byte offset at which the binary file starts within <filename>
+  // @length length of the binary file (in bytes); 0 if it runs to the end of <filename>
+  //
+  // Throws if the file cannot be opened, is not in the binary output format, or
+  // is shorter than its header says.
+  //
+  void Open(std::string filename, uint64_t offset=0, uint64_t length=0);
+
+  // Unmap the file
+  //
+  void Close(void);
+
+  // @return true if a file is mapped
+  //
+  bool IsOpen(void);
+
+  // @return number of doubles in each row
+  //
+  int GetNumColumns(void);
+
+  // @return number of rows in the file
+  //
+  uint64_t GetNumRows(void);
+
+  // @return pointer to row <i>, valid until the file is closed
+  //
+  const double * GetRow(uint64_t i);
+
+  // Find a row by the value of its first column, e.g. the time
+  // @value value to look for
+  // @first_row first row searched
+  //
+  // The first column must be non-decreasing from <first_row> on.
+  //
+  // @return index of the first row from <first_row> on whose first column is at
+  // least <value>, or the number of rows if there is none
+  //
+  uint64_t FindRow(double value, uint64_t first_row=0);
+};
+
+// Time index writer object
+//
+// Writes a sparse index of the rows of an output file, so that readers can find
+// the rows around a given time without scanning the file, to `<file>.index`.
+// The index is itself in the binary output format, with one row per entry
+// holding the time of the row, its index in the file, counting from 0, and the
+// byte offset at which it starts. There is an entry for every <interval>th
+// row, starting with the first row added.
+//
+class TimeIndexWriter {
+private:
+  /* Index file */
+  BinaryWriter f;
+
+  /* Number of rows between entries */
+  int interval;
+
+  /* Index in the file of the first row added and of the next row added */
+  uint64_t first_row;
+  uint64_t row;
+
+public:
+  /* Default constructor */
+  TimeIndexWriter(void);
+
+  // Open the index of a file
+  // @filename path to the file indexed; the index is written to this path suffixed by `.index`
+  // @interval number of rows between entries
+  // @first_row index in the file of the first row added, e.g. 1 if the file starts with a row that is not indexed
+  //
+  void Open(std::string filename, int interval, uint64_t first_row=0);
+
+  // @return true if the next row added gets an entry, so its offset is needed
+  //
+  bool IsDue(void);
+
+  // Add a row
+  // @time time of the row (in s)
+  // @offset byte offset of the row in the file; only used if <IsDue>
+  //
+  void AddRow(double time, uint64_t offset);
+
+  // Close the index file
+  //
+  void Close(void);
+
+  // @return true if an index is open for writing
+  //
+  bool IsOpen(void);
+};
+
+// Time index reader object
+//
+// Reads the index written by <TimeIndexWriter>.
+//
+class TimeIndex {
+private:
+  /* Time, row and byte offset of each entry */
+  std::vector<double> entries;
+
+public:
+  // Read the index of a file
+  // @filename path to the file indexed, not to the index itself
+  //
+  void Open(std::string filename);
+
+  // Read an index that is already mapped, e.g. one stored in an ensemble container
+  // @index mapped index file
+  //
+  void Open(MappedReader & index);
+
+  // @return number of entries
+  //
+  std::size_t GetNumEntries(void);
+
+  // @return time of entry <k> (in s)
+  //
+  double GetTime(std::size_t k);
+
+  // @return index in the file of the row of entry <k>
+  //
+  uint64_t GetRow(std::size_t k);
+
+  // @return byte offset in the file of the row of entry <k>
+  //
+  uint64_t GetOffset(std::size_t k);
+
+  // Find the entry to start reading from to reach a given time
+  // @time time to look for (in s)
+  //
+  // @return index of the last entry whose time is at most <time>, or 0 if there is none
+  //
+  std::size_t FindEntry(double time);
+};
+
+#endif
@@ -0,0 +1,111 @@
+/*
+canonical.cpp
+Functions for comparing the configurations of ensemble members
+*/
+
+#include "canonical.h"
+#include <map>
+#include <sstream>
+
+uint64_t HashString(const std::string & text)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for(std::size_t k=0;k<text.size();k++)
+  {
+    hash ^= (unsigned char)text[k];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string FormatHash(uint64_t hash)
+{
+  std::ostringstream hex;
+  hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return hex.str();
+}
+
+// @return <value> written the same way however it was written in the configuration file
+//
+static std::string CanonicalizeValue(std::string value)
+{
+  std::size_t first = value.find_first_not_of(" \t\r\n");
+  if(first == std::string::npos)
+  {
+    return "";
+  }
+  value = value.substr(first,value.find_last_not_of(" \t\r\n") - first + 1);
+  // Numbers are printed with enough digits to round trip
+  try
+  {
+    std::size_t end;
+    double number = std::stod(value,&end);
+    if(end == value.size())
+    {
+      std::ostringstream number_text;
+      number_text << std::setprecision(17) << number;
+      return number_text.str();
+    }
+  }
+  catch(std::exception &e) {}
+  std::string lower = value;
+  std::transform(lower.begin(),lower.end(),lower.begin(),::tolower);
+  if(lower.compare("true")==0 || lower.compare("false")==0)
+  {
+    return lower;
+  }
+  return value;
+}
+
+// Add a line for each element below <node> and each of their attributes to <lines>
+// @node element whose children are added
+// @path path of <node> from the root element
+//
+static void CanonicalizeChildren(tinyxml2::XMLElement * node, std::string path, std::vector<std::string> & lines)
+{
+  // Elements of the same name are told apart by their position
+  std::map<std::string,int> counts;
+  for(tinyxml2::XMLElement *child = node->FirstChildElement();child != NULL;child=child->NextSiblingElement())
+  {
+    std::string name = child->Name();
+    if(path.empty() && name.compare("output_filename")==0)
+    {
+      continue;
+    }
+    std::string child_path = path + "/" + name + "[" + std::to_string(counts[name]++) + "]";
+    const char * text = child->GetText();
+    lines.push_back(child_path + "=" + CanonicalizeValue(text == NULL ? "" : text));
+    for(const tinyxml2::XMLAttribute *attribute = child->FirstAttribute();attribute != NULL;attribute=attribute->Next())
+    {
+      lines.push_back(child_path + "@" + attribute->Name() + "=" + CanonicalizeValue(attribute->Value()));
+    }
+    CanonicalizeChildren(child,child_path,lines);
+  }
+}
+
+CanonicalConfig CanonicalizeConfig(std::string config)
+{
+  tinyxml2::XMLDocument doc;
+  if(doc.LoadFile(config.c_str()) != 0)
+  {
+    throw std::runtime_error("Failed to load XML configuration file " + config);
+  }
+  tinyxml2::XMLElement * root = doc.FirstChildElement();
+  if(root == NULL)
+  {
+    throw std::runtime_error("Empty XML configuration file " + config);
+  }
+
+  std::vector<std::string> lines;
+  CanonicalizeChildren(root,"",lines);
+  std::sort(lines.begin(),lines.end());
+
+  CanonicalConfig canonical;
+  for(std::size_t k=0;k<lines.size();k++)
+  {
+    canonical.text += lines[k] + "\n";
+  }
+  canonical.hash = FormatHash(HashString(canonical.text));
+  canonical.output_filename = get_element_text(root,"output_filename");
+  return canonical;
+}
@@ -0,0 +1,47 @@
+/*
+canonical.h
+Functions for comparing the configurations of ensemble members
+*/
+
+#ifndef CANONICAL_H
+#define CANONICAL_H
+
+#include <stdint.h>
+#include "helper.h"
+
+// Canonical form of a configuration file
+//
+struct CanonicalConfig {
+  /* Every setting except the output filename, one per line, in a fixed order */
+  std::string text;
+  /* Hash of <text>, as 16 hexadecimal digits */
+  std::string hash;
+  /* Output filename given in the configuration file */
+  std::string output_filename;
+};
+
+// Hash a string
+// @text string to hash
+//
+// @return 64-bit FNV-1a hash of <text>
+//
+uint64_t HashString(const std::string & text);
+
+// @return <hash> as 16 hexadecimal digits
+//
+std::string FormatHash(uint64_t hash);
+
+// Canonicalize a configuration file
+// @config path to the configuration file
+//
+// Two configuration files that differ only in their output filename, in the
+// order of the parameters, in how numbers or booleans are written, e.g. `1e9`
+// and `1.0e+09` or `True` and `true`, or in whitespace and comments, give the
+// same canonical text and so the same results. The order of elements of the
+// same name, e.g. heating events, is kept. Throws if the file cannot be loaded.
+//
+// @return canonical form of the configuration
+//
+CanonicalConfig CanonicalizeConfig(std::string config);
+
+#endif
@@ -0,0 +1,621 @@
+/*
+container.cpp
+Methods for the single-file container of ensemble outputs
+*/
+
+#include "container.h"
+#include <cstring>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char CONTAINER_MAGIC[8] = {'E','B','T','E','L','C','O','N'};
+static const char RECORD_MAGIC[8] = {'E','B','T','E','L','R','E','C'};
+static const char INDEX_MAGIC[8] = {'E','B','T','E','L','I','D','X'};
+static const uint32_t CONTAINER_VERSION = 1;
+static const uint64_t CONTAINER_HEADER_SIZE = 16;
+// Length of the footer at the end of an index record: INDEX_MAGIC and the offset of the record
+static const uint64_t INDEX_FOOTER_SIZE = 16;
+// Bytes copied into the container with each write
+static const std::size_t COPY_BLOCK_SIZE = 8 << 20;
+
+// @return <size> rounded up to a multiple of 8
+//
+static uint64_t PadTo8(uint64_t size)
+{
+  return (size + 7) & ~uint64_t(7);
+}
+
+static void PutU32(std::string & out, uint32_t value)
+{
+  out.append(reinterpret_cast<const char *>(&value),sizeof(value));
+}
+
+static void PutU64(std::string & out, uint64_t value)
+{
+  out.append(reinterpret_cast<const char *>(&value),sizeof(value));
+}
+
+static void PutString(std::string & out, const std::string & value)
+{
+  PutU32(out,value.size());
+  out.append(value);
+}
+
+// Append the table of a member: its id, hash and files
+//
+static void PutMemberTable(std::string & out, const ContainerMember & member)
+{
+  PutString(out,member.id);
+  PutString(out,member.hash);
+  PutU32(out,member.files.size());
+  for(std::size_t k=0;k<member.files.size();k++)
+  {
+    PutString(out,member.files[k].suffix);
+    PutU64(out,member.files[k].offset);
+    PutU64(out,member.files[k].size);
+  }
+}
+
+static uint32_t GetU32(std::istream & f)
+{
+  uint32_t value;
+  if(!f.read(reinterpret_cast<char *>(&value),sizeof(value)))
+  {
+    throw std::runtime_error("Unexpected end of container");
+  }
+  return value;
+}
+
+static uint64_t GetU64(std::istream & f)
+{
+  uint64_t value;
+  if(!f.read(reinterpret_cast<char *>(&value),sizeof(value)))
+  {
+    throw std::runtime_error("Unexpected end of container");
+  }
+  return value;
+}
+
+static std::string GetString(std::istream & f)
+{
+  std::string value(GetU32(f),'\0');
+  if(!value.empty() && !f.read(&value[0],value.size()))
+  {
+    throw std::runtime_error("Unexpected end of container");
+  }
+  return value;
+}
+
+// Read the table of a member written by <PutMemberTable>
+//
+static ContainerMember GetMemberTable(std::istream & f)
+{
+  ContainerMember member;
+  member.id = GetString(f);
+  member.hash = GetString(f);
+  member.record = 0;
+  member.files.resize(GetU32(f));
+  for(std::size_t k=0;k<member.files.size();k++)
+  {
+    member.files[k].suffix = GetString(f);
+    member.files[k].offset = GetU64(f);
+    member.files[k].size = GetU64(f);
+  }
+  return member;
+}
+
+#ifdef __linux__
+// Input stream buffer that reads a file descriptor with pread
+//
+// Closing any descriptor of a file releases every record lock the process holds
+// on it, so a container that is locked is read through this buffer rather than
+// by opening it again.
+//
+class DescriptorBuffer : public std::streambuf {
+private:
+  /* File descriptor to read */
+  int fd;
+  /* Byte offset in the file of the start of <buffer> */
+  uint64_t base;
+  /* Bytes read from the file */
+  std::vector<char> buffer;
+
+protected:
+  int_type underflow(void)
+  {
+    if(gptr() < egptr())
+    {
+      return traits_type::to_int_type(*gptr());
+    }
+    base += egptr() - eback();
+    ssize_t length;
+    do
+    {
+      length = pread(fd,buffer.data(),buffer.size(),base);
+    } while(length < 0 && errno == EINTR);
+    if(length <= 0)
+    {
+      setg(buffer.data(),buffer.data(),buffer.data());
+      return traits_type::eof();
+    }
+    setg(buffer.data(),buffer.data(),buffer.data()+length);
+    return traits_type::to_int_type(*gptr());
+  }
+
+  pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which)
+  {
+    if(direction == std::ios_base::cur)
+    {
+      offset += base + (gptr() - eback());
+    }
+    else if(direction == std::ios_base::end)
+    {
+      struct stat info;
+      if(fstat(fd,&info) != 0)
+      {
+        return pos_type(off_type(-1));
+      }
+      offset += info.st_size;
+    }
+    return seekpos(offset,which);
+  }
+
+  pos_type seekpos(pos_type position, std::ios_base::openmode /*which*/)
+  {
+    uint64_t target = off_type(position);
+    // Keep the buffer if it holds the new position
+    if(target >= base && target <= base + (egptr() - eback()))
+    {
+      setg(eback(),eback() + (target - base),egptr());
+    }
+    else
+    {
+      base = target;
+      setg(buffer.data(),buffer.data(),buffer.data());
+    }
+    return position;
+  }
+
+public:
+  DescriptorBuffer(int descriptor) : fd(descriptor), base(0), buffer(1 << 16)
+  {
+    setg(buffer.data(),buffer.data(),buffer.data());
+  }
+};
+#endif
+
+ContainerReader::ContainerReader(void) : fd(-1), end(0)
+{
+  // Default constructor
+}
+
+void ContainerReader::Open(std::string container_filename)
+{
+  filename = container_filename;
+  fd = -1;
+  std::ifstream f(filename.c_str(),std::ios::in | std::ios::binary);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open container " + filename);
+  }
+  Read(f);
+}
+
+void ContainerReader::Open(std::string container_filename, int container_fd)
+{
+#ifdef __linux__
+  filename = container_filename;
+  fd = container_fd;
+  DescriptorBuffer buffer(fd);
+  std::istream f(&buffer);
+  Read(f);
+#else
+  throw std::runtime_error("Reading a container through a file descriptor is not supported on this platform");
+#endif
+}
+
+void ContainerReader::Read(std::istream & f)
+{
+  members.clear();
+  ids.clear();
+  char header[CONTAINER_HEADER_SIZE];
+  if(!f.read(header,CONTAINER_HEADER_SIZE) || !std::equal(CONTAINER_MAGIC,CONTAINER_MAGIC+8,header))
+  {
+    throw std::runtime_error(filename + " is not an ebtel++ ensemble container");
+  }
+  f.seekg(0,std::ios::end);
+  uint64_t file_size = f.tellg();
+  end = CONTAINER_HEADER_SIZE;
+
+  // Read the index at the end of the container, if it covers every record
+  if(file_size >= end + sizeof(ContainerRecordHeader) + INDEX_FOOTER_SIZE)
+  {
+    char footer[INDEX_FOOTER_SIZE];
+    uint64_t index_offset;
+    f.seekg(file_size - INDEX_FOOTER_SIZE);
+    f.read(footer,INDEX_FOOTER_SIZE);
+    std::memcpy(&index_offset,footer+8,sizeof(index_offset));
+    ContainerRecordHeader record;
+    if(f && std::equal(INDEX_MAGIC,INDEX_MAGIC+8,footer) && index_offset >= end && index_offset < file_size
+      && f.seekg(index_offset) && f.read(reinterpret_cast<char *>(&record),sizeof(record))
+      && std::equal(RECORD_MAGIC,RECORD_MAGIC+8,record.magic) && record.type == CONTAINER_INDEX && index_offset + record.size == file_size)
+    {
+      uint64_t num_members = GetU64(f);
+      for(uint64_t k=0;k<num_members;k++)
+      {
+        uint64_t record_offset = GetU64(f);
+        ContainerMember member = GetMemberTable(f);
+        member.record = record_offset;
+        AddMember(member);
+      }
+      end = file_size;
+      return;
+    }
+  }
+  f.clear();
+  Scan(f,file_size);
+}
+
+void ContainerReader::Update(void)
+{
+#ifdef __linux__
+  if(fd >= 0)
+  {
+    DescriptorBuffer buffer(fd);
+    std::istream f(&buffer);
+    f.seekg(0,std::ios::end);
+    Scan(f,f.tellg());
+    return;
+  }
+#endif
+  std::ifstream f(filename.c_str(),std::ios::in | std::ios::binary);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open container " + filename);
+  }
+  f.seekg(0,std::ios::end);
+  Scan(f,f.tellg());
+}
+
+void ContainerReader::Scan(std::istream & f, uint64_t file_size)
+{
+  ContainerRecordHeader record;
+  while(end + sizeof(record) <= file_size)
+  {
+    f.clear();
+    f.seekg(end);
+    // Stop at a record that is cut short
+    if(!f.read(reinterpret_cast<char *>(&record),sizeof(record)) || !std::equal(RECORD_MAGIC,RECORD_MAGIC+8,record.magic)
+      || record.size < sizeof(record) || record.size % 8 != 0 || record.size > file_size - end)
+    {
+      break;
+    }
+    if(record.type == CONTAINER_MEMBER)
+    {
+      ContainerMember member = GetMemberTable(f);
+      member.record = end;
+      AddMember(member);
+    }
+    end += record.size;
+  }
+}
+
+void ContainerReader::AddMember(const ContainerMember & member)
+{
+  ids[member.id] = members.size();
+  members.push_back(member);
+}
+
+std::size_t ContainerReader::GetNumMembers(void)
+{
+  return members.size();
+}
+
+const ContainerMember & ContainerReader::GetMember(std::size_t k)
+{
+  return members[k];
+}
+
+long ContainerReader::FindMember(std::string id)
+{
+  std::map<std::string, std::size_t>::iterator entry = ids.find(id);
+  return entry == ids.end() ? -1 : long(entry->second);
+}
+
+std::vector<std::size_t> ContainerReader::FindMembersByHash(std::string hash)
+{
+  std::vector<std::size_t> matches;
+  for(std::size_t k=0;k<members.size();k++)
+  {
+    if(members[k].hash.compare(hash)==0)
+    {
+      matches.push_back(k);
+    }
+  }
+  return matches;
+}
+
+const ContainerFile & ContainerReader::FindFile(std::size_t k, std::string suffix)
+{
+  for(std::size_t j=0;j<members[k].files.size();j++)
+  {
+    if(members[k].files[j].suffix.compare(suffix)==0)
+    {
+      return members[k].files[j];
+    }
+  }
+  throw std::runtime_error("Member " + members[k].id + " of " + filename + " has no output " + (suffix.empty() ? "results" : suffix));
+}
+
+uint64_t ContainerReader::GetEnd(void)
+{
+  return end;
+}
+
+std::string ContainerReader::GetFilename(void)
+{
+  return filename;
+}
+
+ContainerWriter::ContainerWriter(std::string container_filename) : filename(container_filename)
+{
+  std::string header(CONTAINER_MAGIC,8);
+  PutU32(header,CONTAINER_VERSION);
+  PutU32(header,0);
+#ifdef __linux__
+  fd = open(filename.c_str(),O_RDWR | O_CREAT | O_APPEND,0644);
+  if(fd < 0)
+  {
+    throw std::runtime_error("Failed to open container " + filename);
+  }
+#else
+  fd = -1;
+  f.open(filename.c_str(),std::ios::in | std::ios::out | std::ios::binary | std::ios::app);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open container " + filename);
+  }
+#endif
+  Lock(true);
+  try
+  {
+    if(GetEnd() == 0)
+    {
+      Append(header.data(),header.size());
+    }
+#ifdef __linux__
+    index.Open(filename,fd);
+#else
+    index.Open(filename);
+#endif
+    // Drop a record that was cut short so that new records follow the last complete one
+    if(index.GetEnd() < GetEnd())
+    {
+      std::cout << "Removing incomplete record at the end of container " << filename << std::endl;
+#ifdef __linux__
+      if(ftruncate(fd,index.GetEnd()) != 0)
+      {
+        throw std::runtime_error("Failed to truncate container " + filename);
+      }
+#else
+      throw std::runtime_error("Container " + filename + " ends in an incomplete record");
+#endif
+    }
+  }
+  catch(std::exception &e)
+  {
+    Lock(false);
+#ifdef __linux__
+    close(fd);
+#endif
+    throw;
+  }
+  Lock(false);
+}
+
+ContainerWriter::~ContainerWriter(void)
+{
+#ifdef __linux__
+  close(fd);
+#else
+  f.close();
+#endif
+}
+
+void ContainerWriter::Lock(bool lock)
+{
+#ifdef __linux__
+  // Record locks are held per process, so they also exclude forked workers
+  struct flock lock_info;
+  std::memset(&lock_info,0,sizeof(lock_info));
+  lock_info.l_type = lock ? F_WRLCK : F_UNLCK;
+  lock_info.l_whence = SEEK_SET;
+  int status;
+  do
+  {
+    status = fcntl(fd,F_SETLKW,&lock_info);
+  } while(status != 0 && errno == EINTR);
+  if(status != 0)
+  {
+    throw std::runtime_error("Failed to lock container " + filename);
+  }
+#endif
+}
+
+uint64_t ContainerWriter::GetEnd(void)
+{
+#ifdef __linux__
+  return lseek(fd,0,SEEK_END);
+#else
+  f.seekp(0,std::ios::end);
+  return f.tellp();
+#endif
+}
+
+void ContainerWriter::Append(const char * bytes, std::size_t size)
+{
+#ifdef __linux__
+  while(size > 0)
+  {
+    ssize_t written = write(fd,bytes,size);
+    if(written < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if(written <= 0)
+    {
+      throw std::runtime_error("Failed to write to container " + filename);
+    }
+    bytes += written;
+    size -= written;
+  }
+#else
+  if(!f.write(bytes,size))
+  {
+    throw std::runtime_error("Failed to write to container " + filename);
+  }
+#endif
+}
+
+ContainerMember ContainerWriter::AppendRecord(ContainerMember member, const std::vector<std::string> & filenames)
+{
+  Lock(true);
+  uint64_t start = GetEnd();
+  try
+  {
+    // The table has the same length whatever the offsets, so place the files after it
+    ContainerRecordHeader record;
+    std::copy(RECORD_MAGIC,RECORD_MAGIC+8,record.magic);
+    record.type = CONTAINER_MEMBER;
+    record.reserved = 0;
+    std::string table;
+    PutMemberTable(table,member);
+    uint64_t offset = start + PadTo8(sizeof(record) + table.size());
+    for(std::size_t k=0;k<filenames.size();k++)
+    {
+      member.files[k].offset = offset;
+      offset = PadTo8(offset + member.files[k].size);
+    }
+    record.size = offset - start;
+    member.record = start;
+    table.assign(reinterpret_cast<const char *>(&record),sizeof(record));
+    PutMemberTable(table,member);
+    table.resize(PadTo8(table.size()),'\0');
+    Append(table.data(),table.size());
+
+    // Copy the files in large blocks
+    std::vector<char> block;
+    for(std::size_t k=0;k<filenames.size();k++)
+    {
+      std::ifstream f_in(filenames[k].c_str(),std::ios::in | std::ios::binary);
+      uint64_t remaining = member.files[k].size;
+      block.resize(std::min<uint64_t>(COPY_BLOCK_SIZE,PadTo8(remaining)));
+      while(remaining > 0)
+      {
+        std::size_t length = std::min<uint64_t>(block.size(),remaining);
+        if(!f_in.read(block.data(),length))
+        {
+          throw std::runtime_error("Failed to read " + filenames[k] + " into container " + filename);
+        }
+        remaining -= length;
+        // Pad the end of the file
+        if(remaining == 0)
+        {
+          std::fill(block.begin()+length,block.begin()+PadTo8(length),'\0');
+          length = PadTo8(length);
+        }
+        Append(block.data(),length);
+      }
+    }
+  }
+  catch(std::exception &e)
+  {
+    // Leave the container as it was for the other workers
+#ifdef __linux__
+    if(ftruncate(fd,start) != 0)
+    {
+      std::cerr << "Failed to remove incomplete record from container " << filename << std::endl;
+    }
+#endif
+    Lock(false);
+    throw;
+  }
+  Lock(false);
+  return member;
+}
+
+ContainerMember ContainerWriter::AddMember(std::string id, std::string hash, std::string output_filename, const std::vector<std::string> & filenames)
+{
+  ContainerMember member;
+  member.id = id;
+  member.hash = hash;
+  member.record = 0;
+  for(std::size_t k=0;k<filenames.size();k++)
+  {
+    if(filenames[k].compare(0,output_filename.size(),output_filename) != 0)
+    {
+      throw std::runtime_error("Output " + filenames[k] + " of " + id + " does not start with its output filename " + output_filename);
+    }
+    struct stat info;
+    if(stat(filenames[k].c_str(),&info) != 0)
+    {
+      throw std::runtime_error("Failed to find output " + filenames[k] + " of " + id);
+    }
+    ContainerFile file = {filenames[k].substr(output_filename.size()),0,uint64_t(info.st_size)};
+    member.files.push_back(file);
+  }
+  return AppendRecord(member,filenames);
+}
+
+void ContainerWriter::AddDuplicate(std::string id, const ContainerMember & original)
+{
+  ContainerMember member = original;
+  member.id = id;
+  AppendRecord(member,std::vector<std::string>());
+}
+
+void ContainerWriter::WriteIndex(void)
+{
+  Lock(true);
+  try
+  {
+    index.Update();
+    uint64_t start = GetEnd();
+    ContainerRecordHeader record;
+    std::copy(RECORD_MAGIC,RECORD_MAGIC+8,record.magic);
+    record.type = CONTAINER_INDEX;
+    record.reserved = 0;
+    record.size = 0;
+    std::string text(reinterpret_cast<const char *>(&record),sizeof(record));
+    PutU64(text,index.GetNumMembers());
+    for(std::size_t k=0;k<index.GetNumMembers();k++)
+    {
+      PutU64(text,index.GetMember(k).record);
+      PutMemberTable(text,index.GetMember(k));
+    }
+    text.resize(PadTo8(text.size()),'\0');
+    text.append(INDEX_MAGIC,8);
+    PutU64(text,start);
+    record.size = text.size();
+    text.replace(0,sizeof(record),reinterpret_cast<const char *>(&record),sizeof(record));
+    Append(text.data(),text.size());
+#ifdef __linux__
+    if(fdatasync(fd) != 0)
+    {
+      throw std::runtime_error("Failed to write container " + filename);
+    }
+#else
+    f.flush();
+#endif
+  }
+  catch(std::exception &e)
+  {
+    Lock(false);
+    throw;
+  }
+  Lock(false);
+}
@@ -0,0 +1,243 @@
+/*
+container.h
+Class definitions for the single-file container of ensemble outputs
+*/
+
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <map>
+#include <stdint.h>
+#include "helper.h"
+
+// Header at the start of every record of a container
+//
+// A container starts with a 16-byte header, "EBTELCON" followed by the
+// version and four reserved bytes, and is followed by records, one after
+// another. Each record is a multiple of 8 bytes long.
+//
+struct ContainerRecordHeader {
+  /* Identifies a record; always "EBTELREC" */
+  char magic[8];
+  /* Type of record; <CONTAINER_MEMBER> or <CONTAINER_INDEX> */
+  uint32_t type;
+  /* Unused; always 0 */
+  uint32_t reserved;
+  /* Length of the record, including this header (in bytes) */
+  uint64_t size;
+};
+
+// Record holding the output files of a member
+static const uint32_t CONTAINER_MEMBER = 1;
+// Record holding the index of every member before it
+static const uint32_t CONTAINER_INDEX = 2;
+
+// Output file stored in a container
+//
+struct ContainerFile {
+  /* Suffix of the file relative to the output filename of the member, e.g. empty for the results and `.terms` for the terms */
+  std::string suffix;
+  /* Byte offset of the contents of the file in the container */
+  uint64_t offset;
+  /* Length of the file (in bytes) */
+  uint64_t size;
+};
+
+// Member stored in a container
+//
+struct ContainerMember {
+  /* Identifier of the member, e.g. the path of its configuration file */
+  std::string id;
+  /* Hash of the canonical form of its configuration; see <CanonicalizeConfig> */
+  std::string hash;
+  /* Byte offset of its record in the container */
+  uint64_t record;
+  /* Output files of the member, results first */
+  std::vector<ContainerFile> files;
+};
+
+// Container reader object
+//
+// Reads the member index of a container. If the container ends with an index
+// record, the index is read from it with a single read. Otherwise, e.g. if the
+// ensemble writing the container was stopped before it finished, the index is
+// built by reading the table at the start of every member record. A record cut
+// short at the end of the container is ignored. The files of a member are read
+// in place with <MappedReader>, which maps only the part of the container that
+// holds them; see <OpenFile>.
+//
+class ContainerReader {
+private:
+  /* Path of the container */
+  std::string filename;
+
+  /* File descriptor to read the container through; -1 to open it by name */
+  int fd;
+
+  /* Every member, in the order they were added */
+  std::vector<ContainerMember> members;
+
+  /* Position in <members> of the last member added with each id */
+  std::map<std::string, std::size_t> ids;
+
+  /* Byte offset of the end of the last complete record */
+  uint64_t end;
+
+  // Add a member to <members> and <ids>
+  //
+  void AddMember(const ContainerMember & member);
+
+  // Read the member index from the start of the container
+  //
+  void Read(std::istream & f);
+
+  // Read the member records from <end> up to the end of the container
+  //
+  void Scan(std::istream & f, uint64_t file_size);
+
+public:
+  /* Default constructor */
+  ContainerReader(void);
+
+  // Open a container and read its member index
+  // @filename path of the container
+  //
+  // Throws if the file cannot be opened or is not a container.
+  //
+  void Open(std::string filename);
+
+  // Read the member index of a container that is already open
+  // @filename path of the container
+  // @fd file descriptor of the container, open for reading
+  //
+  // The container is only read with `pread`, never opened or closed, so any
+  // record locks the process holds on it are kept. Only available on Linux.
+  //
+  void Open(std::string filename, int fd);
+
+  // Read the members added to the container since it was opened or last updated
+  //
+  void Update(void);
+
+  // @return number of members
+  //
+  std::size_t GetNumMembers(void);
+
+  // @return member <k>, in the order they were added
+  //
+  const ContainerMember & GetMember(std::size_t k);
+
+  // Find a member by id
+  // @id identifier of the member
+  //
+  // @return position of the last member added with <id>; -1 if there is none
+  //
+  long FindMember(std::string id);
+
+  // Find the members run with the same configuration
+  // @hash hash of the canonical form of the configuration
+  //
+  // @return position of every member with <hash>
+  //
+  std::vector<std::size_t> FindMembersByHash(std::string hash);
+
+  // Find an output file of a member
+  // @k position of the member
+  // @suffix suffix of the file, e.g. empty for the results
+  //
+  // @return the file; throws if the member has no file with <suffix>
+  //
+  const ContainerFile & FindFile(std::size_t k, std::string suffix);
+
+  // @return byte offset of the end of the last complete record
+  //
+  uint64_t GetEnd(void);
+
+  // @return path of the container
+  //
+  std::string GetFilename(void);
+};
+
+// Container writer object
+//
+// Appends the output files of ensemble members to a single container file, so
+// that an ensemble leaves one file behind rather than one to four per member.
+// Each member is appended as one record, holding a table of its files followed
+// by their contents, each starting on a multiple of 8 bytes so that the rows of
+// binary files can be read in place. A record is written with a few large
+// sequential writes while the container is locked, so several worker processes
+// may append to the same container. A member that duplicates one already in
+// the container is added as a record holding only a table that points at the
+// files of the other.
+//
+// The container is append-only. <WriteIndex> appends an index of every member
+// so that readers need not visit each record; a later index supersedes an
+// earlier one. A record cut short when a run was killed is removed when the
+// container is next opened for writing.
+//
+class ContainerWriter {
+private:
+  /* Path of the container */
+  std::string filename;
+
+  /* File descriptor of the container, open for appending */
+  int fd;
+
+  /* Output stream, if appending with a file descriptor is not available */
+  std::fstream f;
+
+  /* Members of the container, for the index; read through <fd> so that the lock is kept */
+  ContainerReader index;
+
+  // Lock or unlock the container against appends by other processes
+  //
+  void Lock(bool lock);
+
+  // @return byte offset of the end of the container
+  //
+  uint64_t GetEnd(void);
+
+  // Append bytes to the container
+  //
+  void Append(const char * bytes, std::size_t size);
+
+  // Append a record holding a table and the contents of <filenames>, which may be empty
+  //
+  ContainerMember AppendRecord(ContainerMember member, const std::vector<std::string> & filenames);
+
+public:
+  // Constructor
+  // @filename path of the container; created if it does not exist
+  //
+  // Throws if the file exists and is not a container.
+  //
+  ContainerWriter(std::string filename);
+
+  // Destructor
+  //
+  ~ContainerWriter(void);
+
+  // Append a member
+  // @id identifier of the member, e.g. the path of its configuration file
+  // @hash hash of the canonical form of its configuration
+  // @output_filename output filename of the member
+  // @filenames output files of the member, results first; each must start with <output_filename>
+  //
+  // @return the member as stored, to pass to <AddDuplicate>
+  //
+  ContainerMember AddMember(std::string id, std::string hash, std::string output_filename, const std::vector<std::string> & filenames);
+
+  // Append a member whose outputs are identical to those of one already stored
+  // @id identifier of the member
+  // @original member returned by <AddMember>
+  //
+  void AddDuplicate(std::string id, const ContainerMember & original);
+
+  // Append an index of every member in the container
+  //
+  void WriteIndex(void);
+};
+// Pointer to the <ContainerWriter> class
+typedef ContainerWriter* CONTAINER;
+
+#endif
@@ -5,13 +5,24 @@ Methods for DEM class
 
 #include "dem.h"
 
+// @return attribute <name> of the <moments> element as a number
+//
+static double GetMomentsAttribute(tinyxml2::XMLElement * moments_node, const char * name)
+{
+  const char * value = moments_node->Attribute(name);
+  if(value == NULL)
+  {
+    throw std::runtime_error(std::string("The moments element of the DEM options has no ") + name + " attribute.");
+  }
+  return std::stod(value);
+}
 
-Dem::Dem(void)
+Dem::Dem(void) : num_threads(0), stream_rows(false), __num_streamed(0), __num_tasks(0)
 {
   // Default constructor
 }
 
-Dem::Dem(LOOP loop_object)
+Dem::Dem(LOOP loop_object) : num_threads(0), stream_rows(false), __num_streamed(0), __num_tasks(0)
 {
   loop = loop_object;
   // Set some parameters for later calculations
@@ -30,135 +41,564 @@ Dem::Dem(LOOP loop_object)
     __temperature[i] = temperature_min*pow(10.0,i*delta_temperature);
     __radiative_loss[i] = loop->CalculateRadiativeLoss(__temperature[i]);
   }
-  // Resize DEM arrays
-  dem_TR.resize(loop->parameters.N);
-  dem_corona.resize(loop->parameters.N);
+  // Precompute everything in the TR DEM that depends only on the bin
+  __conductivity.resize(nbins);
+  __sqrt_temperature.resize(nbins);
+  __temperature_m025.resize(nbins);
+  __equilibrium_factor.resize(nbins);
+  for(int i=0;i<nbins;i++)
+  {
+    __conductivity[i] = (SPITZER_ELECTRON_CONDUCTIVITY + SPITZER_ION_CONDUCTIVITY)*pow(__temperature[i],1.5);
+    __sqrt_temperature[i] = sqrt(__temperature[i]);
+    __temperature_m025[i] = pow(__temperature[i],-0.25);
+    __equilibrium_factor[i] = sqrt(2.0*(SPITZER_ELECTRON_CONDUCTIVITY+SPITZER_ION_CONDUCTIVITY)/7.0/__radiative_loss[i]);
+  }
+  __bins.temperature = __temperature.data();
+  __bins.radiative_loss = __radiative_loss.data();
+  __bins.conductivity = __conductivity.data();
+  __bins.sqrt_temperature = __sqrt_temperature.data();
+  __bins.temperature_m025 = __temperature_m025.data();
+  __bins.equilibrium_factor = __equilibrium_factor.data();
+  kernels = &GetDemKernels();
+  // Store one row per timestep, allocated in chunks as the integration proceeds
+  dem_TR.configure(nbins,256);
+  dem_corona.configure(nbins,256);
+  dem_state.configure(3,256);
+  // Keep one row more than the window, as for the results, which also leaves the
+  // previous row that the TR calculation may fall back to
+  if(loop->parameters.results_window_steps > 0)
+  {
+    dem_TR.set_capacity(loop->parameters.results_window_steps + 1);
+    dem_corona.set_capacity(loop->parameters.results_window_steps + 1);
+    dem_state.set_capacity(loop->parameters.results_window_steps + 1);
+  }
+
+  // Rows are written as soon as they are complete, so the pipeline is not used
+  // when only the last rows are kept or rows are spilled to disk
+  num_threads = std::stoi(get_optional_element_text(loop->parameters.dem_options,"threads","0"));
+  if(num_threads < 0)
+  {
+    throw std::runtime_error("Number of DEM threads must be non-negative.");
+  }
+  if(loop->parameters.results_window_steps > 0 || loop->parameters.max_memory > 0)
+  {
+    num_threads = 0;
+  }
+  if(num_threads > 0)
+  {
+    // Enough slots for every worker to be busy while the writer catches up
+    __num_tasks = 4*(num_threads + 1);
+    __tasks.reset(new DemTask[__num_tasks]);
+    // A row is written before its slot is reused, so rows need not outlive their slot
+    // and the one before it, which a negative TR DEM falls back to
+    dem_TR.set_capacity(__num_tasks+1);
+    dem_corona.set_capacity(__num_tasks+1);
+    for(long k=0;k<__num_tasks;k++)
+    {
+      __tasks[k].sequence.store(k);
+    }
+    __next_claim.store(0);
+    __num_submitted.store(0);
+    __num_to_write.store(-1);
+    __abort.store(false);
+    OpenOutput();
+    for(int k=0;k<num_threads;k++)
+    {
+      __workers.push_back(std::thread(&Dem::CalculateQueuedRows,this));
+    }
+    __writer = std::thread(&Dem::WriteQueuedRows,this);
+  }
+  else if(!loop->parameters.save_dem && loop->parameters.results_window_steps == 0)
+  {
+    // Keep the rows that may not yet be known to be printed and the one before them
+    stream_rows = true;
+    std::size_t capacity = loop->parameters.use_adaptive_solver ? 2 : 3;
+    dem_TR.set_capacity(capacity);
+    dem_corona.set_capacity(capacity);
+    dem_state.set_capacity(capacity);
+    OpenOutput();
+  }
 }
 
 Dem::~Dem(void)
 {
-  // Destructor--free some stuff here if needed
+  // Stop the pipeline if the integration ended early
+  if(num_threads > 0)
+  {
+    __abort.store(true);
+    NotifyQueue();
+    StopThreads();
+  }
+  // Scratch files are left over if the run failed before they were printed
+  tr_scratch.Discard();
+  corona_scratch.Discard();
+  state_scratch.Discard();
 }
 
-void Dem::CalculateDEM(int i)
+DemInputs Dem::GetInputs(double time)
 {
   state_type loop_state = loop->GetState();
-  double velocity = loop->CalculateVelocity(loop_state[3],loop_state[4],loop_state[0]);
-  double scale_height = loop->CalculateScaleHeight(loop_state[3],loop_state[4]);
-  double f_e = loop->CalculateThermalConduction(loop_state[3],loop_state[2],"electron");
-  double R_tr = loop->CalculateC1(loop_state[3],loop_state[4],loop_state[2])*pow(loop_state[2],2)*loop->CalculateRadiativeLoss(loop_state[3])*loop->parameters.loop_length;
+  const Intermediates & intermediates = loop->GetIntermediates();
+  DemInputs inputs;
+  inputs.time = time;
+  inputs.temperature_e = loop_state[3];
+  inputs.density = loop_state[2];
+  inputs.pressure_e = loop_state[0];
+  inputs.velocity = intermediates.velocity;
+  inputs.scale_height = intermediates.scale_height;
+  inputs.f_e = intermediates.f_e;
+  inputs.R_tr = intermediates.R_tr;
+  return inputs;
+}
+
+void Dem::CalculateDEM(int i, double time)
+{
+  if(num_threads > 0)
+  {
+    SubmitDEM(i,time);
+    return;
+  }
+
+  DemInputs inputs = GetInputs(time);
+  if((std::size_t)i >= dem_TR.size())
+  {
+    dem_TR.resize(i+1);
+    dem_corona.resize(i+1);
+    dem_state.resize(i+1);
+  }
+  double * state = dem_state.row(i);
+  state[0] = time;
+  state[1] = inputs.density;
+  state[2] = inputs.pressure_e;
+  double * row_tr = dem_TR.row(i);
+  double * row_corona = dem_corona.row(i);
+  if(CalculateDEMRow(inputs,row_tr,row_corona))
+  {
+    ReplaceNegativeDEMTR(i,inputs,i>0 ? dem_TR.row(i-1) : NULL,row_tr);
+  }
+  if(stream_rows)
+  {
+    for(;IsRowPrinted(__num_streamed,i+1);__num_streamed++)
+    {
+      WriteRow(dem_state.row(__num_streamed),dem_TR.row(__num_streamed),dem_corona.row(__num_streamed));
+    }
+  }
+}
+
+bool Dem::CalculateDEMRow(const DemInputs & inputs,double * row_tr,double * row_corona)
+{
   // Calculate coronal temperature range
-  double temperature_corona_max = fmax(loop_state[3]/loop->CalculateC2(),1.1e+4);
-  double temperature_corona_min = fmax(loop_state[3]*(2.0 - 1.0/loop->CalculateC2()),1.0e+4);
+  double temperature_corona_max = fmax(inputs.temperature_e/loop->CalculateC2(),1.1e+4);
+  double temperature_corona_min = fmax(inputs.temperature_e*(2.0 - 1.0/loop->CalculateC2()),1.0e+4);
+  double temperature_tr_max = loop->CalculateC3()/loop->CalculateC2()*inputs.temperature_e;
   // Calculate coronal emission
   double delta_temperature = pow(10.0,0.5/100.0)*temperature_corona_max - pow(10.0,-0.5/100.0)*temperature_corona_min;
-  double coronal_emission = 2.0*pow(loop_state[2],2)*loop->parameters.loop_length/delta_temperature;
+  double coronal_emission = 2.0*pow(inputs.density,2)*loop->parameters.loop_length/delta_temperature;
 
-  bool dem_tr_negative = false;
-  std::vector<double> tmp_dem_corona(__temperature.size()), tmp_dem_tr(__temperature.size());
+  // The TR DEM is only calculated below the TR temperature limit
+  int num_tr_bins = std::lower_bound(__temperature.begin(),__temperature.end(),temperature_tr_max) - __temperature.begin();
+  DemRowTerms terms = CalculateDEMTRTerms(inputs);
+  if(use_new_method)
+  {
+    kernels->tr_new(num_tr_bins,__bins,terms,row_tr);
+  }
+  else
+  {
+    kernels->tr_old(num_tr_bins,__bins,terms,row_tr);
+  }
 
-  for(int j=0;j<__temperature.size();j++)
+  bool dem_tr_negative = false;
+  for(int j=0;j<(int)__temperature.size();j++)
   {
     // Coronal DEM
-    tmp_dem_corona[j] = 0.0;
+    row_corona[j] = 0.0;
     if(__temperature[j]<=temperature_corona_max && __temperature[j]>=temperature_corona_min)
     {
-      tmp_dem_corona[j] = coronal_emission;
+      row_corona[j] = coronal_emission;
     }
     // Transition Region DEM
-    tmp_dem_tr[j] = 0.0;
-    if(__temperature[j]<loop->CalculateC3()/loop->CalculateC2()*loop_state[3])
+    if(j >= num_tr_bins)
+    {
+      row_tr[j] = 0.0;
+    }
+    else if(row_tr[j] < 0.0)
+    {
+      dem_tr_negative = true;
+    }
+  }
+
+  return dem_tr_negative;
+}
+
+void Dem::ReplaceNegativeDEMTR(int i,const DemInputs & inputs,const double * previous_row_tr,double * row_tr)
+{
+  std::cout << "Negative DEM at timestep " << i << std::endl;
+  if(i == 0)
+  {
+    return;
+  }
+  double temperature_tr_max = loop->CalculateC3()/loop->CalculateC2()*inputs.temperature_e;
+  for(std::size_t j=0;j<__temperature.size();j++)
+  {
+    row_tr[j] = __temperature[j]<temperature_tr_max ? previous_row_tr[j] : 0.0;
+  }
+}
+
+bool Dem::IsRowPrinted(long i, long num_rows)
+{
+  long lookahead = loop->parameters.use_adaptive_solver ? 1 : 2;
+  bool past_last_step = !loop->parameters.use_adaptive_solver && i >= (long)loop->parameters.N;
+  return i+lookahead < num_rows && !past_last_step;
+}
+
+void Dem::SubmitDEM(int i, double time)
+{
+  DemTask & task = __tasks[i%__num_tasks];
+  // Wait for the writer to free the slot
+  {
+    std::unique_lock<std::mutex> lock(__queue_mutex);
+    __queue_changed.wait(lock,[&]{ return task.sequence.load(std::memory_order_acquire) == i; });
+  }
+  task.inputs = GetInputs(time);
+  // Only this thread changes the arenas; rows never move once allocated
+  if((std::size_t)i >= dem_TR.size())
+  {
+    dem_TR.resize(i+1);
+    dem_corona.resize(i+1);
+  }
+  task.row_tr = dem_TR.row(i);
+  task.row_corona = dem_corona.row(i);
+  task.sequence.store(i+1,std::memory_order_release);
+  __num_submitted.store(i+1);
+  NotifyQueue();
+}
+
+void Dem::NotifyQueue(void)
+{
+  // Taking the lock orders the change before any waiter checks its condition
+  {
+    std::lock_guard<std::mutex> lock(__queue_mutex);
+  }
+  __queue_changed.notify_all();
+}
+
+void Dem::CalculateQueuedRows(void)
+{
+  while(true)
+  {
+    long i = __next_claim.fetch_add(1);
+    DemTask & task = __tasks[i%__num_tasks];
     {
-      if(dem_tr_negative && i>0)
+      // Stop once the integration has finished and there is nothing left to claim
+      std::unique_lock<std::mutex> lock(__queue_mutex);
+      __queue_changed.wait(lock,[&]{
+        return task.sequence.load(std::memory_order_acquire) == i+1 || __abort.load() || (__num_to_write.load() >= 0 && i >= __num_submitted.load());
+      });
+      if(task.sequence.load(std::memory_order_acquire) != i+1)
       {
-        tmp_dem_tr[j] = dem_TR[i-1][j];
+        return;
       }
-      else
-      {
-        tmp_dem_tr[j] = CalculateDEMTR(j,loop_state[2],velocity,loop_state[0],scale_height,R_tr,f_e);
-        if(tmp_dem_tr[j] < 0.0)
+    }
+    task.negative = CalculateDEMRow(task.inputs,task.row_tr,task.row_corona);
+    task.sequence.store(i+2,std::memory_order_release);
+    NotifyQueue();
+  }
+}
+
+void Dem::WriteQueuedRows(void)
+{
+  const double * previous_row_tr = NULL;
+  for(long i=0;;i++)
+  {
+    DemTask & task = __tasks[i%__num_tasks];
+    // Until the number of rows is known only rows known to be printed are written
+    {
+      std::unique_lock<std::mutex> lock(__queue_mutex);
+      bool finished = false;
+      __queue_changed.wait(lock,[&]{
+        long num_to_write = __num_to_write.load();
+        if(__abort.load() || (num_to_write >= 0 && i >= num_to_write))
         {
-          dem_tr_negative=true;
-          std::cout << "Negative DEM at timestep " << i << std::endl;
-          j = -1;
-          continue;
+          finished = true;
+          return true;
         }
+        return task.sequence.load(std::memory_order_acquire) == i+2 && (num_to_write >= 0 || IsRowPrinted(i,__num_submitted.load()));
+      });
+      if(finished)
+      {
+        return;
       }
     }
+    if(task.negative)
+    {
+      ReplaceNegativeDEMTR(i,task.inputs,previous_row_tr,task.row_tr);
+    }
+    double state[3] = {task.inputs.time,task.inputs.density,task.inputs.pressure_e};
+    WriteRow(state,task.row_tr,task.row_corona);
+    previous_row_tr = task.row_tr;
+    task.sequence.store(i+__num_tasks,std::memory_order_release);
+    NotifyQueue();
   }
-  if(i>=loop->parameters.N)
+}
+
+void Dem::StopThreads(void)
+{
+  for(std::size_t k=0;k<__workers.size();k++)
   {
-    dem_TR.push_back(tmp_dem_tr);
-    dem_corona.push_back(tmp_dem_corona);
+    __workers[k].join();
   }
-  else
+  __workers.clear();
+  if(__writer.joinable())
   {
-    dem_TR[i] = tmp_dem_tr;
-    dem_corona[i] = tmp_dem_corona;
+    __writer.join();
   }
 }
 
-void Dem::PrintToFile(int num_steps)
+std::size_t Dem::GetMemory(void)
+{
+  return dem_TR.memory() + dem_corona.memory() + dem_state.memory();
+}
+
+void Dem::SpillToDisk(void)
+{
+  // Streamed rows are not kept
+  if(stream_rows)
+  {
+    return;
+  }
+  std::size_t rows_per_chunk = dem_TR.rows_per_chunk();
+
+  // Keep the chunk holding the most recent row; it is needed if the next TR DEM is negative
+  while(dem_TR.first() + rows_per_chunk < dem_TR.size())
+  {
+    if(!tr_scratch.IsOpen())
+    {
+      tr_scratch.Open(loop->parameters.output_filename+".dem_tr.scratch",__temperature.size());
+      corona_scratch.Open(loop->parameters.output_filename+".dem_corona.scratch",__temperature.size());
+      state_scratch.Open(loop->parameters.output_filename+".dem_state.scratch",3);
+    }
+    for(std::size_t i=dem_TR.first();i<dem_TR.first()+rows_per_chunk;i++)
+    {
+      tr_scratch.WriteRow(dem_TR.row(i));
+      corona_scratch.WriteRow(dem_corona.row(i));
+      state_scratch.WriteRow(dem_state.row(i));
+    }
+    dem_TR.release_front();
+    dem_corona.release_front();
+    dem_state.release_front();
+  }
+}
+
+void Dem::OpenOutput(void)
 {
-  // Open file streams
-  std::ofstream f_corona;
-  std::ofstream f_tr;
+  if(loop->parameters.save_dem_moments)
+  {
+    tinyxml2::XMLElement * moments_node = get_element(loop->parameters.dem_options,"moments");
+    moments.reset(new DemMoments(__temperature,GetMomentsAttribute(moments_node,"slope_log_min"),GetMomentsAttribute(moments_node,"slope_log_max"),
+                                 moments_node->Attribute("window") == NULL ? 0.0 : std::stod(moments_node->Attribute("window")),
+                                 loop->parameters.output_filename+".dem_moments",loop->parameters.output_format.compare("binary")==0));
+  }
+  if(loop->parameters.save_dem_lines)
+  {
+    std::vector<std::string> filenames;
+    tinyxml2::XMLElement * lines_node = get_element(loop->parameters.dem_options,"lines");
+    for(tinyxml2::XMLElement * line_node=lines_node->FirstChildElement("line");line_node!=NULL;line_node=line_node->NextSiblingElement("line"))
+    {
+      filenames.push_back(line_node->GetText());
+    }
+    lines.reset(new LineSynthesis(filenames,__temperature,loop->parameters.output_filename+".lines",loop->parameters.output_format.compare("binary")==0));
+  }
+  if(!loop->parameters.save_dem)
+  {
+    return;
+  }
+  // The temperature row is not indexed
+  if(loop->parameters.index_interval > 0)
+  {
+    corona_index.Open(loop->parameters.output_filename+".dem_corona",loop->parameters.index_interval,1);
+    tr_index.Open(loop->parameters.output_filename+".dem_tr",loop->parameters.index_interval,1);
+  }
+  if(loop->parameters.output_format.compare("binary")==0)
+  {
+    f_binary_corona.Open(loop->parameters.output_filename+".dem_corona",__temperature.size());
+    f_binary_tr.Open(loop->parameters.output_filename+".dem_tr",__temperature.size());
+    f_binary_corona.WriteRow(__temperature.data());
+    f_binary_tr.WriteRow(__temperature.data());
+    return;
+  }
   f_corona.open(loop->parameters.output_filename+".dem_corona");
   f_tr.open(loop->parameters.output_filename+".dem_tr");
   // First row of each file is the temperature array
-  for(int j=0;j<__temperature.size();j++)
+  for(std::size_t j=0;j<__temperature.size();j++)
   {
     f_corona << __temperature[j] << "\t";
     f_tr << __temperature[j] << "\t";
   }
   f_corona << "\n";
   f_tr << "\n";
-  // Print TR and corona DEM at each timestep
-  for(int i=0;i<num_steps;i++)
+}
+
+void Dem::WriteRow(const double * state,const double * row_tr,const double * row_corona)
+{
+  if(moments)
   {
-    for(int j=0;j<dem_TR[i].size();j++)
-    {
-      f_corona << dem_corona[i][j] << "\t";
-      f_tr << dem_TR[i][j] << "\t";
-    }
-    f_corona << "\n";
-    f_tr << "\n";
+    moments->AddRow(state[0],row_tr,row_corona);
+  }
+  if(lines)
+  {
+    lines->AddRow(state[0],state[1],state[2],row_tr,row_corona);
+  }
+  if(!loop->parameters.save_dem)
+  {
+    return;
   }
+  if(tr_index.IsDue())
+  {
+    corona_index.AddRow(state[0],f_binary_corona.IsOpen() ? f_binary_corona.GetOffset() : uint64_t(f_corona.tellp()));
+    tr_index.AddRow(state[0],f_binary_tr.IsOpen() ? f_binary_tr.GetOffset() : uint64_t(f_tr.tellp()));
+  }
+  else
+  {
+    corona_index.AddRow(state[0],0);
+    tr_index.AddRow(state[0],0);
+  }
+  if(f_binary_tr.IsOpen())
+  {
+    f_binary_corona.WriteRow(row_corona);
+    f_binary_tr.WriteRow(row_tr);
+    return;
+  }
+  for(std::size_t j=0;j<__temperature.size();j++)
+  {
+    f_corona << row_corona[j] << "\t";
+    f_tr << row_tr[j] << "\t";
+  }
+  f_corona << "\n";
+  f_tr << "\n";
+}
 
-  // Close the file
+void Dem::CloseOutput(void)
+{
+  if(moments)
+  {
+    moments->Close();
+    moments.reset();
+  }
+  if(lines)
+  {
+    lines->Close();
+    lines.reset();
+  }
+  if(!loop->parameters.save_dem)
+  {
+    return;
+  }
+  corona_index.Close();
+  tr_index.Close();
+  if(f_binary_tr.IsOpen())
+  {
+    f_binary_corona.Close();
+    f_binary_tr.Close();
+    return;
+  }
   f_corona.close();
   f_tr.close();
 }
 
-double Dem::CalculateDEMTR(int j,double density,double velocity,double pressure,double scale_height,double R_tr,double f_e)
+void Dem::PrintToFile(int num_steps)
 {
-  double dem_tr;
-
-  if(use_new_method)
+  // Rows have been written by the pipeline; wait for the last of them
+  if(num_threads > 0)
   {
-    double a = (SPITZER_ELECTRON_CONDUCTIVITY + SPITZER_ION_CONDUCTIVITY)*pow(__temperature[j],1.5);
-    double b = -GAMMA*(1.0+ loop->parameters.boltzmann_correction)*BOLTZMANN_CONSTANT/GAMMA_MINUS_ONE*density*velocity;
-    double density_squared = pow(pressure/BOLTZMANN_CONSTANT/__temperature[j],2)*exp(4.0*loop->parameters.loop_length*sin(_PI_/5.0)/scale_height/_PI_);
-    double c = -density_squared*__radiative_loss[j];
-    double dTds_plus = (-b + sqrt(pow(b,2) - 4.0*a*c))/(2.0*a);
-    double dTds_minus = (-b - sqrt(pow(b,2) - 4.0*a*c))/(2.0*a);
-    double dTds = fmax(dTds_plus,dTds_minus);
-    dem_tr = 2.0*density_squared/dTds;
+    __num_to_write.store(num_steps);
+    NotifyQueue();
+    StopThreads();
+    CloseOutput();
+    return;
   }
-  else
+  // Rows have been passed on as they were calculated, apart from the last few
+  if(stream_rows)
   {
-    double dem_evap = GAMMA_MINUS_ONE*(SPITZER_ELECTRON_CONDUCTIVITY+SPITZER_ION_CONDUCTIVITY)/GAMMA/(1.0+loop->parameters.boltzmann_correction)/pow(BOLTZMANN_CONSTANT,3)*pow(pressure,2)/(density*velocity*sqrt(__temperature[j]));
-    double dem_condense = -GAMMA*(1.0 + loop->parameters.boltzmann_correction)*BOLTZMANN_CONSTANT*density*velocity/GAMMA_MINUS_ONE/__radiative_loss[j];
-    double dem_eqm = sqrt(2.0*(SPITZER_ELECTRON_CONDUCTIVITY+SPITZER_ION_CONDUCTIVITY)/7.0/__radiative_loss[j])*pressure/BOLTZMANN_CONSTANT*pow(__temperature[j],-0.25);
+    for(;__num_streamed<num_steps;__num_streamed++)
+    {
+      WriteRow(dem_state.row(__num_streamed),dem_TR.row(__num_streamed),dem_corona.row(__num_streamed));
+    }
+    CloseOutput();
+    return;
+  }
 
-    double f_e_plus_R_tr = f_e + R_tr;
-    if(f_e_plus_R_tr==0.0)
+  int first_in_memory = dem_TR.first();
+  bool spilled = tr_scratch.IsOpen();
+  std::vector<double> scratch_row_tr(__temperature.size()), scratch_row_corona(__temperature.size());
+  double scratch_state[3];
+  BinaryReader scratch_tr, scratch_corona, scratch_states;
+  if(spilled)
+  {
+    tr_scratch.Close();
+    corona_scratch.Close();
+    state_scratch.Close();
+    scratch_tr.Open(loop->parameters.output_filename+".dem_tr.scratch");
+    scratch_corona.Open(loop->parameters.output_filename+".dem_corona.scratch");
+    scratch_states.Open(loop->parameters.output_filename+".dem_state.scratch");
+  }
+
+  // Print TR and corona DEM at each timestep
+  OpenOutput();
+  for(int i=loop->GetWindowStart();i<num_steps;i++)
+  {
+    if(i < first_in_memory)
     {
-      f_e_plus_R_tr = 1.0e+10*f_e;
+      scratch_corona.ReadRow(scratch_row_corona.data());
+      scratch_tr.ReadRow(scratch_row_tr.data());
+      scratch_states.ReadRow(scratch_state);
+      WriteRow(scratch_state,scratch_row_tr.data(),scratch_row_corona.data());
     }
+    else
+    {
+      WriteRow(dem_state.row(i),dem_TR.row(i),dem_corona.row(i));
+    }
+  }
+  CloseOutput();
 
-    dem_tr = 2.0*(f_e*dem_evap - f_e*R_tr/f_e_plus_R_tr*dem_eqm + R_tr*dem_condense)/(f_e - f_e*R_tr/f_e_plus_R_tr + R_tr);
+  if(spilled)
+  {
+    scratch_tr.Close();
+    scratch_corona.Close();
+    scratch_states.Close();
+    tr_scratch.Discard();
+    corona_scratch.Discard();
+    state_scratch.Discard();
+  }
+}
+
+DemRowTerms Dem::CalculateDEMTRTerms(const DemInputs & inputs)
+{
+  DemRowTerms terms;
+  double density = inputs.density;
+  double velocity = inputs.velocity;
+  double pressure = inputs.pressure_e;
+
+  // New method
+  terms.enthalpy = -GAMMA*(1.0+ loop->parameters.boltzmann_correction)*BOLTZMANN_CONSTANT/GAMMA_MINUS_ONE*density*velocity;
+  terms.pressure_over_k = pressure/BOLTZMANN_CONSTANT;
+  terms.density_factor = exp(4.0*loop->parameters.loop_length*sin(_PI_/5.0)/inputs.scale_height/_PI_);
+
+  // Old method
+  terms.evaporation = GAMMA_MINUS_ONE*(SPITZER_ELECTRON_CONDUCTIVITY+SPITZER_ION_CONDUCTIVITY)/GAMMA/(1.0+loop->parameters.boltzmann_correction)/pow(BOLTZMANN_CONSTANT,3)*pow(pressure,2);
+  terms.density_velocity = density*velocity;
+  terms.condensation = -GAMMA*(1.0 + loop->parameters.boltzmann_correction)*BOLTZMANN_CONSTANT*density*velocity/GAMMA_MINUS_ONE;
+  terms.pressure = pressure;
+  double f_e = inputs.f_e;
+  double R_tr = inputs.R_tr;
+  double f_e_plus_R_tr = f_e + R_tr;
+  if(f_e_plus_R_tr==0.0)
+  {
+    f_e_plus_R_tr = 1.0e+10*f_e;
   }
+  terms.f_e = f_e;
+  terms.R_tr = R_tr;
+  terms.equilibrium_weight = f_e*R_tr/f_e_plus_R_tr;
+  terms.denominator = f_e - f_e*R_tr/f_e_plus_R_tr + R_tr;
 
-  return dem_tr;
+  return terms;
 }
@@ -6,12 +6,32 @@ Class definition for DEM object
 #ifndef DEM_H
 #define DEM_H
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 #include "helper.h"
 #include "loop.h"
+#include "kernels.h"
+#include "moments.h"
+#include "lines.h"
 #include "../rsp_toolkit/source/xmlreader.h"
 #include "../rsp_toolkit/source/file.h"
 #include "../rsp_toolkit/source/constants.h"
 
+// Loop quantities needed to calculate one row of the DEM
+//
+struct DemInputs {
+  double time;
+  double temperature_e;
+  double density;
+  double pressure_e;
+  double velocity;
+  double scale_height;
+  double f_e;
+  double R_tr;
+};
+
 // DEM object
 //
 // Class for holding all of the methods needed to calculate
@@ -21,9 +41,172 @@ Class definition for DEM object
 //
 class Dem{
 private:
-  // Calculate TR DEM
+  /* Scratch file for TR DEM rows written to disk to stay within <Parameters.max_memory> */
+  BinaryWriter tr_scratch;
+
+  /* Scratch file for coronal DEM rows written to disk to stay within <Parameters.max_memory> */
+  BinaryWriter corona_scratch;
+
+  /* Scratch file for the loop state of the DEM rows written to disk */
+  BinaryWriter state_scratch;
+
+  /* Time (in s), density (in cm^-3) and electron pressure (in dyne cm^-2) of each
+  DEM row; only used when the rows are not written as they are completed */
+  Arena<double> dem_state;
+
+  /* Emission measure moments, if they are printed */
+  std::unique_ptr<DemMoments> moments;
+
+  /* Line intensities, if they are printed */
+  std::unique_ptr<LineSynthesis> lines;
+
+  // Slot in the queue between the integrator, the DEM workers and the writer
+  //
+  // <sequence> says who owns the slot for timestep i: i when it is free for the
+  // integrator, i+1 when it is waiting for a worker, i+2 when it is waiting for the
+  // writer and i+<__num_tasks> once it has been written.
+  //
+  struct DemTask {
+    std::atomic<long> sequence;
+    DemInputs inputs;
+    double * row_tr;
+    double * row_corona;
+    bool negative;
+  };
+
+  /* Number of DEM worker threads; 0 calculates the DEM on the integrator thread */
+  int num_threads;
+
+  /* True if the DEM files are not printed, in which case rows calculated on the
+  integrator thread are passed to the moments and lines as soon as they are known
+  to be printed and only the last few are kept */
+  bool stream_rows;
+
+  /* Number of rows passed on so far when <stream_rows> is set */
+  long __num_streamed;
+
+  /* Ring of queue slots */
+  std::unique_ptr<DemTask[]> __tasks;
+
+  /* Number of queue slots */
+  long __num_tasks;
+
+  /* Next timestep to be claimed by a worker */
+  std::atomic<long> __next_claim;
+
+  /* Number of timesteps handed to the workers */
+  std::atomic<long> __num_submitted;
+
+  /* Number of rows to write; -1 until the integration has finished */
+  std::atomic<long> __num_to_write;
+
+  /* Set to stop the workers and writer early */
+  std::atomic<bool> __abort;
+
+  /* Threads waiting for a slot or counter to change block on <__queue_changed> */
+  std::mutex __queue_mutex;
+  std::condition_variable __queue_changed;
+
+  /* DEM worker threads */
+  std::vector<std::thread> __workers;
+
+  /* Writer thread */
+  std::thread __writer;
+
+  /* Output streams */
+  std::ofstream f_corona;
+  std::ofstream f_tr;
+  BinaryWriter f_binary_corona;
+  BinaryWriter f_binary_tr;
+
+  /* Time indexes of the output files, if they are written */
+  TimeIndexWriter corona_index;
+  TimeIndexWriter tr_index;
+
+  /* Per-bin quantities for the TR DEM kernels; see <DemBins> */
+  std::vector<double> __conductivity;
+  std::vector<double> __sqrt_temperature;
+  std::vector<double> __temperature_m025;
+  std::vector<double> __equilibrium_factor;
+  DemBins __bins;
+
+  /* TR DEM kernels for the instruction set selected at startup */
+  const DemKernels * kernels;
+
+  // Calculate the temperature-independent terms of a row of the TR DEM
+  //
+  DemRowTerms CalculateDEMTRTerms(const DemInputs & inputs);
+
+  // Collect the loop quantities for the current state
+  // @time current time (in s)
+  //
+  DemInputs GetInputs(double time);
+
+  // Calculate one row of the TR and coronal DEM
+  // @inputs loop quantities at this timestep
+  // @row_tr space for the TR DEM row
+  // @row_corona space for the coronal DEM row
   //
-  double CalculateDEMTR(int j,double density,double velocity,double pressure,double scale_height,double R_tr,double f_e);
+  // Only reads <__temperature> and <__radiative_loss>, so may be called from any thread.
+  //
+  // @return true if any TR DEM value is negative
+  //
+  bool CalculateDEMRow(const DemInputs & inputs,double * row_tr,double * row_corona);
+
+  // Replace a TR DEM row that has negative values
+  //
+  // Bins below the TR temperature limit take the value from the previous timestep
+  // and all others are set to zero. The first row is left as it is.
+  //
+  void ReplaceNegativeDEMTR(int i,const DemInputs & inputs,const double * previous_row_tr,double * row_tr);
+
+  // Check whether a row is printed before the number of rows is known
+  // @i index of the row
+  // @num_rows number of rows calculated so far
+  //
+  // The state after the last step is not printed, and with a static timestep
+  // neither is the state at the final time nor any past the first N steps.
+  //
+  // @return true if row <i> is known to be printed
+  //
+  bool IsRowPrinted(long i, long num_rows);
+
+  // Hand the current state to the DEM workers
+  //
+  void SubmitDEM(int i, double time);
+
+  // Wake the threads waiting on the queue after a slot or counter has changed
+  //
+  void NotifyQueue(void);
+
+  // Body of each DEM worker thread
+  //
+  void CalculateQueuedRows(void);
+
+  // Body of the writer thread
+  //
+  void WriteQueuedRows(void);
+
+  // Stop the worker and writer threads
+  //
+  void StopThreads(void);
+
+  // Open the output files and write the temperature row
+  //
+  void OpenOutput(void);
+
+  // Append one row to each output file
+  // @state time, density and electron pressure of the row, as stored in <dem_state>
+  // @row_tr TR DEM row
+  // @row_corona coronal DEM row
+  //
+  // Also adds the row to the moments and line intensities, if they are printed.
+  //
+  void WriteRow(const double * state,const double * row_tr,const double * row_corona);
+
+  // Close the output files
+  //
+  void CloseOutput(void);
 
 public:
   /* Loop object */
@@ -38,11 +221,11 @@ public:
   /* Radiative loss */
   std::vector<double> __radiative_loss;
 
-  /*Transition region DEM*/
-  std::vector<std::vector<double> > dem_TR;
+  /*Transition region DEM; one row of temperature bins per timestep */
+  Arena<double> dem_TR;
 
-  /*Coronal DEM*/
-  std::vector<std::vector<double> > dem_corona;
+  /*Coronal DEM; one row of temperature bins per timestep */
+  Arena<double> dem_corona;
 
   // Default constructor
   //
@@ -65,12 +248,26 @@ public:
 
   // Calculate DEM
   // @i Timestep index
+  // @time current time (in s)
   //
   // Front end for DEM calculations. Calls methods to calculate both
   // the transition region and coronal DEM across the entire specified
-  // temperature range.
+  // temperature range. If DEM threads are configured, the row is instead
+  // queued for the worker threads and this returns straight away.
+  //
+  void CalculateDEM(int i, double time);
+
+  // Memory used by stored DEM rows
+  //
+  // @return bytes allocated for <dem_TR>, <dem_corona> and their loop states
+  //
+  std::size_t GetMemory(void);
+
+  // Write completed DEM rows to disk
+  //
+  // Same as <Loop::SpillToDisk>, but for <dem_TR> and <dem_corona>.
   //
-  void CalculateDEM(int i);
+  void SpillToDisk(void);
 
   // Print results to file
   // @num_steps number of steps taken by the integration routine
@@ -78,7 +275,12 @@ public:
   // Print coronal and transition region DEM arrays to separate files.
   // The filenames are the output filename as given in <loop>,
   // suffixed by `.dem_corona` and `.dem_tr`, respectively. The first
-  // row of each file is the temperature vector, <__temperature>.
+  // row of each file is the temperature vector, <__temperature>. If
+  // <Parameters.save_dem_moments> is set, the moments of the same rows are
+  // printed to `.dem_moments`; see <DemMoments>. If <Parameters.save_dem_lines>
+  // is set, line intensities are printed to `.lines`; see <LineSynthesis>. If DEM
+  // threads are configured, the rows have already been written as they were
+  // completed and this waits for the last of them.
   //
   void PrintToFile(int num_steps);
 };
@@ -3,6 +3,7 @@ heater.cpp
 Class defnition for heater object
 */
 
+#include <limits>
 #include "heater.h"
 
 Heater::Heater(tinyxml2::XMLElement * heating_node)
@@ -55,3 +56,21 @@ double Heater::Get_Heating(double time)
 
   return heat;
 }
+
+double Heater::Get_Next_Breakpoint(double time)
+{
+  double breakpoint = std::numeric_limits<double>::infinity();
+  for(int i=0;i<num_events;i++)
+  {
+    double corners[4] = {time_start_rise[i],time_end_rise[i],time_start_decay[i],time_end_decay[i]};
+    for(int k=0;k<4;k++)
+    {
+      if(corners[k] > time)
+      {
+        breakpoint = std::fmin(breakpoint,corners[k]);
+      }
+    }
+  }
+
+  return breakpoint;
+}
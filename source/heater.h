@@ -69,6 +69,16 @@ public:
   //
   double Get_Heating(double time);
 
+  // Get the next change in the slope of the heating profile
+  // @time current time (in s)
+  //
+  // The heating rate is piecewise linear in time, with corners at the start and
+  // end of the rise and decay phase of each event.
+  //
+  // @return time of the first corner after <time> (in s); infinity if there is none
+  //
+  double Get_Next_Breakpoint(double time);
+
 };
 // Pointer to the <Heater> class
 typedef Heater* HEATER;
@@ -14,7 +14,10 @@ General purpose includes to be used everywhere
 #include <fstream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <thread>
 #include "boost/array.hpp"
+#include "arena.h"
 #include "../rsp_toolkit/source/xmlreader.h"
 
 // Structure to hold all input parameters
@@ -29,6 +32,10 @@ struct Parameters {
   double loop_length;
   /* Truncation error tolerance for adaptive solver */
   double adaptive_solver_error;
+  /* Looser truncation error tolerance for a first, screening run; 0 to always use <adaptive_solver_error> */
+  double screening_error;
+  /* Stepper used to integrate the equations; "cash_karp", "adams_bashforth_moulton", "bulirsch_stoer" or "imex" */
+  std::string stepper;
   /* Safety factor on allowed timestep for adaptive solver */
   double adaptive_solver_safety;
   /* Heat flux saturation limit; 1/6 is a typical value */
@@ -51,10 +58,30 @@ struct Parameters {
   bool save_terms;
   /* Switch for using the adaptive solver option */
   bool use_adaptive_solver;
+  /* Switch for computing terms, velocity and heating after the integration rather than at every step */
+  bool defer_derived_quantities;
   /* Path to output file */
   std::string output_filename;
+  /* Format of the output files; either "text" or "binary" */
+  std::string output_format;
+  /* Memory (in MB) that stored results may use before completed rows are written to scratch files; 0 for no limit */
+  double max_memory;
+  /* Number of rows between entries of the time index of each output file; 0 for no index */
+  int index_interval;
   /* XML node holding DEM calculation parameters */
   tinyxml2::XMLElement * dem_options;
+  /* Switch for printing the DEM itself; if False, only derived quantities such as its moments are printed */
+  bool save_dem;
+  /* Switch for printing the emission measure moments of the DEM */
+  bool save_dem_moments;
+  /* Switch for printing spectral line intensities from the DEM */
+  bool save_dem_lines;
+  /* Switch for following non-equilibrium ionization */
+  bool calculate_nei;
+  /* XML node holding non-equilibrium ionization parameters */
+  tinyxml2::XMLElement * nei_options;
+  /* Switch for following non-equilibrium ionization from the printed results after the run rather than at every step */
+  bool nei_post_process;
   /* Correction to ion equation of state */
   double boltzmann_correction;
   /* Ion mass correction to account for He abundance */
@@ -65,41 +92,118 @@ struct Parameters {
   double surface_gravity;
   /* Number of grid points */
   size_t N;
+  /* Number of most recent steps kept in memory and printed; 0 keeps every step */
+  size_t results_window_steps;
 };
 
 // Structure to hold all results
 struct Results {
   /* Time (in s) */
-  std::vector<double> time;
+  Arena<double> time;
   /* Electron temperature (in K) */
-  std::vector<double> temperature_e;
+  Arena<double> temperature_e;
   /* Ion temperature (in K) */
-  std::vector<double> temperature_i;
+  Arena<double> temperature_i;
   /* Electron pressure (in dyne cm^-2 s^-1) */
-  std::vector<double> pressure_e;
+  Arena<double> pressure_e;
   /* Ion pressure (in dyne cm^-2 s^-1) */
-  std::vector<double> pressure_i;
+  Arena<double> pressure_i;
   /* Number density (in cm^-3) */
-  std::vector<double> density;
+  Arena<double> density;
   /* Velocity (in cm s^-1) */
-  std::vector<double> velocity;
+  Arena<double> velocity;
   /* Heating rate (in erg cm^-3 s^-1) */
-  std::vector<double> heat;
+  Arena<double> heat;
 };
 
 // Structure to hold equation terms
 struct Terms {
   /* Electron heat flux (in erg cm^-2 s^-1)*/
-  std::vector<double> f_e;
+  Arena<double> f_e;
   /* Ion heat flux (in erg cm^-2 s^-1)*/
-  std::vector<double> f_i;
+  Arena<double> f_i;
   /* Radiative_loss (in erg cm^3 s^-1) */
-  std::vector<double> radiative_loss;
+  Arena<double> radiative_loss;
   /* c1 coefficient */
-  std::vector<double> c1;
+  Arena<double> c1;
+};
+
+// Change of integration method made by the adaptive solver after repeated failures
+struct SolverSwitch {
+  /* Time of the switch (in s) */
+  double time;
+  /* Timestep after the switch (in s) */
+  double tau;
+  /* Description of the change */
+  std::string action;
+};
+
+// Structure to hold statistics over every step of the run. Each vector holds
+// one entry per results column, excluding time
+struct Summary {
+  /* Number of steps */
+  int num_steps;
+  /* Time of the first step (in s) */
+  double first_time;
+  /* Time of the most recent step (in s) */
+  double last_time;
+  /* Values of each column at the most recent step */
+  std::vector<double> last;
+  /* Minimum of each column */
+  std::vector<double> minimum;
+  /* Maximum of each column */
+  std::vector<double> maximum;
+  /* Time integral of each column */
+  std::vector<double> integral;
+  /* Time of the most recently saved step, which is only included once the next step is saved (in s) */
+  double pending_time;
+  /* Values of each column at the most recently saved step */
+  std::vector<double> pending;
+  /* Changes of integration method, in the order they were made */
+  std::vector<SolverSwitch> solver_switches;
+};
+
+// Structure to hold intermediate quantities for a single state
+struct Intermediates {
+  /* Electron heat flux (in erg cm^-2 s^-1)*/
+  double f_e;
+  /* Ion heat flux (in erg cm^-2 s^-1)*/
+  double f_i;
+  /* Radiative_loss (in erg cm^3 s^-1) */
+  double radiative_loss;
+  /* c1 coefficient */
+  double c1;
+  /* Temperature scale height (in cm) */
+  double scale_height;
+  /* Transition region radiative losses (in erg cm^-2 s^-1) */
+  double R_tr;
+  /* Velocity (in cm s^-1) */
+  double velocity;
+  /* Heating rate (in erg cm^-3 s^-1) */
+  double heat;
 };
 
 // Generic type for state vectors and derivatives
 typedef boost::array<double, 5> state_type;
 
+// Get text of an optional element
+// @root parent XML node
+// @name name of the child element
+// @default_value text returned if the element is missing
+//
+// Same as `get_element_text`, but falls back to <default_value> instead of throwing
+// so that configuration files written before an option existed remain valid.
+//
+// @return text of the element or <default_value>
+//
+inline std::string get_optional_element_text(tinyxml2::XMLElement * root, const char * name, std::string default_value)
+{
+  tinyxml2::XMLElement * element = root->FirstChildElement(name);
+  if(element == NULL || element->GetText() == NULL)
+  {
+    return default_value;
+  }
+  return std::string(element->GetText());
+}
+
 #endif
@@ -0,0 +1,232 @@
+/*
+imex.cpp
+Methods for the implicit-explicit Runge-Kutta stepper
+*/
+
+#include "imex.h"
+
+// ARK3(2)4L[2]SA coefficients; stage times, explicit and implicit tableaus, and
+// weights of the solution and of the embedded second-order solution
+static const double IMEX_GAMMA = 1767732205903.0/4055673282236.0;
+static const double IMEX_C[4] = {0.0, 1767732205903.0/2027836641118.0, 3.0/5.0, 1.0};
+static const double IMEX_EXPLICIT[4][3] = {
+  {0.0, 0.0, 0.0},
+  {1767732205903.0/2027836641118.0, 0.0, 0.0},
+  {5535828885825.0/10492691773637.0, 788022342437.0/10882634858940.0, 0.0},
+  {6485989280629.0/16251701735622.0, -4246266847089.0/9704473918619.0, 10755448449292.0/10357097424841.0}
+};
+static const double IMEX_IMPLICIT[4][3] = {
+  {0.0, 0.0, 0.0},
+  {1767732205903.0/4055673282236.0, 0.0, 0.0},
+  {2746238789719.0/10658868560708.0, -640167445237.0/6845629431997.0, 0.0},
+  {1471266399579.0/7840856788654.0, -4482444167858.0/7529755066697.0, 11266239266428.0/11593286722821.0}
+};
+static const double IMEX_B[4] = {1471266399579.0/7840856788654.0, -4482444167858.0/7529755066697.0, 11266239266428.0/11593286722821.0, 1767732205903.0/4055673282236.0};
+static const double IMEX_B_EMBEDDED[4] = {2756255671327.0/12835298489170.0, -10771552573575.0/22201958757719.0, 9247589265047.0/10645013368117.0, 2193209047091.0/5459859503100.0};
+
+ImexStepper::ImexStepper(double abs_error, double rel_error, double max_dt) : abs_error(abs_error), rel_error(rel_error), max_dt(max_dt)
+{
+}
+
+bool ImexStepper::FactorNewtonMatrix(const ImexSystem & system, const state_type & state, double t, double h_gamma)
+{
+  // Jacobian of the stiff part by forward differences
+  state_type derivs,perturbed_state,perturbed_derivs;
+  system.implicit_part(state,derivs,t);
+  for(int j=0;j<num_states;j++)
+  {
+    perturbed_state = state;
+    double delta = 1.0e-7*std::fmax(std::fabs(state[j]),1.0e-10);
+    perturbed_state[j] += delta;
+    system.implicit_part(perturbed_state,perturbed_derivs,t);
+    for(int i=0;i<num_states;i++)
+    {
+      double jacobian = (perturbed_derivs[i] - derivs[i])/delta;
+      newton_matrix[i][j] = (i==j ? 1.0 : 0.0) - h_gamma*jacobian;
+    }
+  }
+
+  // LU decomposition with partial pivoting
+  for(int k=0;k<num_states;k++)
+  {
+    int p = k;
+    for(int i=k+1;i<num_states;i++)
+    {
+      if(std::fabs(newton_matrix[i][k]) > std::fabs(newton_matrix[p][k]))
+      {
+        p = i;
+      }
+    }
+    if(newton_matrix[p][k] == 0.0 || !std::isfinite(newton_matrix[p][k]))
+    {
+      return false;
+    }
+    pivot[k] = p;
+    if(p != k)
+    {
+      for(int j=0;j<num_states;j++)
+      {
+        std::swap(newton_matrix[k][j],newton_matrix[p][j]);
+      }
+    }
+    for(int i=k+1;i<num_states;i++)
+    {
+      newton_matrix[i][k] /= newton_matrix[k][k];
+      for(int j=k+1;j<num_states;j++)
+      {
+        newton_matrix[i][j] -= newton_matrix[i][k]*newton_matrix[k][j];
+      }
+    }
+  }
+
+  return true;
+}
+
+void ImexStepper::SolveNewton(state_type & rhs)
+{
+  // Rows were swapped in full during the decomposition, so apply all the swaps first
+  for(int k=0;k<num_states;k++)
+  {
+    std::swap(rhs[k],rhs[pivot[k]]);
+  }
+  for(int k=0;k<num_states;k++)
+  {
+    for(int i=k+1;i<num_states;i++)
+    {
+      rhs[i] -= newton_matrix[i][k]*rhs[k];
+    }
+  }
+  for(int k=num_states-1;k>=0;k--)
+  {
+    for(int j=k+1;j<num_states;j++)
+    {
+      rhs[k] -= newton_matrix[k][j]*rhs[j];
+    }
+    rhs[k] /= newton_matrix[k][k];
+  }
+}
+
+bool ImexStepper::SolveStage(const ImexSystem & system, const state_type & known, double t, double h_gamma, state_type & stage)
+{
+  int max_iterations = 10;
+  state_type derivs,residual;
+  for(int n=0;n<max_iterations;n++)
+  {
+    system.implicit_part(stage,derivs,t);
+    for(int i=0;i<num_states;i++)
+    {
+      residual[i] = known[i] + h_gamma*derivs[i] - stage[i];
+    }
+    SolveNewton(residual);
+    for(int i=0;i<num_states;i++)
+    {
+      stage[i] += residual[i];
+    }
+    // Converged once the update is well below the error tolerance
+    double norm = ErrorNorm(residual,stage);
+    if(!std::isfinite(norm))
+    {
+      return false;
+    }
+    if(norm < 1.0e-3)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+double ImexStepper::ErrorNorm(const state_type & err, const state_type & state)
+{
+  double norm = 0.0;
+  for(int i=0;i<num_states;i++)
+  {
+    // NaNs are not dropped, unlike with fmax
+    double scaled = std::fabs(err[i])/(abs_error + rel_error*std::fabs(state[i]));
+    if(!(scaled <= norm))
+    {
+      norm = scaled;
+    }
+  }
+  return norm;
+}
+
+boost::numeric::odeint::controlled_step_result ImexStepper::try_step(const ImexSystem & system, state_type & state, double & t, double & dt)
+{
+  if(max_dt > 0.0)
+  {
+    dt = std::fmin(dt,max_dt);
+  }
+  double h = dt;
+  double h_gamma = h*IMEX_GAMMA;
+
+  // The Newton matrix is the same for all implicit stages
+  if(!FactorNewtonMatrix(system,state,t,h_gamma))
+  {
+    dt *= 0.25;
+    return boost::numeric::odeint::fail;
+  }
+
+  // First stage is explicit in both parts
+  state_type explicit_derivs[4],implicit_derivs[4],known,stage;
+  system.explicit_part(state,explicit_derivs[0],t);
+  system.implicit_part(state,implicit_derivs[0],t);
+  stage = state;
+  for(int s=1;s<4;s++)
+  {
+    double stage_time = t + IMEX_C[s]*h;
+    for(int i=0;i<num_states;i++)
+    {
+      known[i] = state[i];
+      for(int j=0;j<s;j++)
+      {
+        known[i] += h*(IMEX_EXPLICIT[s][j]*explicit_derivs[j][i] + IMEX_IMPLICIT[s][j]*implicit_derivs[j][i]);
+      }
+    }
+    // Start from the previous stage
+    if(!SolveStage(system,known,stage_time,h_gamma,stage))
+    {
+      dt *= 0.25;
+      return boost::numeric::odeint::fail;
+    }
+    system.explicit_part(stage,explicit_derivs[s],stage_time);
+    system.implicit_part(stage,implicit_derivs[s],stage_time);
+  }
+
+  // Third-order solution and its difference from the embedded second-order one
+  state_type solution,err;
+  for(int i=0;i<num_states;i++)
+  {
+    solution[i] = state[i];
+    err[i] = 0.0;
+    for(int j=0;j<4;j++)
+    {
+      double derivs = explicit_derivs[j][i] + implicit_derivs[j][i];
+      solution[i] += h*IMEX_B[j]*derivs;
+      err[i] += h*(IMEX_B[j] - IMEX_B_EMBEDDED[j])*derivs;
+    }
+  }
+  double norm = ErrorNorm(err,solution);
+  if(!std::isfinite(norm))
+  {
+    dt *= 0.25;
+    return boost::numeric::odeint::fail;
+  }
+  // The error estimate is third order in the step size
+  double factor = 0.9*std::pow(std::fmax(norm,1.0e-10),-1.0/3.0);
+  if(norm > 1.0)
+  {
+    dt *= std::fmax(factor,0.2);
+    return boost::numeric::odeint::fail;
+  }
+
+  state = solution;
+  t += h;
+  dt = h*std::fmin(factor,5.0);
+  if(max_dt > 0.0)
+  {
+    dt = std::fmin(dt,max_dt);
+  }
+  return boost::numeric::odeint::success;
+}
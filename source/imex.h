@@ -0,0 +1,96 @@
+/*
+imex.h
+Class definition for the implicit-explicit Runge-Kutta stepper
+*/
+
+#ifndef IMEX_H
+#define IMEX_H
+
+#include "helper.h"
+#include "boost/numeric/odeint.hpp"
+
+// Equations split into a non-stiff part, integrated explicitly, and a stiff
+// part, integrated implicitly
+//
+struct ImexSystem {
+  /* Non-stiff part of the time derivatives */
+  void (*explicit_part)(const state_type &state, state_type &derivs, double time);
+  /* Stiff part of the time derivatives */
+  void (*implicit_part)(const state_type &state, state_type &derivs, double time);
+};
+
+// Implicit-explicit Runge-Kutta stepper
+//
+// Third-order, L-stable additive Runge-Kutta method ARK3(2)4L[2]SA of Kennedy &
+// Carpenter (2003). The stiff part is integrated with three implicit stages, each
+// solved by a simplified Newton iteration. The Jacobian is calculated by finite
+// differences once per step and is shared by all stages, so each step needs only
+// small 5x5 linear solves. The local error is estimated by comparison with the
+// embedded second-order solution, and the step size is chosen from it as
+// in the odeint controlled steppers. Provides the same `try_step` interface as
+// those, so it can be used in the same integration loops.
+//
+class ImexStepper {
+public:
+  typedef ::state_type state_type;
+  typedef double value_type;
+  typedef ::state_type deriv_type;
+  typedef double time_type;
+  typedef boost::numeric::odeint::controlled_stepper_tag stepper_category;
+
+private:
+  /* Number of state variables */
+  static const int num_states = 5;
+
+  /* Absolute and relative error tolerances */
+  double abs_error;
+  double rel_error;
+
+  /* Maximum step size; 0 for no limit */
+  double max_dt;
+
+  /* Matrix of the Newton iteration and its LU decomposition */
+  double newton_matrix[num_states][num_states];
+  int pivot[num_states];
+
+  // Calculate I - <h_gamma>*J and its LU decomposition
+  //
+  // @return false if the matrix is singular
+  //
+  bool FactorNewtonMatrix(const ImexSystem & system, const state_type & state, double t, double h_gamma);
+
+  // Solve <newton_matrix> x = <rhs> in place
+  //
+  void SolveNewton(state_type & rhs);
+
+  // Solve an implicit stage <stage> = <known> + <h_gamma>*implicit_part(<stage>)
+  // @stage initial guess; holds the solution on return
+  //
+  // @return false if the iteration does not converge
+  //
+  bool SolveStage(const ImexSystem & system, const state_type & known, double t, double h_gamma, state_type & stage);
+
+  // @return error norm of <err> relative to the tolerances at <state>
+  //
+  double ErrorNorm(const state_type & err, const state_type & state);
+
+public:
+  // Constructor
+  // @abs_error absolute error tolerance
+  // @rel_error relative error tolerance
+  // @max_dt maximum step size; 0 for no limit
+  //
+  ImexStepper(double abs_error, double rel_error, double max_dt);
+
+  // Try to take a step
+  // @system split equations
+  // @state state at <t>; the state at the end of the step if it succeeds
+  // @t current time; advanced by the step if it succeeds
+  // @dt step size to try; the size of the next step on return
+  //
+  // @return success if the step was taken, otherwise fail with a smaller <dt>
+  //
+  boost::numeric::odeint::controlled_step_result try_step(const ImexSystem & system, state_type & state, double & t, double & dt);
+};
+
+#endif
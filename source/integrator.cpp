@@ -0,0 +1,336 @@
+/*
+integrator.cpp
+Functions for integrating the loop equations with the configured stepper
+*/
+
+#include "integrator.h"
+#include "imex.h"
+#include <limits>
+#include <sstream>
+#include <type_traits>
+#include "boost/numeric/odeint.hpp"
+
+namespace odeint = boost::numeric::odeint;
+
+// Properties of a stepper used by the adaptive loop
+//
+// Cash-Karp needs no special handling.
+//
+template<class Stepper>
+struct StepperTraits {
+  /* True if the step is limited by the thermal conduction timescale for stability */
+  static const bool limit_to_conduction_timescale = true;
+  /* True if steps should end at heating breakpoints rather than cross them */
+  static const bool stop_at_breakpoints = false;
+  /* Called when a step ends at a heating breakpoint */
+  static void AtBreakpoint(Stepper & /*stepper*/) {}
+  /* Called when a step is rejected */
+  static void AfterRejection(Stepper & /*stepper*/) {}
+  /* Called when the stepper takes over from the fallback stepper */
+  static void Restart(Stepper & /*stepper*/) {}
+};
+
+// Adams-Bashforth-Moulton keeps the derivatives at previous steps, which are
+// only useful while the solution is smooth
+//
+template<class... Args>
+struct StepperTraits< odeint::controlled_adams_bashforth_moulton<Args...> > {
+  static const bool limit_to_conduction_timescale = true;
+  static const bool stop_at_breakpoints = true;
+  static void AtBreakpoint(odeint::controlled_adams_bashforth_moulton<Args...> & stepper)
+  {
+    stepper.reset();
+  }
+  static void AfterRejection(odeint::controlled_adams_bashforth_moulton<Args...> & stepper)
+  {
+    stepper.reset();
+  }
+  static void Restart(odeint::controlled_adams_bashforth_moulton<Args...> & stepper)
+  {
+    stepper.reset();
+  }
+};
+
+// Bulirsch-Stoer extrapolation assumes a smooth solution over each step, and
+// chooses its next order and step from the last one
+//
+template<class... Args>
+struct StepperTraits< odeint::bulirsch_stoer<Args...> > {
+  static const bool limit_to_conduction_timescale = true;
+  static const bool stop_at_breakpoints = true;
+  static void AtBreakpoint(odeint::bulirsch_stoer<Args...> & stepper)
+  {
+    stepper.reset();
+  }
+  static void AfterRejection(odeint::bulirsch_stoer<Args...> & /*stepper*/) {}
+  static void Restart(odeint::bulirsch_stoer<Args...> & stepper)
+  {
+    stepper.reset();
+  }
+};
+
+// The IMEX stepper integrates conduction implicitly, so it is stable at steps
+// longer than the conduction timescale. Without that limit its steps can be long
+// enough to cross a whole heating event, so they end at the breakpoints instead.
+//
+template<>
+struct StepperTraits<ImexStepper> {
+  static const bool limit_to_conduction_timescale = false;
+  static const bool stop_at_breakpoints = true;
+  static void AtBreakpoint(ImexStepper & /*stepper*/) {}
+  static void AfterRejection(ImexStepper & /*stepper*/) {}
+  static void Restart(ImexStepper & /*stepper*/) {}
+};
+
+// Number of steps taken with the IMEX stepper when the configured stepper keeps failing
+static const int FALLBACK_STEPS = 100;
+
+// Factor applied to <Parameters.adaptive_solver_safety> when a step keeps failing
+static const double FALLBACK_SAFETY_FACTOR = 0.1;
+
+// @return thermal conduction timescale (in s) of <state>
+//
+static double CalculateConductionTimescale(LOOP loop, const state_type & state)
+{
+  return 4e-10*state[2]*pow(loop->parameters.loop_length,2)*pow(std::fmax(state[3],state[4]),-2.5);
+}
+
+// Take a single step with an adaptive timestep
+// @stepper controlled stepper
+// @system equations in the form expected by <stepper>
+// @loop <Loop> object
+// @obs <Observer> object
+// @state state at <t>; the state at the end of the step if it succeeds
+// @t current time; advanced by the step if it succeeds
+// @tau timestep to try; the next timestep on return
+//
+// The timestep chosen by the stepper is further limited by the thermal conduction
+// timescale, <Parameters.adaptive_solver_safety> and <Parameters.tau_max>.
+// Steppers that assume a smooth solution are stopped at each heating breakpoint,
+// where the derivatives are not smooth; see <StepperTraits>.
+//
+// @return false if the step is still rejected after the maximum number of
+// attempts, in which case <state> and <t> are unchanged
+//
+template<class Stepper, class System>
+static bool TakeAdaptiveStep(Stepper & stepper, System system, LOOP loop, OBSERVER obs, state_type & state, double & t, double & tau)
+{
+  // Set maximum number of allowed failures
+  int max_failures = 1000;
+  double old_tau,old_t;
+  double breakpoint = std::numeric_limits<double>::infinity();
+  if(StepperTraits<Stepper>::stop_at_breakpoints)
+  {
+    breakpoint = loop->heater->Get_Next_Breakpoint(t);
+    tau = std::fmin(tau,breakpoint - t);
+  }
+  int fail = 1;
+  int num_failures = 0;
+  while(fail>0)
+  {
+    // Give up if exceeded max number of failures to avoid infinite loop
+    if(num_failures>max_failures)
+    {
+      return false;
+    }
+    old_tau = tau;
+    old_t = t;
+    fail = stepper.try_step(system,state,t,tau);
+    // Force NaNs to fail
+    if(!fail) fail = obs->CheckNan(state,t,tau,old_t,old_tau);
+    if(fail) StepperTraits<Stepper>::AfterRejection(stepper);
+    num_failures++;
+  }
+  // Land exactly on the breakpoint despite rounding
+  if(std::isfinite(breakpoint) && breakpoint - t <= 1e-9*breakpoint)
+  {
+    t = breakpoint;
+  }
+  if(t >= breakpoint)
+  {
+    StepperTraits<Stepper>::AtBreakpoint(stepper);
+  }
+  // Enforce thermal conduction timescale limit
+  if(StepperTraits<Stepper>::limit_to_conduction_timescale)
+  {
+    double tau_tc = CalculateConductionTimescale(loop,state);
+    // Limit abrupt changes in the timestep with safety factor
+    tau = std::fmax(std::fmin(tau,0.5*tau_tc),loop->parameters.adaptive_solver_safety*tau);
+  }
+  // Control maximum timestep
+  tau = std::fmin(tau,loop->parameters.tau_max);
+
+  return true;
+}
+
+// Integrate with an adaptive timestep
+// @stepper controlled stepper
+// @system equations in the form expected by <stepper>
+// @loop <Loop> object
+// @obs <Observer> object
+// @state initial state; holds the final state on return
+//
+// Steps are taken with <TakeAdaptiveStep>. If a step keeps failing, rather than
+// giving up, the solver falls back on progressively more robust settings: first
+// <Parameters.adaptive_solver_safety> is reduced for the rest of the run, then,
+// if the stepper still fails, the next <FALLBACK_STEPS> steps are taken with the
+// IMEX stepper before the configured stepper takes over again. Every switch is
+// recorded with <Loop::RecordSolverSwitch>. Throws if the IMEX stepper fails too.
+//
+// @return number of steps taken
+//
+template<class Stepper, class System>
+static int IntegrateAdaptive(Stepper & stepper, System system, LOOP loop, OBSERVER obs, state_type & state)
+{
+  int num_steps = 0;
+  // Initialize time and timestep
+  double tau = loop->parameters.tau;
+  double t = loop->parameters.tau;
+  // Fallback stepper, unless this is the IMEX stepper already
+  bool can_fall_back = !std::is_same<Stepper,ImexStepper>::value;
+  ImexSystem fallback_system = {loop->CalculateNonStiffDerivs,loop->CalculateStiffDerivs};
+  ImexStepper fallback_stepper(loop->parameters.adaptive_solver_error,loop->parameters.adaptive_solver_error,loop->parameters.tau_max);
+  bool safety_reduced = false;
+  int fallback_steps_left = 0;
+  // Start integration loop
+  while(t<loop->parameters.total_time)
+  {
+    bool success;
+    if(fallback_steps_left > 0)
+    {
+      success = TakeAdaptiveStep(fallback_stepper,fallback_system,loop,obs,state,t,tau);
+      if(success && --fallback_steps_left == 0)
+      {
+        // Hand back to the configured stepper within its stability limit
+        StepperTraits<Stepper>::Restart(stepper);
+        if(StepperTraits<Stepper>::limit_to_conduction_timescale)
+        {
+          tau = std::fmin(tau,0.5*CalculateConductionTimescale(loop,state));
+        }
+        loop->RecordSolverSwitch(t,tau,"resumed " + loop->parameters.stepper);
+      }
+    }
+    else
+    {
+      success = TakeAdaptiveStep(stepper,system,loop,obs,state,t,tau);
+    }
+    if(!success)
+    {
+      if(!safety_reduced)
+      {
+        loop->parameters.adaptive_solver_safety *= FALLBACK_SAFETY_FACTOR;
+        safety_reduced = true;
+        std::ostringstream action;
+        action << "reduced adaptive_solver_safety to " << loop->parameters.adaptive_solver_safety;
+        loop->RecordSolverSwitch(t,tau,action.str());
+      }
+      else if(can_fall_back && fallback_steps_left == 0)
+      {
+        fallback_steps_left = FALLBACK_STEPS;
+        loop->RecordSolverSwitch(t,tau,"switched to imex");
+      }
+      else
+      {
+        throw std::runtime_error("Adaptive solver exceeded maximum number of allowed failures.");
+      }
+      continue;
+    }
+    // Save the state
+    obs->Observe(state,t);
+    num_steps += 1;
+  }
+
+  return num_steps;
+}
+
+// Integrate with a constant timestep
+// @stepper controlled stepper, used to take substeps between output times
+// @system equations in the form expected by <stepper>
+// @loop <Loop> object
+// @obs <Observer> object
+// @state initial state; holds the final state on return
+//
+// @return number of steps taken
+//
+template<class Stepper, class System>
+static int IntegrateConstant(Stepper & stepper, System system, LOOP loop, OBSERVER obs, state_type & state)
+{
+  return odeint::integrate_const(stepper, system, state, loop->parameters.tau, loop->parameters.total_time, loop->parameters.tau, obs->Observe);
+}
+
+// Integrate with a constant timestep, interpolating to the output times
+// @stepper dense output stepper
+// @system equations in the form expected by <stepper>
+// @loop <Loop> object
+// @obs <Observer> object
+// @state initial state; holds the final state on return
+//
+// A dense output stepper may take far fewer steps than there are output times,
+// so each interval between output times is counted as one step, as it is for a
+// controlled stepper that needs no substeps.
+//
+// @return number of intervals between output times
+//
+template<class Stepper, class System>
+static int IntegrateConstantDense(Stepper & stepper, System system, LOOP loop, OBSERVER obs, state_type & state)
+{
+  int num_outputs = 0;
+  odeint::integrate_const(stepper, system, state, loop->parameters.tau, loop->parameters.total_time, loop->parameters.tau,
+    [&](const state_type & observed_state, const double time)
+    {
+      obs->Observe(observed_state,time);
+      num_outputs++;
+    });
+  return num_outputs - 1;
+}
+
+int Integrate(LOOP loop, OBSERVER obs, state_type & state)
+{
+  double error = loop->parameters.adaptive_solver_error;
+
+  if(loop->parameters.stepper.compare("adams_bashforth_moulton")==0)
+  {
+    // Variable order, up to 5, and variable step
+    typedef odeint::adaptive_adams_bashforth_moulton<5,state_type> error_stepper_type;
+    typedef odeint::controlled_adams_bashforth_moulton<error_stepper_type> stepper_type;
+    stepper_type controlled_stepper(stepper_type::step_adjuster_type(error,error,loop->parameters.tau_max));
+    if(loop->parameters.use_adaptive_solver)
+    {
+      return IntegrateAdaptive(controlled_stepper,loop->CalculateDerivs,loop,obs,state);
+    }
+    return IntegrateConstant(controlled_stepper,loop->CalculateDerivs,loop,obs,state);
+  }
+
+  if(loop->parameters.stepper.compare("imex")==0)
+  {
+    // Heating explicitly, everything else implicitly
+    ImexSystem system = {loop->CalculateNonStiffDerivs,loop->CalculateStiffDerivs};
+    ImexStepper controlled_stepper(error,error,loop->parameters.tau_max);
+    if(loop->parameters.use_adaptive_solver)
+    {
+      return IntegrateAdaptive(controlled_stepper,system,loop,obs,state);
+    }
+    return IntegrateConstant(controlled_stepper,system,loop,obs,state);
+  }
+
+  if(loop->parameters.stepper.compare("bulirsch_stoer")==0)
+  {
+    if(loop->parameters.use_adaptive_solver)
+    {
+      odeint::bulirsch_stoer<state_type> controlled_stepper(error,error,1.0,1.0,loop->parameters.tau_max);
+      return IntegrateAdaptive(controlled_stepper,loop->CalculateDerivs,loop,obs,state);
+    }
+    // Take steps as long as the tolerance allows and interpolate to the output times
+    odeint::bulirsch_stoer_dense_out<state_type> dense_stepper(error,error,1.0,1.0,loop->parameters.tau_max,true);
+    return IntegrateConstantDense(dense_stepper,loop->CalculateDerivs,loop,obs,state);
+  }
+
+  // Cash-Karp Runge-Kutta
+  typedef odeint::runge_kutta_cash_karp54< state_type > stepper_type;
+  auto controlled_stepper = odeint::make_controlled(error, error, stepper_type());
+  if(loop->parameters.use_adaptive_solver)
+  {
+    return IntegrateAdaptive(controlled_stepper,loop->CalculateDerivs,loop,obs,state);
+  }
+  return IntegrateConstant(controlled_stepper,loop->CalculateDerivs,loop,obs,state);
+}
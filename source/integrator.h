@@ -0,0 +1,27 @@
+/*
+integrator.h
+Functions for integrating the loop equations with the configured stepper
+*/
+
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "helper.h"
+#include "loop.h"
+#include "observer.h"
+
+// Integrate the loop equations
+// @loop <Loop> object holding the parameters and equations
+// @obs <Observer> called at every step to save the results
+// @state initial state; holds the final state on return
+//
+// Uses the stepper given by <Parameters.stepper>, either with the adaptive
+// timestep loop or, if the adaptive solver is off, with a constant timestep
+// <Parameters.tau>. If a step of the adaptive loop keeps failing, falls back on
+// a smaller safety factor and then on the IMEX stepper; throws only if that fails too.
+//
+// @return number of steps taken
+//
+int Integrate(LOOP loop, OBSERVER obs, state_type & state);
+
+#endif
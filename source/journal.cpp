@@ -0,0 +1,151 @@
+/*
+journal.cpp
+Methods for the journal of completed ensemble members
+*/
+
+#include "journal.h"
+#include "canonical.h"
+#include <sstream>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// @return size of <filename> (in bytes); -1 if it does not exist
+//
+static long long GetFileSize(const std::string & filename)
+{
+  struct stat info;
+  if(stat(filename.c_str(),&info) != 0)
+  {
+    return -1;
+  }
+  return info.st_size;
+}
+
+Journal::Journal(std::string filename)
+{
+  // Read the members completed by earlier runs; fields are separated by tabs
+  std::ifstream f_in(filename.c_str());
+  std::string line;
+  bool ends_in_newline = true;
+  while(std::getline(f_in,line))
+  {
+    ends_in_newline = !f_in.eof();
+    std::size_t last_tab = line.rfind('\t');
+    if(!ends_in_newline || last_tab == std::string::npos || FormatHash(HashString(line.substr(0,last_tab))) != line.substr(last_tab+1))
+    {
+      // Cut short or corrupted
+      continue;
+    }
+    std::vector<std::string> fields;
+    std::stringstream line_stream(line.substr(0,last_tab));
+    std::string field;
+    while(std::getline(line_stream,field,'\t'))
+    {
+      fields.push_back(field);
+    }
+    if(fields.size() < 2)
+    {
+      continue;
+    }
+    std::vector<JournalOutput> outputs;
+    for(std::size_t k=2;k+1<fields.size();k+=2)
+    {
+      JournalOutput output = {fields[k],std::stoll(fields[k+1])};
+      outputs.push_back(output);
+    }
+    completed[fields[0]] = outputs;
+    config_hashes[fields[0]] = fields[1];
+  }
+  f_in.close();
+
+#ifdef __linux__
+  fd = open(filename.c_str(),O_WRONLY | O_CREAT | O_APPEND,0644);
+  if(fd < 0)
+  {
+    throw std::runtime_error("Failed to open journal " + filename);
+  }
+  // Start a new line after one that was cut short
+  if(!ends_in_newline && write(fd,"\n",1) != 1)
+  {
+    throw std::runtime_error("Failed to write to journal " + filename);
+  }
+#else
+  fd = -1;
+  f.open(filename.c_str(),std::ios::out | std::ios::app);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open journal " + filename);
+  }
+  if(!ends_in_newline)
+  {
+    f << "\n";
+  }
+#endif
+}
+
+Journal::~Journal(void)
+{
+#ifdef __linux__
+  close(fd);
+#else
+  f.close();
+#endif
+}
+
+bool Journal::IsComplete(std::string member, std::string config_hash)
+{
+  std::map<std::string, std::vector<JournalOutput> >::iterator entry = completed.find(member);
+  if(entry == completed.end() || entry->second.empty())
+  {
+    return false;
+  }
+  if(config_hashes[member] != config_hash)
+  {
+    std::cout << "Configuration of " << member << " has changed since it was run; rerunning" << std::endl;
+    return false;
+  }
+  for(std::size_t k=0;k<entry->second.size();k++)
+  {
+    if(GetFileSize(entry->second[k].filename) != entry->second[k].size)
+    {
+      std::cout << "Output " << entry->second[k].filename << " of " << member << " is missing or incomplete; rerunning" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<JournalOutput> Journal::GetOutputs(std::string member)
+{
+  std::map<std::string, std::vector<JournalOutput> >::iterator entry = completed.find(member);
+  if(entry == completed.end())
+  {
+    return std::vector<JournalOutput>();
+  }
+  return entry->second;
+}
+
+void Journal::Record(std::string member, std::string config_hash, std::vector<std::string> filenames)
+{
+  std::ostringstream line;
+  line << member << "\t" << config_hash;
+  for(std::size_t k=0;k<filenames.size();k++)
+  {
+    line << "\t" << filenames[k] << "\t" << GetFileSize(filenames[k]);
+  }
+  std::string text = line.str();
+  text += "\t" + FormatHash(HashString(text)) + "\n";
+#ifdef __linux__
+  // A single append is not interleaved with those of other workers
+  if(write(fd,text.c_str(),text.size()) != (ssize_t)text.size() || fdatasync(fd) != 0)
+  {
+    throw std::runtime_error("Failed to record " + member + " in the journal");
+  }
+#else
+  f << text;
+  f.flush();
+#endif
+}
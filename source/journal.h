@@ -0,0 +1,82 @@
+/*
+journal.h
+Class definition for the journal of completed ensemble members
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <map>
+#include "helper.h"
+
+// Output file of a completed member and its size when the member finished
+//
+struct JournalOutput {
+  /* Path of the file */
+  std::string filename;
+  /* Size of the file (in bytes) */
+  long long size;
+};
+
+// Journal object
+//
+// Append-only record of the ensemble members that have finished, so that an
+// ensemble that is stopped part way through can be restarted without repeating
+// them. Each line holds a member, the hash of its canonical configuration, every
+// output file it wrote with the size of the file, and a checksum of the line. A line is only appended once all the
+// output files of the member have been closed, and is written to disk with a
+// single write before the next member starts, so a line that is cut short when
+// the process is killed fails its checksum and is ignored. Several worker
+// processes may append to the same journal.
+//
+class Journal {
+private:
+  /* File descriptor of the journal, open for appending */
+  int fd;
+
+  /* Output stream, if appending with a file descriptor is not available */
+  std::ofstream f;
+
+  /* Completed members read from the journal when it was opened */
+  std::map<std::string, std::vector<JournalOutput> > completed;
+
+  /* Hash of the canonical configuration of each completed member when it was run */
+  std::map<std::string, std::string> config_hashes;
+
+public:
+  // Constructor
+  // @filename path of the journal; created if it does not exist
+  //
+  // Reads the members recorded by earlier runs and opens the journal for appending.
+  //
+  Journal(std::string filename);
+
+  // Destructor
+  //
+  ~Journal(void);
+
+  // Check whether a member can be skipped
+  // @member configuration file of the member
+  // @config_hash hash of the canonical configuration of the member, see <CanonicalizeConfig>
+  //
+  // @return true if the member is in the journal with the same configuration hash,
+  // i.e. its configuration has not been edited since, and every one of its output
+  // files still exists with the size recorded, i.e. none were truncated or rewritten
+  //
+  bool IsComplete(std::string member, std::string config_hash);
+
+  // @return output files recorded for <member>, results first; empty if it is not in the journal
+  //
+  std::vector<JournalOutput> GetOutputs(std::string member);
+
+  // Record a completed member
+  // @member configuration file of the member
+  // @config_hash hash of the canonical configuration of the member
+  // @filenames output files written by the member, results first
+  //
+  void Record(std::string member, std::string config_hash, std::vector<std::string> filenames);
+};
+// Pointer to the <Journal> class
+typedef Journal* JOURNAL;
+
+#endif
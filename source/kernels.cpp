@@ -0,0 +1,133 @@
+/*
+kernels.cpp
+DEM kernels compiled for several instruction sets, selected at runtime
+*/
+
+#include "kernels.h"
+#include "../rsp_toolkit/source/constants.h"
+
+// The kernel bodies are written once and inlined into a wrapper per instruction
+// set, each compiled with its own target attribute. The arithmetic is done in the
+// same order as the scalar calculation so every variant gives the same result.
+//
+#define DEM_INLINE inline __attribute__((always_inline))
+
+// Instruction sets with fused multiply-add (AVX-512 implies it) would otherwise let
+// the compiler contract a multiply and an add into one differently rounded operation
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("fp-contract=off")
+#elif defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+
+static DEM_INLINE void DemTRNewBody(int num_bins,const DemBins & bins,const DemRowTerms & terms,double * __restrict__ row_tr)
+{
+  for(int j=0;j<num_bins;j++)
+  {
+    double a = bins.conductivity[j];
+    double density_squared = pow(terms.pressure_over_k/bins.temperature[j],2)*terms.density_factor;
+    double c = -density_squared*bins.radiative_loss[j];
+    double root = sqrt(pow(terms.enthalpy,2) - 4.0*a*c);
+    double dTds_plus = (-terms.enthalpy + root)/(2.0*a);
+    double dTds_minus = (-terms.enthalpy - root)/(2.0*a);
+    double dTds = dTds_plus > dTds_minus ? dTds_plus : dTds_minus;
+    row_tr[j] = 2.0*density_squared/dTds;
+  }
+}
+
+static DEM_INLINE void DemTROldBody(int num_bins,const DemBins & bins,const DemRowTerms & terms,double * __restrict__ row_tr)
+{
+  for(int j=0;j<num_bins;j++)
+  {
+    double dem_evap = terms.evaporation/(terms.density_velocity*bins.sqrt_temperature[j]);
+    double dem_condense = terms.condensation/bins.radiative_loss[j];
+    double dem_eqm = bins.equilibrium_factor[j]*terms.pressure/BOLTZMANN_CONSTANT*bins.temperature_m025[j];
+    row_tr[j] = 2.0*(terms.f_e*dem_evap - terms.equilibrium_weight*dem_eqm + terms.R_tr*dem_condense)/terms.denominator;
+  }
+}
+
+#define DEM_KERNELS(suffix,target) \
+  target static void DemTRNew_##suffix(int num_bins,const DemBins & bins,const DemRowTerms & terms,double * row_tr) \
+  { \
+    DemTRNewBody(num_bins,bins,terms,row_tr); \
+  } \
+  target static void DemTROld_##suffix(int num_bins,const DemBins & bins,const DemRowTerms & terms,double * row_tr) \
+  { \
+    DemTROldBody(num_bins,bins,terms,row_tr); \
+  }
+
+DEM_KERNELS(generic,)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DEM_X86_KERNELS
+DEM_KERNELS(sse42,__attribute__((target("sse4.2"))))
+DEM_KERNELS(avx2,__attribute__((target("avx2"))))
+DEM_KERNELS(avx512,__attribute__((target("avx512f"))))
+#endif
+
+// Variants from widest to narrowest
+static const DemKernels DEM_KERNEL_VARIANTS[] = {
+#ifdef DEM_X86_KERNELS
+  {"avx512",DemTRNew_avx512,DemTROld_avx512},
+  {"avx2",DemTRNew_avx2,DemTROld_avx2},
+  {"sse4.2",DemTRNew_sse42,DemTROld_sse42},
+#endif
+  {"generic",DemTRNew_generic,DemTROld_generic},
+};
+static const int NUM_DEM_KERNEL_VARIANTS = sizeof(DEM_KERNEL_VARIANTS)/sizeof(DemKernels);
+
+// @return true if the CPU supports the instruction set of <kernels>
+//
+static bool IsSupported(const DemKernels & kernels)
+{
+  std::string isa = kernels.isa;
+#ifdef DEM_X86_KERNELS
+  __builtin_cpu_init();
+  if(isa.compare("avx512") == 0)
+  {
+    return __builtin_cpu_supports("avx512f");
+  }
+  if(isa.compare("avx2") == 0)
+  {
+    return __builtin_cpu_supports("avx2");
+  }
+  if(isa.compare("sse4.2") == 0)
+  {
+    return __builtin_cpu_supports("sse4.2");
+  }
+#endif
+  return isa.compare("generic") == 0;
+}
+
+static const DemKernels * selected_kernels = NULL;
+
+void SelectDemKernels(std::string isa)
+{
+  for(int k=0;k<NUM_DEM_KERNEL_VARIANTS;k++)
+  {
+    const DemKernels & kernels = DEM_KERNEL_VARIANTS[k];
+    if(isa.compare("auto") != 0 && isa.compare(kernels.isa) != 0)
+    {
+      continue;
+    }
+    if(IsSupported(kernels))
+    {
+      selected_kernels = &kernels;
+      return;
+    }
+    if(isa.compare("auto") != 0)
+    {
+      throw std::runtime_error("Kernel instruction set " + isa + " is not supported by this CPU.");
+    }
+  }
+  throw std::runtime_error("Unrecognized kernel instruction set " + isa + ". Use auto, avx512, avx2, sse4.2 or generic.");
+}
+
+const DemKernels & GetDemKernels(void)
+{
+  if(selected_kernels == NULL)
+  {
+    SelectDemKernels("auto");
+  }
+  return *selected_kernels;
+}
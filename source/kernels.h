@@ -0,0 +1,84 @@
+/*
+kernels.h
+DEM kernels compiled for several instruction sets, selected at runtime
+*/
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "helper.h"
+
+// Per-bin quantities for the TR DEM kernels
+//
+// Everything that depends only on the temperature bin is computed once, when
+// the <Dem> object is set up, so that the kernels are plain arithmetic that the
+// compiler can vectorize.
+//
+struct DemBins {
+  /* Temperature of each bin */
+  const double * temperature;
+  /* Radiative loss at each bin temperature */
+  const double * radiative_loss;
+  /* Spitzer conductivity times temperature^(3/2) */
+  const double * conductivity;
+  /* Square root of the temperature */
+  const double * sqrt_temperature;
+  /* Temperature^(-1/4) */
+  const double * temperature_m025;
+  /* sqrt(2 kappa_0/7/radiative loss), the equilibrium DEM factor */
+  const double * equilibrium_factor;
+};
+
+// Quantities for one row of the TR DEM that do not depend on temperature
+//
+struct DemRowTerms {
+  /* New method: enthalpy flux coefficient */
+  double enthalpy;
+  /* New method: pressure/k_B */
+  double pressure_over_k;
+  /* New method: ratio of the squared TR density to (pressure/k_B/T)^2 */
+  double density_factor;
+  /* Old method: evaporative DEM times density*velocity*sqrt(T) */
+  double evaporation;
+  /* Old method: density*velocity */
+  double density_velocity;
+  /* Old method: condensing DEM times radiative loss */
+  double condensation;
+  /* Old method: pressure */
+  double pressure;
+  /* Old method: weights of the evaporative, equilibrium and condensing DEM */
+  double f_e;
+  double equilibrium_weight;
+  double R_tr;
+  /* Old method: sum of the weights */
+  double denominator;
+};
+
+// Kernel computing the TR DEM for bins [0,num_bins)
+//
+typedef void (*DEM_TR_KERNEL)(int num_bins,const DemBins & bins,const DemRowTerms & terms,double * row_tr);
+
+// Set of kernels built for one instruction set
+//
+struct DemKernels {
+  /* Name of the instruction set */
+  const char * isa;
+  /* TR DEM using the method of section 3 of Klimchuk et al. (2008) */
+  DEM_TR_KERNEL tr_new;
+  /* TR DEM using the method of the appendix of Klimchuk et al. (2008) */
+  DEM_TR_KERNEL tr_old;
+};
+
+// Select the kernels to use
+// @isa one of "auto", "avx512", "avx2", "sse4.2" or "generic"
+//
+// With "auto", the widest instruction set supported by the CPU is used. Throws
+// if the requested instruction set is unknown or not supported by the CPU.
+//
+void SelectDemKernels(std::string isa);
+
+// @return the selected kernels; the widest supported if none have been selected
+//
+const DemKernels & GetDemKernels(void);
+
+#endif
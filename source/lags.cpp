@@ -0,0 +1,363 @@
+/*
+lags.cpp
+Methods for time lags between synthetic channels
+*/
+
+#include "lags.h"
+#include "binary.h"
+#include <complex>
+#include <limits>
+#include <sstream>
+
+typedef std::complex<double> complex_type;
+
+// In-place radix-2 fast Fourier transform
+// @data values to transform; the size must be a power of two
+// @inverse if true, the inverse transform, without the 1/N normalization
+//
+static void FFT(std::vector<complex_type> & data, bool inverse)
+{
+  std::size_t n = data.size();
+  // Bit-reversal permutation
+  for(std::size_t i=1,j=0;i<n;i++)
+  {
+    std::size_t bit = n >> 1;
+    for(;j & bit;bit>>=1)
+    {
+      j ^= bit;
+    }
+    j ^= bit;
+    if(i < j)
+    {
+      std::swap(data[i],data[j]);
+    }
+  }
+  // Butterflies
+  for(std::size_t length=2;length<=n;length<<=1)
+  {
+    double angle = 2.0*M_PI/length*(inverse ? 1.0 : -1.0);
+    complex_type root(cos(angle),sin(angle));
+    for(std::size_t start=0;start<n;start+=length)
+    {
+      complex_type w(1.0,0.0);
+      for(std::size_t k=0;k<length/2;k++)
+      {
+        complex_type even = data[start+k];
+        complex_type odd = data[start+k+length/2]*w;
+        data[start+k] = even + odd;
+        data[start+k+length/2] = even - odd;
+        w *= root;
+      }
+    }
+  }
+}
+
+LagAnalysis::LagAnalysis(std::vector<std::string> channel_definitions, std::vector<std::string> pair_specifications, std::string grid_spec)
+{
+  // Channels given by response functions
+  for(std::size_t k=0;k<channel_definitions.size();k++)
+  {
+    std::size_t equals = channel_definitions[k].find('=');
+    if(equals == std::string::npos)
+    {
+      throw std::runtime_error("Channel " + channel_definitions[k] + " must be of the form name=file");
+    }
+    Channel channel;
+    channel.name = channel_definitions[k].substr(0,equals);
+    channel.column = -1;
+    std::string filename = channel_definitions[k].substr(equals+1);
+    std::ifstream f(filename.c_str());
+    if(!f.is_open())
+    {
+      throw std::runtime_error("Failed to open response function " + filename);
+    }
+    std::string line;
+    while(std::getline(f,line))
+    {
+      double temperature,response;
+      std::istringstream line_stream(line);
+      if(line.empty() || line[0] == '#' || !(line_stream >> temperature >> response))
+      {
+        continue;
+      }
+      if(!channel.log_temperature.empty() && log10(temperature) <= channel.log_temperature.back())
+      {
+        throw std::runtime_error("Temperatures of response function " + filename + " must be increasing");
+      }
+      channel.log_temperature.push_back(log10(temperature));
+      channel.response.push_back(response);
+    }
+    if(channel.log_temperature.size() < 2)
+    {
+      throw std::runtime_error("Response function " + filename + " needs at least two temperatures");
+    }
+    channels.push_back(channel);
+  }
+
+  // Pairs of channels
+  for(std::size_t k=0;k<pair_specifications.size();k++)
+  {
+    std::vector<std::string> fields;
+    std::stringstream pair_stream(pair_specifications[k]);
+    std::string field;
+    while(std::getline(pair_stream,field,':'))
+    {
+      fields.push_back(field);
+    }
+    std::size_t comma = fields.empty() ? std::string::npos : fields[0].find(',');
+    if(fields.size() != 3 || comma == std::string::npos)
+    {
+      throw std::runtime_error("Channel pair " + pair_specifications[k] + " must be of the form first,second:min_lag:max_lag");
+    }
+    ChannelPair pair;
+    pair.first = FindChannel(fields[0].substr(0,comma));
+    pair.second = FindChannel(fields[0].substr(comma+1));
+    pair.min_lag = std::stod(fields[1]);
+    pair.max_lag = std::stod(fields[2]);
+    if(pair.max_lag < pair.min_lag)
+    {
+      throw std::runtime_error("Channel pair " + pair_specifications[k] + " has max_lag < min_lag");
+    }
+    pairs.push_back(pair);
+  }
+
+  interpolator = GridInterpolator(grid_spec,channels.size());
+  step_values.resize(channels.size());
+}
+
+int LagAnalysis::FindChannel(std::string name)
+{
+  for(std::size_t c=0;c<channels.size();c++)
+  {
+    if(channels[c].name.compare(name)==0)
+    {
+      return c;
+    }
+  }
+  Channel channel;
+  channel.name = name;
+  channel.column = FindResultsColumn(name);
+  if(channel.column < 0)
+  {
+    throw std::runtime_error("Unrecognized channel " + name + ". Use temperature_e, temperature_i, density, pressure_e, pressure_i, velocity, heat or a channel defined by a response function.");
+  }
+  channels.push_back(channel);
+  return channels.size() - 1;
+}
+
+double LagAnalysis::GetChannelValue(const Channel & channel, const double * row)
+{
+  if(channel.column >= 0)
+  {
+    return row[channel.column];
+  }
+  // Linear interpolation in log T; no response outside the table
+  double log_temperature = log10(row[1]);
+  const std::vector<double> & log_t = channel.log_temperature;
+  if(!(log_temperature >= log_t.front() && log_temperature <= log_t.back()))
+  {
+    return 0.0;
+  }
+  std::size_t j = std::upper_bound(log_t.begin(),log_t.end(),log_temperature) - log_t.begin();
+  j = std::min(std::max(j,std::size_t(1)),log_t.size()-1);
+  double weight = (log_temperature - log_t[j-1])/(log_t[j] - log_t[j-1]);
+  double response = channel.response[j-1] + weight*(channel.response[j] - channel.response[j-1]);
+  return row[3]*row[3]*response;
+}
+
+void LagAnalysis::BeginMember(void)
+{
+  interpolator.Begin();
+}
+
+void LagAnalysis::AddStep(const double * row)
+{
+  for(std::size_t c=0;c<channels.size();c++)
+  {
+    step_values[c] = GetChannelValue(channels[c],row);
+  }
+  interpolator.Add(row[0],step_values.data());
+}
+
+void LagAnalysis::CommitMember(std::string member)
+{
+  std::size_t first = interpolator.GetFirst();
+  std::size_t n = interpolator.GetEnd() > first ? interpolator.GetEnd() - first : 0;
+  const std::vector<double> & grid = interpolator.GetGrid();
+  double step = grid.size() > 1 ? grid[1] - grid[0] : 0.0;
+  std::vector<double> member_lags(2*pairs.size(),std::numeric_limits<double>::quiet_NaN());
+
+  if(n >= 2)
+  {
+    // Spectrum of each light curve, after removing its mean, zero padded so
+    // that the correlation does not wrap around
+    std::size_t size = 1;
+    while(size < 2*n)
+    {
+      size <<= 1;
+    }
+    std::vector<std::vector<complex_type> > spectra(channels.size());
+    std::vector<double> sum_squares(channels.size(),0.0);
+    for(std::size_t c=0;c<channels.size();c++)
+    {
+      double mean = 0.0;
+      for(std::size_t g=0;g<n;g++)
+      {
+        mean += interpolator.GetValues(first+g)[c];
+      }
+      mean /= n;
+      spectra[c].assign(size,complex_type(0.0,0.0));
+      for(std::size_t g=0;g<n;g++)
+      {
+        double value = interpolator.GetValues(first+g)[c] - mean;
+        spectra[c][g] = value;
+        sum_squares[c] += value*value;
+      }
+      FFT(spectra[c],false);
+    }
+
+    std::vector<complex_type> correlation(size);
+    for(std::size_t p=0;p<pairs.size();p++)
+    {
+      const ChannelPair & pair = pairs[p];
+      double norm = sqrt(sum_squares[pair.first]*sum_squares[pair.second]);
+      if(!(norm > 0.0))
+      {
+        continue;
+      }
+      // Cross-correlation sum_t x(t) y(t + lag), lag in grid steps, negative lags wrapped to the end
+      for(std::size_t k=0;k<size;k++)
+      {
+        correlation[k] = std::conj(spectra[pair.first][k])*spectra[pair.second][k];
+      }
+      FFT(correlation,true);
+      long max_shift = long(n) - 1;
+      long shift_min = std::max(long(std::ceil(pair.min_lag/step - 1e-9)),-max_shift);
+      long shift_max = std::min(long(std::floor(pair.max_lag/step + 1e-9)),max_shift);
+      if(shift_max < shift_min)
+      {
+        continue;
+      }
+      std::vector<double> values(shift_max - shift_min + 1);
+      for(long shift=shift_min;shift<=shift_max;shift++)
+      {
+        values[shift - shift_min] = correlation[shift >= 0 ? shift : long(size) + shift].real()/(size*norm);
+      }
+      std::size_t peak = std::max_element(values.begin(),values.end()) - values.begin();
+      // Refine the lag with a parabola through the peak and its neighbours
+      double offset = 0.0;
+      if(peak > 0 && peak + 1 < values.size())
+      {
+        double curvature = values[peak-1] - 2.0*values[peak] + values[peak+1];
+        if(curvature < 0.0)
+        {
+          offset = 0.5*(values[peak-1] - values[peak+1])/curvature;
+        }
+      }
+      member_lags[2*p] = (shift_min + long(peak) + offset)*step;
+      member_lags[2*p+1] = values[peak];
+    }
+  }
+
+  lags[member] = member_lags;
+  BeginMember();
+}
+
+void LagAnalysis::AddMemberFromFile(std::string member, std::string filename)
+{
+  double row[8];
+  ResultsReader f;
+  f.Open(filename);
+  if(f.GetNumColumns() != 8)
+  {
+    throw std::runtime_error("Unexpected number of columns in results file " + filename);
+  }
+  BeginMember();
+  while(f.ReadRow(row))
+  {
+    AddStep(row);
+  }
+  f.Close();
+  CommitMember(member);
+}
+
+void LagAnalysis::CopyMember(std::string from, std::string to)
+{
+  std::map<std::string, std::vector<double> >::iterator entry = lags.find(from);
+  if(entry != lags.end())
+  {
+    lags[to] = entry->second;
+  }
+}
+
+void LagAnalysis::WriteState(std::string filename)
+{
+  std::ofstream f(filename.c_str());
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open lag scratch file " + filename);
+  }
+  f << std::setprecision(17);
+  for(std::map<std::string, std::vector<double> >::iterator entry=lags.begin();entry!=lags.end();entry++)
+  {
+    f << entry->first;
+    for(std::size_t k=0;k<entry->second.size();k++)
+    {
+      f << "\t" << entry->second[k];
+    }
+    f << "\n";
+  }
+  f.close();
+}
+
+void LagAnalysis::MergeState(std::string filename)
+{
+  std::ifstream f(filename.c_str());
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open lag scratch file " + filename);
+  }
+  std::string line;
+  while(std::getline(f,line))
+  {
+    std::stringstream line_stream(line);
+    std::string member,field;
+    std::getline(line_stream,member,'\t');
+    std::vector<double> member_lags;
+    while(std::getline(line_stream,field,'\t'))
+    {
+      member_lags.push_back(std::stod(field));
+    }
+    if(member_lags.size() != 2*pairs.size())
+    {
+      throw std::runtime_error("Lag scratch file " + filename + " is incomplete");
+    }
+    lags[member] = member_lags;
+  }
+  f.close();
+}
+
+void LagAnalysis::PrintToFile(std::string filename, const std::vector<std::string> & members)
+{
+  std::ofstream f(filename.c_str());
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open lag output file " + filename);
+  }
+  f << std::setprecision(6) << std::scientific;
+  for(std::size_t k=0;k<members.size();k++)
+  {
+    std::map<std::string, std::vector<double> >::iterator entry = lags.find(members[k]);
+    if(entry == lags.end())
+    {
+      continue;
+    }
+    f << members[k];
+    for(std::size_t j=0;j<entry->second.size();j++)
+    {
+      f << "\t" << entry->second[j];
+    }
+    f << "\n";
+  }
+  f.close();
+}
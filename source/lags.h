@@ -0,0 +1,136 @@
+/*
+lags.h
+Class definition for time lags between synthetic channels
+*/
+
+#ifndef LAGS_H
+#define LAGS_H
+
+#include <map>
+#include "helper.h"
+#include "reduction.h"
+
+// Time-lag analysis object
+//
+// Finds the time lag between pairs of channels of each run, as in Viall &
+// Klimchuk (2012): the lag of the peak of the cross-correlation of the light
+// curves of the two channels, within a given range of lags, together with the
+// value of the peak. The light curves are interpolated linearly onto a uniform
+// time grid as the run is integrated and cross-correlated with FFTs once it has
+// finished, so they are never written to disk. Only the grid times covered by
+// the run are used.
+//
+// A channel is either one of the columns of the results, `temperature_e`,
+// `temperature_i`, `density`, `pressure_e`, `pressure_i`, `velocity` or `heat`,
+// or is defined by a temperature response function R(T), in which case its
+// intensity is n^2 R(T_e), i.e. that of an isothermal loop per unit column depth.
+// Only the shape of the light curves matters, as the correlations are normalized.
+// A lag is positive if the second channel of the pair peaks after the first.
+//
+class LagAnalysis {
+private:
+  // Channel whose light curve is correlated
+  //
+  struct Channel {
+    std::string name;
+    /* Index of the column in a results row; -1 for a channel defined by a response function */
+    int column;
+    /* Base-10 logarithm of the temperatures (in K) of the response function */
+    std::vector<double> log_temperature;
+    /* Response function at each temperature */
+    std::vector<double> response;
+  };
+
+  // Pair of channels to find the lag between
+  //
+  struct ChannelPair {
+    /* Indices of the two channels in <channels> */
+    int first;
+    int second;
+    /* Range of lags searched (in s) */
+    double min_lag;
+    double max_lag;
+  };
+
+  /* Channels used by any pair */
+  std::vector<Channel> channels;
+
+  /* Pairs of channels */
+  std::vector<ChannelPair> pairs;
+
+  /* Light curves of the current run on the grid, one value per channel */
+  GridInterpolator interpolator;
+
+  /* Value of each channel at the current step */
+  std::vector<double> step_values;
+
+  /* Lag (in s) and peak correlation of each pair, by member */
+  std::map<std::string, std::vector<double> > lags;
+
+  // @return index of the channel named <name> in <channels>, adding it if it is a results column not used yet
+  //
+  int FindChannel(std::string name);
+
+  // @return value of <channel> for the results row <row>
+  //
+  double GetChannelValue(const Channel & channel, const double * row);
+
+public:
+  // Constructor
+  // @channel_definitions one `name=file` definition per channel given by a response
+  // function; the file has two columns, the temperature (in K) and the response
+  // @pair_specifications one `first,second:min_lag:max_lag` specification per pair of channels
+  // @grid string of the form `start:stop:step` giving the uniform time grid (in s)
+  //
+  LagAnalysis(std::vector<std::string> channel_definitions, std::vector<std::string> pair_specifications, std::string grid);
+
+  // Start a new run, discarding any uncommitted light curves
+  //
+  void BeginMember(void);
+
+  // Add a step of the current run
+  // @row results row at this step, in the same order as the columns of the results file
+  //
+  // Steps must be added in order of time.
+  //
+  void AddStep(const double * row);
+
+  // Find the lags of the current run
+  // @member name the lags are stored under
+  //
+  void CommitMember(std::string member);
+
+  // Find the lags of a run from its results file
+  // @member name the lags are stored under
+  // @filename results file of the run, in either output format
+  //
+  void AddMemberFromFile(std::string member, std::string filename);
+
+  // Store the lags of one member under another name too
+  // @from member whose lags are copied; nothing is done if it has none
+  // @to name of the copy
+  //
+  void CopyMember(std::string from, std::string to);
+
+  // Write the lags found so far to a scratch file
+  //
+  void WriteState(std::string filename);
+
+  // Add the lags from a scratch file written by <WriteState>
+  //
+  void MergeState(std::string filename);
+
+  // Print the lag map
+  // @filename output file
+  // @members order of the rows; members without lags are left out
+  //
+  // There is one row per member. The columns are the member and then the lag (in
+  // s) and the peak correlation of each pair, in the order the pairs were
+  // specified. Both are NaN if a light curve is constant or covers fewer than two grid times.
+  //
+  void PrintToFile(std::string filename, const std::vector<std::string> & members);
+};
+// Pointer to the <LagAnalysis> class
+typedef LagAnalysis* LAGS;
+
+#endif
@@ -0,0 +1,238 @@
+/*
+lines.cpp
+Methods for spectral line intensities from the DEM
+*/
+
+#include "lines.h"
+#include <limits>
+#include <sstream>
+#include "../rsp_toolkit/source/constants.h"
+
+std::map<std::string, std::shared_ptr<const LineTables> > LineSynthesis::cache;
+
+LineSynthesis::LineSynthesis(const std::vector<std::string> & filenames, const std::vector<double> & temperature, std::string filename, bool binary)
+{
+  std::size_t num_bins = temperature.size();
+  if(num_bins < 2)
+  {
+    throw std::runtime_error("Line synthesis needs at least two temperature bins.");
+  }
+  if(filenames.empty())
+  {
+    throw std::runtime_error("Line synthesis needs at least one line.");
+  }
+
+  // Reuse the tables of an earlier run with the same lines and bins
+  std::ostringstream key;
+  key << std::setprecision(17) << num_bins << "\t" << temperature.front() << "\t" << temperature.back();
+  for(std::size_t l=0;l<filenames.size();l++)
+  {
+    key << "\t" << filenames[l];
+  }
+  std::map<std::string, std::shared_ptr<const LineTables> >::iterator entry = cache.find(key.str());
+  if(entry == cache.end())
+  {
+    entry = cache.insert(std::make_pair(key.str(),LoadTables(filenames,temperature))).first;
+  }
+  tables = entry->second;
+
+  // Bins are equally spaced in log T, so each is delta_log_t wide centered on its temperature
+  double delta_log_t = log10(temperature[1]/temperature[0]);
+  log_temperature.resize(num_bins);
+  bin_width.resize(num_bins);
+  for(std::size_t j=0;j<num_bins;j++)
+  {
+    log_temperature[j] = log10(temperature[j]);
+    bin_width[j] = temperature[j]*(pow(10.0,0.5*delta_log_t) - pow(10.0,-0.5*delta_log_t));
+  }
+  row.resize(1 + tables->num_lines);
+
+  if(binary)
+  {
+    f_binary.Open(filename,row.size());
+    return;
+  }
+  f.open(filename.c_str());
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open line intensity file " + filename);
+  }
+}
+
+std::shared_ptr<const LineTables> LineSynthesis::LoadTables(const std::vector<std::string> & filenames, const std::vector<double> & temperature)
+{
+  std::shared_ptr<LineTables> tables(new LineTables);
+  tables->num_lines = filenames.size();
+  tables->num_bins = temperature.size();
+
+  std::vector<std::vector<double> > log_density(filenames.size());
+  std::vector<std::vector<double> > log_t(filenames.size());
+  std::vector<std::vector<std::vector<double> > > contribution(filenames.size());
+  for(std::size_t l=0;l<filenames.size();l++)
+  {
+    std::ifstream f(filenames[l].c_str());
+    if(!f.is_open())
+    {
+      throw std::runtime_error("Failed to open contribution function " + filenames[l]);
+    }
+    std::string line;
+    while(std::getline(f,line))
+    {
+      if(line.empty() || line[0] == '#')
+      {
+        continue;
+      }
+      std::istringstream line_stream(line);
+      std::vector<double> values;
+      double value;
+      while(line_stream >> value)
+      {
+        values.push_back(value);
+      }
+      if(values.empty())
+      {
+        continue;
+      }
+      // First row gives the densities
+      if(log_density[l].empty())
+      {
+        for(std::size_t k=0;k<values.size();k++)
+        {
+          if(!(values[k] > 0.0) || (k > 0 && values[k] <= values[k-1]))
+          {
+            throw std::runtime_error("Densities of contribution function " + filenames[l] + " must be positive and increasing");
+          }
+          log_density[l].push_back(log10(values[k]));
+        }
+        continue;
+      }
+      if(values.size() != log_density[l].size() + 1)
+      {
+        throw std::runtime_error("Each temperature of contribution function " + filenames[l] + " needs a value at each density");
+      }
+      if(!(values[0] > 0.0) || (!log_t[l].empty() && log10(values[0]) <= log_t[l].back()))
+      {
+        throw std::runtime_error("Temperatures of contribution function " + filenames[l] + " must be positive and increasing");
+      }
+      log_t[l].push_back(log10(values[0]));
+      contribution[l].push_back(std::vector<double>(values.begin()+1,values.end()));
+    }
+    if(log_t[l].size() < 2)
+    {
+      throw std::runtime_error("Contribution function " + filenames[l] + " needs at least two temperatures");
+    }
+    // A table at a single density is independent of density; all others share their densities
+    if(log_density[l].size() > 1)
+    {
+      if(tables->log_density.empty())
+      {
+        tables->log_density = log_density[l];
+      }
+      bool same = log_density[l].size() == tables->log_density.size();
+      for(std::size_t k=0;same && k<log_density[l].size();k++)
+      {
+        same = fabs(log_density[l][k] - tables->log_density[k]) < 1e-9;
+      }
+      if(!same)
+      {
+        throw std::runtime_error("Contribution function " + filenames[l] + " must be tabulated at a single density or at the same densities as the other lines");
+      }
+    }
+  }
+  if(tables->log_density.empty())
+  {
+    tables->log_density = log_density[0];
+  }
+
+  // Linear interpolation in log T onto the bins; no contribution outside the table
+  std::size_t num_densities = tables->log_density.size();
+  tables->contribution.assign(num_densities*tables->num_bins*tables->num_lines,0.0);
+  for(std::size_t l=0;l<filenames.size();l++)
+  {
+    const std::vector<double> & log_t_line = log_t[l];
+    for(std::size_t j=0;j<tables->num_bins;j++)
+    {
+      double log_temperature = log10(temperature[j]);
+      if(!(log_temperature >= log_t_line.front() && log_temperature <= log_t_line.back()))
+      {
+        continue;
+      }
+      std::size_t i = std::upper_bound(log_t_line.begin(),log_t_line.end(),log_temperature) - log_t_line.begin();
+      i = std::min(std::max(i,std::size_t(1)),log_t_line.size()-1);
+      double weight = (log_temperature - log_t_line[i-1])/(log_t_line[i] - log_t_line[i-1]);
+      for(std::size_t k=0;k<num_densities;k++)
+      {
+        std::size_t column = log_density[l].size() > 1 ? k : 0;
+        tables->contribution[(k*tables->num_bins + j)*tables->num_lines + l] = contribution[l][i-1][column] + weight*(contribution[l][i][column] - contribution[l][i-1][column]);
+      }
+    }
+  }
+
+  return tables;
+}
+
+void LineSynthesis::AddBin(std::size_t j, double emission_measure, double log_density)
+{
+  // Linear interpolation in log n, clamped to the ends of the table
+  const std::vector<double> & log_n = tables->log_density;
+  std::size_t k = 0;
+  double weight = 0.0;
+  if(log_n.size() > 1)
+  {
+    k = std::upper_bound(log_n.begin(),log_n.end(),log_density) - log_n.begin();
+    k = std::min(std::max(k,std::size_t(1)),log_n.size()-1) - 1;
+    weight = std::fmin(std::fmax((log_density - log_n[k])/(log_n[k+1] - log_n[k]),0.0),1.0);
+  }
+  std::size_t num_lines = tables->num_lines;
+  const double * lower = &tables->contribution[(k*tables->num_bins + j)*num_lines];
+  const double * upper = weight > 0.0 ? lower + tables->num_bins*num_lines : lower;
+  double * intensity = &row[1];
+  for(std::size_t l=0;l<num_lines;l++)
+  {
+    intensity[l] += emission_measure*(lower[l] + weight*(upper[l] - lower[l]));
+  }
+}
+
+void LineSynthesis::AddRow(double time, double density, double pressure_e, const double * row_tr, const double * row_corona)
+{
+  row[0] = time;
+  std::fill(row.begin()+1,row.end(),0.0);
+  double log_density_corona = log10(density);
+  double log_pressure_over_k = log10(pressure_e/BOLTZMANN_CONSTANT);
+  for(std::size_t j=0;j<bin_width.size();j++)
+  {
+    if(row_corona[j] > 0.0)
+    {
+      AddBin(j,row_corona[j]*bin_width[j],log_density_corona);
+    }
+    if(row_tr[j] > 0.0)
+    {
+      AddBin(j,row_tr[j]*bin_width[j],log_pressure_over_k - log_temperature[j]);
+    }
+  }
+
+  if(f_binary.IsOpen())
+  {
+    f_binary.WriteRow(row.data());
+    return;
+  }
+  f << std::fixed << std::setprecision(std::numeric_limits<double>::digits10) << row[0]
+  << std::setprecision(6) << std::scientific;
+  for(std::size_t l=1;l<row.size();l++)
+  {
+    f << "\t" << row[l];
+  }
+  f << "\n";
+}
+
+void LineSynthesis::Close(void)
+{
+  if(f_binary.IsOpen())
+  {
+    f_binary.Close();
+  }
+  else
+  {
+    f.close();
+  }
+}
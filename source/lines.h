@@ -0,0 +1,107 @@
+/*
+lines.h
+Class definition for spectral line intensities from the DEM
+*/
+
+#ifndef LINES_H
+#define LINES_H
+
+#include <map>
+#include <memory>
+#include "helper.h"
+#include "binary.h"
+
+// Contribution functions of a set of lines resampled onto the DEM temperature bins
+//
+struct LineTables {
+  /* Number of lines */
+  std::size_t num_lines;
+  /* Number of temperature bins */
+  std::size_t num_bins;
+  /* Base-10 logarithm of the densities (in cm^-3) the contribution functions are tabulated at */
+  std::vector<double> log_density;
+  /* Contribution function of each line in each bin at each density, indexed [density][bin][line] */
+  std::vector<double> contribution;
+};
+
+// Line synthesis object
+//
+// Integrates the contribution functions G(T,n) of a set of spectral lines
+// against the DEM as its rows are produced, I = sum_j G(T_j,n_j) DEM(T_j) ΔT_j,
+// so that line light curves are printed without keeping the DEM. The coronal DEM
+// is at the coronal density. The TR is taken to be at the electron pressure of
+// the corona, so the TR DEM in a bin of temperature T_j is at the density
+// p_e/(k_B T_j). G is interpolated linearly in log T and in log n and is zero
+// outside the temperatures of its table; densities outside the table are
+// clamped to its ends.
+//
+// Each contribution function is resampled onto the DEM bins once and the
+// result is shared by every run in the process with the same lines and bins, so
+// an ensemble reads the tables only once. For each bin, the contributions of
+// all lines are stored next to each other so the inner loop of each row runs over
+// lines.
+//
+class LineSynthesis {
+private:
+  /* Contribution functions on the DEM bins, shared between runs */
+  std::shared_ptr<const LineTables> tables;
+
+  /* Base-10 logarithm of the bin temperatures */
+  std::vector<double> log_temperature;
+
+  /* Width of each temperature bin (in K) */
+  std::vector<double> bin_width;
+
+  /* Time followed by the intensity of each line for the current row */
+  std::vector<double> row;
+
+  /* Output streams */
+  std::ofstream f;
+  BinaryWriter f_binary;
+
+  /* Tables already loaded, keyed by the line files and the bins */
+  static std::map<std::string, std::shared_ptr<const LineTables> > cache;
+
+  // Read contribution function tables and resample them onto the DEM bins
+  // @filenames one table per line
+  // @temperature bin temperatures (in K)
+  //
+  // @return tables of every line on a common density grid
+  //
+  static std::shared_ptr<const LineTables> LoadTables(const std::vector<std::string> & filenames, const std::vector<double> & temperature);
+
+  // Add the emission measure of one bin at a given density to the intensities
+  //
+  void AddBin(std::size_t j, double emission_measure, double log_density);
+
+public:
+  // Constructor
+  // @filenames contribution function table of each line, in the order of the output columns
+  // @temperature bin temperatures (in K), equally spaced in log T
+  // @filename output file
+  // @binary if true, print in the binary output format
+  //
+  // Each table file has a first row giving the densities (in cm^-3) that G is
+  // tabulated at, in increasing order, followed by one row per temperature,
+  // in increasing order: the temperature (in K) and then G at each density.
+  // Lines starting with `#` are skipped. The files of different lines may use
+  // different temperatures. A table with a single density is taken to be
+  // independent of density; all others must use the same densities.
+  //
+  LineSynthesis(const std::vector<std::string> & filenames, const std::vector<double> & temperature, std::string filename, bool binary);
+
+  // Add a row of the DEM and print the intensities
+  // @time time of the row (in s)
+  // @density coronal density (in cm^-3)
+  // @pressure_e electron pressure (in dyne cm^-2)
+  // @row_tr TR DEM
+  // @row_corona coronal DEM
+  //
+  void AddRow(double time, double density, double pressure_e, const double * row_tr, const double * row_corona);
+
+  // Close the output file
+  //
+  void Close(void);
+};
+
+#endif
@@ -4,12 +4,13 @@ Loop object that will hold all information about the loop and be evolved in time
 */
 
 #include "loop.h"
+#include "kernels.h"
 
 Parameters Loop::parameters;
 Terms Loop::terms;
 HEATER Loop::heater;
 
-Loop::Loop(char *config)
+Loop::Loop(const char *config)
 {
   tinyxml2::XMLElement *root;
 
@@ -43,9 +44,44 @@ Loop::Loop(char *config)
   parameters.calculate_dem = string2bool(get_element_text(root,"calculate_dem"));
   parameters.use_adaptive_solver = string2bool(get_element_text(root,"use_adaptive_solver"));
   parameters.save_terms = string2bool(get_element_text(root,"save_terms"));
+  parameters.defer_derived_quantities = string2bool(get_optional_element_text(root,"defer_derived_quantities","False"));
+  // The DEM needs the velocity and fluxes at every step so these cannot be deferred
+  if(parameters.calculate_dem)
+  {
+    parameters.defer_derived_quantities = false;
+  }
   //String parameters
   parameters.output_filename = get_element_text(root,"output_filename");
 
+  parameters.results_window_steps = std::stoi(get_optional_element_text(root,"results_window_steps","0"));
+  parameters.screening_error = std::stod(get_optional_element_text(root,"screening_error","0.0"));
+  parameters.stepper = get_optional_element_text(root,"stepper","cash_karp");
+  if(parameters.stepper.compare("cash_karp")!=0 && parameters.stepper.compare("adams_bashforth_moulton")!=0 && parameters.stepper.compare("bulirsch_stoer")!=0 && parameters.stepper.compare("imex")!=0)
+  {
+    throw std::runtime_error("Unrecognized stepper " + parameters.stepper + ". Use cash_karp, adams_bashforth_moulton, bulirsch_stoer or imex.");
+  }
+  parameters.output_format = get_optional_element_text(root,"output_format","text");
+  if(parameters.output_format.compare("text")!=0 && parameters.output_format.compare("binary")!=0)
+  {
+    throw std::runtime_error("Unrecognized output format " + parameters.output_format + ". Use text or binary.");
+  }
+  parameters.index_interval = std::stoi(get_optional_element_text(root,"index_interval","0"));
+  if(parameters.index_interval < 0)
+  {
+    throw std::runtime_error("Time index interval must be non-negative.");
+  }
+  parameters.max_memory = std::stod(get_optional_element_text(root,"max_memory","0.0"));
+  // A window already keeps memory use constant
+  if(parameters.results_window_steps > 0)
+  {
+    parameters.max_memory = 0.0;
+  }
+  // Deferred quantities can only be computed for the steps still stored
+  if(parameters.results_window_steps > 0 || parameters.max_memory > 0.0)
+  {
+    parameters.defer_derived_quantities = false;
+  }
+
   //Estimate results array length
   parameters.N = int(std::ceil(parameters.total_time/parameters.tau));
 
@@ -53,11 +89,22 @@ Loop::Loop(char *config)
   heater = new Heater(get_element(root,"heating"));
 
   //Initialize DEM object
+  parameters.save_dem = false;
+  parameters.save_dem_moments = false;
+  parameters.save_dem_lines = false;
   if(parameters.calculate_dem)
   {
     parameters.dem_options = get_element(root,"dem");
+    parameters.save_dem = string2bool(get_optional_element_text(parameters.dem_options,"save_dem","True"));
+    parameters.save_dem_moments = parameters.dem_options->FirstChildElement("moments") != NULL;
+    parameters.save_dem_lines = parameters.dem_options->FirstChildElement("lines") != NULL;
   }
 
+  // Non-equilibrium ionization is optional
+  parameters.nei_options = root->FirstChildElement("nei");
+  parameters.calculate_nei = parameters.nei_options != NULL;
+  parameters.nei_post_process = parameters.calculate_nei && string2bool(get_optional_element_text(parameters.nei_options,"post_process","False"));
+
   // Call the setup function
   Setup();
 }
@@ -72,6 +119,9 @@ Loop::~Loop(void)
   //Destructor--free some stuff here
   doc.Clear();
   delete heater;
+  // Scratch files are left over if the run failed before they were printed
+  results_scratch.Discard();
+  terms_scratch.Discard();
 }
 
 void Loop::Setup(void)
@@ -79,15 +129,37 @@ void Loop::Setup(void)
   // Calculate needed He abundance corrections
   CalculateAbundanceCorrection(parameters.helium_to_hydrogen_ratio);
 
-  //Reserve memory for results
-  results.time.resize(parameters.N);
-  results.heat.resize(parameters.N);
-  results.pressure_e.resize(parameters.N);
-  results.pressure_i.resize(parameters.N);
-  results.temperature_e.resize(parameters.N);
-  results.temperature_i.resize(parameters.N);
-  results.density.resize(parameters.N);
-  results.velocity.resize(parameters.N);
+  // Results are stored in chunks as they are computed so nothing is allocated up front.
+  // If a window is set, only the most recent steps are kept. The last step saved is
+  // never printed, so one more than the window is kept.
+  size_t capacity = parameters.results_window_steps > 0 ? parameters.results_window_steps + 1 : 0;
+  results.time.set_capacity(capacity);
+  results.heat.set_capacity(capacity);
+  results.pressure_e.set_capacity(capacity);
+  results.pressure_i.set_capacity(capacity);
+  results.temperature_e.set_capacity(capacity);
+  results.temperature_i.set_capacity(capacity);
+  results.density.set_capacity(capacity);
+  results.velocity.set_capacity(capacity);
+  terms.f_e.set_capacity(capacity);
+  terms.f_i.set_capacity(capacity);
+  terms.c1.set_capacity(capacity);
+  terms.radiative_loss.set_capacity(capacity);
+
+  // Reset statistics for the seven non-time columns
+  summary.num_steps = 0;
+  summary.first_time = 0.0;
+  summary.last_time = 0.0;
+  summary.last.assign(7,0.0);
+  summary.minimum.assign(7,(double)LARGEST_DOUBLE);
+  summary.maximum.assign(7,-(double)LARGEST_DOUBLE);
+  summary.integral.assign(7,0.0);
+  summary.pending_time = 0.0;
+  summary.pending.clear();
+  summary.solver_switches.clear();
+
+  // Zero intermediates in case they are read before the first state is set
+  __intermediates = Intermediates();
 }
 
 state_type Loop::GetState(void)
@@ -100,6 +172,24 @@ void Loop::SetState(state_type state)
   __state = state;
 }
 
+void Loop::CalculateIntermediates(double time)
+{
+  __intermediates.f_e = CalculateThermalConduction(__state[3], __state[2], "electron");
+  __intermediates.f_i = CalculateThermalConduction(__state[4], __state[2], "ion");
+  __intermediates.radiative_loss = CalculateRadiativeLoss(__state[3]);
+  __intermediates.c1 = CalculateC1(__state[3], __state[4], __state[2]);
+  __intermediates.scale_height = CalculateScaleHeight(__state[3], __state[4]);
+  __intermediates.R_tr = __intermediates.c1*std::pow(__state[2],2)*__intermediates.radiative_loss*parameters.loop_length;
+  // The velocity uses the density implied by the electron pressure, not the density of the state
+  __intermediates.velocity = CalculateVelocity(__state[3], __state[4], __state[0], __intermediates.radiative_loss, __intermediates.scale_height);
+  __intermediates.heat = heater->Get_Heating(time);
+}
+
+const Intermediates & Loop::GetIntermediates(void)
+{
+  return __intermediates;
+}
+
 state_type Loop::CalculateInitialConditions(void)
 {
   int i = 0;
@@ -151,58 +241,297 @@ state_type Loop::CalculateInitialConditions(void)
   return state;
 }
 
+int Loop::GetWindowStart(void)
+{
+  if(parameters.results_window_steps > 0)
+  {
+    return results.time.first();
+  }
+  return 0;
+}
+
 void Loop::PrintToFile(int num_steps)
 {
+  int start = GetWindowStart();
+  bool binary = parameters.output_format.compare("binary")==0;
   std::ofstream f;
-  f.open(parameters.output_filename);
-  for(int i=0;i<num_steps;i++)
+  BinaryWriter f_binary;
+  BinaryReader scratch;
+  TimeIndexWriter index;
+  double row[8];
+  // Times of the indexed rows, to index the terms by
+  std::vector<double> index_times;
+
+  // Results written to disk during the integration are read back from the scratch file
+  int first_in_memory = results.time.first();
+  bool spilled = results_scratch.IsOpen();
+  if(spilled)
   {
+    results_scratch.Close();
+    scratch.Open(parameters.output_filename+".scratch");
+  }
+
+  if(binary)
+  {
+    f_binary.Open(parameters.output_filename,8);
+  }
+  else
+  {
+    f.open(parameters.output_filename);
+  }
+  if(parameters.index_interval > 0)
+  {
+    index.Open(parameters.output_filename,parameters.index_interval);
+  }
+  for(int i=start;i<num_steps;i++)
+  {
+    if(i < first_in_memory)
+    {
+      scratch.ReadRow(row);
+    }
+    else
+    {
+      GetResultsRow(i,row);
+    }
+    if(index.IsDue())
+    {
+      index_times.push_back(row[0]);
+      index.AddRow(row[0],binary ? f_binary.GetOffset() : uint64_t(f.tellp()));
+    }
+    else
+    {
+      index.AddRow(row[0],0);
+    }
+    if(binary)
+    {
+      f_binary.WriteRow(row);
+      continue;
+    }
     //Use 10 decimal places when printing the time
     f << std::fixed << std::setprecision(std::numeric_limits<double>::digits10)
-    << results.time[i] << "\t"
+    << row[0] << "\t"
     << std::setprecision(6) << std::scientific
-    << results.temperature_e[i] << "\t"
-    << results.temperature_i[i] << "\t"
-    << results.density[i] << "\t"
-    << results.pressure_e[i] << "\t"
-    << results.pressure_i[i] << "\t"
-    << results.velocity[i] << "\t"
-    << results.heat[i] << "\n";
+    << row[1] << "\t"
+    << row[2] << "\t"
+    << row[3] << "\t"
+    << row[4] << "\t"
+    << row[5] << "\t"
+    << row[6] << "\t"
+    << row[7] << "\n";
+  }
+  if(binary)
+  {
+    f_binary.Close();
+  }
+  else
+  {
+    f.close();
+  }
+  index.Close();
+  if(spilled)
+  {
+    scratch.Close();
+    results_scratch.Discard();
   }
-  f.close();
 
   if(parameters.save_terms)
   {
-    f.open(parameters.output_filename+".terms");
-    for(int i=0;i<num_steps;i++)
+    if(spilled)
+    {
+      terms_scratch.Close();
+      scratch.Open(parameters.output_filename+".terms.scratch");
+    }
+    if(binary)
+    {
+      f_binary.Open(parameters.output_filename+".terms",4);
+    }
+    else
+    {
+      f.open(parameters.output_filename+".terms");
+    }
+    if(parameters.index_interval > 0)
+    {
+      index.Open(parameters.output_filename+".terms",parameters.index_interval);
+    }
+    for(int i=start;i<num_steps;i++)
+    {
+      if(i < first_in_memory)
+      {
+        scratch.ReadRow(row);
+      }
+      else
+      {
+        GetTermsRow(i,row);
+      }
+      if(index.IsDue())
+      {
+        index.AddRow(index_times[(i-start)/parameters.index_interval],binary ? f_binary.GetOffset() : uint64_t(f.tellp()));
+      }
+      else
+      {
+        index.AddRow(0.0,0);
+      }
+      if(binary)
+      {
+        f_binary.WriteRow(row);
+        continue;
+      }
+      f << row[0] << "\t"
+      << row[1] << "\t"
+      << row[2] << "\t"
+      << row[3] << "\n";
+    }
+    if(binary)
+    {
+      f_binary.Close();
+    }
+    else
+    {
+      f.close();
+    }
+    index.Close();
+    if(spilled)
+    {
+      scratch.Close();
+      terms_scratch.Discard();
+    }
+  }
+
+  if(parameters.results_window_steps > 0)
+  {
+    double duration = summary.last_time - summary.first_time;
+    f.open(parameters.output_filename+".summary");
+    if(parameters.calculate_dem)
+    {
+      f << "# DEM kernels: " << GetDemKernels().isa << "\n";
+    }
+    f << std::setprecision(6) << std::scientific;
+    for(int k=0;k<7;k++)
+    {
+      f << summary.minimum[k] << (k<6 ? "\t" : "\n");
+    }
+    for(int k=0;k<7;k++)
+    {
+      f << summary.maximum[k] << (k<6 ? "\t" : "\n");
+    }
+    for(int k=0;k<7;k++)
+    {
+      f << (duration > 0.0 ? summary.integral[k]/duration : summary.last[k]) << (k<6 ? "\t" : "\n");
+    }
+    f.close();
+  }
+
+  if(!summary.solver_switches.empty())
+  {
+    f.open(parameters.output_filename+".solver_switches");
+    f << std::setprecision(6) << std::scientific;
+    for(std::size_t k=0;k<summary.solver_switches.size();k++)
     {
-      f << terms.f_e[i] << "\t"
-      << terms.f_i[i] << "\t"
-      << terms.c1[i] << "\t"
-      << terms.radiative_loss[i] << "\n";
+      f << summary.solver_switches[k].time << "\t" << summary.solver_switches[k].tau << "\t" << summary.solver_switches[k].action << "\n";
     }
     f.close();
   }
 }
 
+std::vector<std::string> Loop::GetOutputFiles(void)
+{
+  std::vector<std::string> filenames;
+  filenames.push_back(parameters.output_filename);
+  if(parameters.save_terms)
+  {
+    filenames.push_back(parameters.output_filename+".terms");
+  }
+  if(parameters.save_dem)
+  {
+    filenames.push_back(parameters.output_filename+".dem_corona");
+    filenames.push_back(parameters.output_filename+".dem_tr");
+  }
+  // Each of these has a time index if requested
+  if(parameters.index_interval > 0)
+  {
+    std::size_t num_indexed = filenames.size();
+    for(std::size_t k=0;k<num_indexed;k++)
+    {
+      filenames.push_back(filenames[k]+".index");
+    }
+  }
+  if(parameters.save_dem_moments)
+  {
+    filenames.push_back(parameters.output_filename+".dem_moments");
+  }
+  if(parameters.save_dem_lines)
+  {
+    filenames.push_back(parameters.output_filename+".lines");
+  }
+  if(parameters.calculate_nei)
+  {
+    filenames.push_back(parameters.output_filename+".nei");
+  }
+  if(parameters.results_window_steps > 0)
+  {
+    filenames.push_back(parameters.output_filename+".summary");
+  }
+  if(!summary.solver_switches.empty())
+  {
+    filenames.push_back(parameters.output_filename+".solver_switches");
+  }
+  return filenames;
+}
+
+void Loop::RecordSolverSwitch(double time, double tau, std::string action)
+{
+  SolverSwitch solver_switch = {time,tau,action};
+  summary.solver_switches.push_back(solver_switch);
+}
+
 void Loop::CalculateDerivs(const state_type &state, state_type &derivs, double time)
 {
-  double dpe_dt,dpi_dt,dn_dt,dTe_dt,dTi_dt;
-  double psi_tr,psi_c,xi,R_tr,enthalpy_flux;
+  double psi_c,R_tr;
+
+  double f_e = CalculateThermalConduction(state[3],state[2],"electron");
+  double f_i = CalculateThermalConduction(state[4],state[2],"ion");
+  double radiative_loss = CalculateRadiativeLoss(state[3]);
+  double heat = heater->Get_Heating(time);
+  double c1 = CalculateC1(state[3],state[4],state[2]);
+  double collision_frequency = CalculateCollisionFrequency(state[3],state[2]);
+
+  R_tr = c1*std::pow(state[2],2)*radiative_loss*parameters.loop_length;
+  psi_c = BOLTZMANN_CONSTANT*state[2]*collision_frequency*(state[4] - state[3]);
 
+  CombineTerms(state,f_e,f_i,R_tr,c1,psi_c,heat,derivs);
+}
+
+void Loop::CalculateStiffDerivs(const state_type &state, state_type &derivs, double /*time*/)
+{
   double f_e = CalculateThermalConduction(state[3],state[2],"electron");
   double f_i = CalculateThermalConduction(state[4],state[2],"ion");
   double radiative_loss = CalculateRadiativeLoss(state[3]);
+  double c1 = CalculateC1(state[3],state[4],state[2]);
+  double collision_frequency = CalculateCollisionFrequency(state[3],state[2]);
+  double R_tr = c1*std::pow(state[2],2)*radiative_loss*parameters.loop_length;
+  double psi_c = BOLTZMANN_CONSTANT*state[2]*collision_frequency*(state[4] - state[3]);
+
+  CombineTerms(state,f_e,f_i,R_tr,c1,psi_c,0.0,derivs);
+}
+
+void Loop::CalculateNonStiffDerivs(const state_type &state, state_type &derivs, double time)
+{
   double heat = heater->Get_Heating(time);
   double c1 = CalculateC1(state[3],state[4],state[2]);
+
+  CombineTerms(state,0.0,0.0,0.0,c1,0.0,heat,derivs);
+}
+
+void Loop::CombineTerms(const state_type &state, double f_e, double f_i, double R_tr, double c1, double psi_c, double heat, state_type &derivs)
+{
+  double dpe_dt,dpi_dt,dn_dt,dTe_dt,dTi_dt;
+  double psi_tr,xi,enthalpy_flux;
+
   double c2 = CalculateC2();
   double c3 = CalculateC3();
-  double collision_frequency = CalculateCollisionFrequency(state[3],state[2]);
 
   xi = state[0]/state[1];
-  R_tr = c1*std::pow(state[2],2)*radiative_loss*parameters.loop_length;
   psi_tr = (f_e + R_tr - xi*f_i)/(1.0 + xi);
-  psi_c = BOLTZMANN_CONSTANT*state[2]*collision_frequency*(state[4] - state[3]);
   enthalpy_flux = GAMMA_MINUS_ONE/GAMMA*(-f_e - R_tr + psi_tr);
 
   dpe_dt = GAMMA_MINUS_ONE*(heat*heater->partition + 1.0/parameters.loop_length*(psi_tr - R_tr*(1.0 + 1.0/c1))) + psi_c;
@@ -229,11 +558,23 @@ void Loop::CalculateDerivs(const state_type &state, state_type &derivs, double t
 void Loop::SaveResults(int i,double time)
 {
   // Get heating profile and velocity
-  double heat = heater->Get_Heating(time);
-  double velocity = CalculateVelocity(__state[3], __state[4], __state[0]);
+  double heat = __intermediates.heat;
+  double velocity = __intermediates.velocity;
+
+  // Keep statistics over every printed step when only a window is stored. The last
+  // step saved is not printed, so each step is only included once the next one is saved
+  if(parameters.results_window_steps > 0)
+  {
+    if(!summary.pending.empty())
+    {
+      UpdateSummary(summary.pending_time, summary.pending.data());
+    }
+    summary.pending = {__state[3], __state[4], __state[2], __state[0], __state[1], velocity, heat};
+    summary.pending_time = time;
+  }
 
   // Save results to results structure
-  if(i >= parameters.N)
+  if((std::size_t)i >= results.time.size())
   {
     results.time.push_back(time);
     results.heat.push_back(heat);
@@ -257,19 +598,158 @@ void Loop::SaveResults(int i,double time)
   }
 }
 
-void Loop::SaveTerms(void)
+void Loop::GetResultsRow(int i, double * row)
+{
+  row[0] = results.time[i];
+  row[1] = results.temperature_e[i];
+  row[2] = results.temperature_i[i];
+  row[3] = results.density[i];
+  row[4] = results.pressure_e[i];
+  row[5] = results.pressure_i[i];
+  row[6] = results.velocity[i];
+  row[7] = results.heat[i];
+}
+
+void Loop::GetTermsRow(int i, double * row)
+{
+  row[0] = terms.f_e[i];
+  row[1] = terms.f_i[i];
+  row[2] = terms.c1[i];
+  row[3] = terms.radiative_loss[i];
+}
+
+std::size_t Loop::GetMemory(void)
+{
+  return results.time.memory() + results.heat.memory() + results.pressure_e.memory() + results.pressure_i.memory()
+    + results.temperature_e.memory() + results.temperature_i.memory() + results.density.memory() + results.velocity.memory()
+    + terms.f_e.memory() + terms.f_i.memory() + terms.c1.memory() + terms.radiative_loss.memory();
+}
+
+void Loop::SpillToDisk(void)
+{
+  double row[8];
+  std::size_t rows_per_chunk = results.time.rows_per_chunk();
+
+  // Keep the chunk holding the most recent step in memory
+  while(results.time.first() + rows_per_chunk < results.time.size())
+  {
+    if(!results_scratch.IsOpen())
+    {
+      results_scratch.Open(parameters.output_filename+".scratch",8);
+    }
+    if(parameters.save_terms && !terms_scratch.IsOpen())
+    {
+      terms_scratch.Open(parameters.output_filename+".terms.scratch",4);
+    }
+    for(std::size_t i=results.time.first();i<results.time.first()+rows_per_chunk;i++)
+    {
+      GetResultsRow(i,row);
+      results_scratch.WriteRow(row);
+      if(parameters.save_terms)
+      {
+        GetTermsRow(i,row);
+        terms_scratch.WriteRow(row);
+      }
+    }
+    results.time.release_front();
+    results.heat.release_front();
+    results.pressure_e.release_front();
+    results.pressure_i.release_front();
+    results.temperature_e.release_front();
+    results.temperature_i.release_front();
+    results.density.release_front();
+    results.velocity.release_front();
+    if(parameters.save_terms)
+    {
+      terms.f_e.release_front();
+      terms.f_i.release_front();
+      terms.c1.release_front();
+      terms.radiative_loss.release_front();
+    }
+  }
+}
+
+void Loop::UpdateSummary(double time, const double * values)
 {
-  // Calculate terms
-  double f_e = CalculateThermalConduction(__state[3], __state[2], "electron");
-  double f_i = CalculateThermalConduction(__state[4], __state[2], "ion");
-  double c1 = CalculateC1(__state[3], __state[4], __state[2]);
-  double radiative_loss = CalculateRadiativeLoss(__state[3]);
+  for(int k=0;k<7;k++)
+  {
+    if(summary.num_steps > 0)
+    {
+      // Trapezoidal rule for the time average
+      summary.integral[k] += 0.5*(values[k] + summary.last[k])*(time - summary.last_time);
+    }
+    summary.minimum[k] = std::fmin(summary.minimum[k],values[k]);
+    summary.maximum[k] = std::fmax(summary.maximum[k],values[k]);
+    summary.last[k] = values[k];
+  }
+  if(summary.num_steps == 0)
+  {
+    summary.first_time = time;
+  }
+  summary.last_time = time;
+  summary.num_steps++;
+}
 
+void Loop::SaveTerms(void)
+{
   // Save terms
-  terms.f_e.push_back(f_e);
-  terms.f_i.push_back(f_i);
-  terms.c1.push_back(c1);
-  terms.radiative_loss.push_back(radiative_loss);
+  terms.f_e.push_back(__intermediates.f_e);
+  terms.f_i.push_back(__intermediates.f_i);
+  terms.c1.push_back(__intermediates.c1);
+  terms.radiative_loss.push_back(__intermediates.radiative_loss);
+}
+
+void Loop::CalculateDerivedQuantities(int num_steps)
+{
+  // Only split the work if there is enough of it to pay for the threads
+  int min_steps_per_thread = 1000;
+  int num_threads = std::max(1,std::min(int(std::thread::hardware_concurrency()),num_steps/min_steps_per_thread));
+  int steps_per_thread = (num_steps + num_threads - 1)/num_threads;
+
+  if(parameters.save_terms)
+  {
+    terms.f_e.resize(num_steps);
+    terms.f_i.resize(num_steps);
+    terms.c1.resize(num_steps);
+    terms.radiative_loss.resize(num_steps);
+  }
+
+  std::vector<std::thread> threads;
+  for(int k=1;k<num_threads;k++)
+  {
+    int start = std::min(num_steps,k*steps_per_thread);
+    int end = std::min(num_steps,(k+1)*steps_per_thread);
+    threads.push_back(std::thread(&Loop::CalculateDerivedQuantitiesRange,this,start,end));
+  }
+  CalculateDerivedQuantitiesRange(0,std::min(num_steps,steps_per_thread));
+  for(std::size_t k=0;k<threads.size();k++)
+  {
+    threads[k].join();
+  }
+}
+
+void Loop::CalculateDerivedQuantitiesRange(int start, int end)
+{
+  const std::string electron("electron");
+  const std::string ion("ion");
+
+  for(int i=start;i<end;i++)
+  {
+    double temperature_e = results.temperature_e[i];
+    double temperature_i = results.temperature_i[i];
+    double radiative_loss = CalculateRadiativeLoss(temperature_e);
+
+    results.velocity[i] = CalculateVelocity(temperature_e,temperature_i,results.pressure_e[i],radiative_loss,CalculateScaleHeight(temperature_e,temperature_i));
+    results.heat[i] = heater->Get_Heating(results.time[i]);
+    if(parameters.save_terms)
+    {
+      double density = results.density[i];
+      terms.f_e[i] = CalculateThermalConduction(temperature_e,density,electron);
+      terms.f_i[i] = CalculateThermalConduction(temperature_i,density,ion);
+      terms.c1[i] = CalculateC1(temperature_e,temperature_i,density);
+      terms.radiative_loss[i] = radiative_loss;
+    }
+  }
 }
 
 double Loop::CalculateThermalConduction(double temperature, double density, std::string species)
@@ -422,18 +902,28 @@ void Loop::CalculateAbundanceCorrection(double helium_to_hydrogen_ratio)
 
 double Loop::CalculateVelocity(double temperature_e, double temperature_i, double pressure_e)
 {
-  double c4 = CalculateC4();
+  return CalculateVelocity(temperature_e,temperature_i,pressure_e,CalculateRadiativeLoss(temperature_e),CalculateScaleHeight(temperature_e,temperature_i));
+}
+
+double Loop::CalculateVelocity(double temperature_e, double temperature_i, double pressure_e, double radiative_loss, double scale_height)
+{
   double density = pressure_e/(BOLTZMANN_CONSTANT*temperature_e);
   double c1 = CalculateC1(temperature_e,temperature_i,density);
-  double R_tr = c1*std::pow(density,2)*CalculateRadiativeLoss(temperature_e)*parameters.loop_length;
+  double R_tr = c1*std::pow(density,2)*radiative_loss*parameters.loop_length;
   double fe = CalculateThermalConduction(temperature_e,density,"electron");
   double fi = CalculateThermalConduction(temperature_i,density,"ion");
-  double sc = CalculateScaleHeight(temperature_e,temperature_i);
+
+  return CalculateVelocity(temperature_e,temperature_i,pressure_e,fe,fi,R_tr,scale_height);
+}
+
+double Loop::CalculateVelocity(double temperature_e, double temperature_i, double pressure_e, double f_e, double f_i, double R_tr, double scale_height)
+{
+  double c4 = CalculateC4();
   double xi = temperature_e/temperature_i/parameters.boltzmann_correction;
 
   double coefficient = c4*xi*GAMMA_MINUS_ONE/(GAMMA*(xi+1));
-  double pressure_e_0 = pressure_e*std::exp(2.0*parameters.loop_length*std::sin(_PI_/5.0)/(_PI_*sc));
-  double enthalpy_flux = -(fe + fi + R_tr);
+  double pressure_e_0 = pressure_e*std::exp(2.0*parameters.loop_length*std::sin(_PI_/5.0)/(_PI_*scale_height));
+  double enthalpy_flux = -(f_e + f_i + R_tr);
 
   return coefficient*enthalpy_flux/pressure_e_0;
 }
@@ -8,6 +8,7 @@ Loop class definition
 
 #include "helper.h"
 #include "heater.h"
+#include "binary.h"
 #include "../rsp_toolkit/source/file.h"
 #include "../rsp_toolkit/source/constants.h"
 
@@ -23,18 +24,46 @@ private:
   /* Results structure */
   Results results;
 
+  /* Statistics over every step, used when only a window of results is kept, and
+  changes of integration method */
+  Summary summary;
+
+  /* Scratch file for results written to disk to stay within <Parameters.max_memory> */
+  BinaryWriter results_scratch;
+
+  /* Scratch file for terms written to disk to stay within <Parameters.max_memory> */
+  BinaryWriter terms_scratch;
+
   /* Pointer to doc tree */
   tinyxml2::XMLDocument doc;
 
   /* Current state of the system */
   state_type __state;
 
+  /* Intermediate quantities evaluated at the current state */
+  Intermediates __intermediates;
+
   // Calculate c4
   // @return ratio of average to base velocity
   //
   // Calculate the ratio of average to base velocity. Set to 1 for now
   //
-  double CalculateC4(void);
+  static double CalculateC4(void);
+
+  // Combine the terms of the loop equations
+  // @state current state of the loop
+  // @f_e electron heat flux (in erg cm$^{-2}$ s$^{-1}$)
+  // @f_i ion heat flux (in erg cm$^{-2}$ s$^{-1}$)
+  // @R_tr transition region radiative loss (in erg cm$^{-2}$ s$^{-1}$)
+  // @c1 ratio of transition region to coronal radiative loss
+  // @psi_c electron-ion equilibration term (in erg cm$^{-3}$ s$^{-1}$)
+  // @heat heating rate (in erg cm$^{-3}$ s$^{-1}$)
+  // @derivs time derivatives of the state
+  //
+  // The derivatives are linear in each of the terms, so setting some of them to
+  // zero gives the contribution of the others.
+  //
+  static void CombineTerms(const state_type &state, double f_e, double f_i, double R_tr, double c1, double psi_c, double heat, state_type &derivs);
 
   // Calculate coulomb collision frequency
   // @temperature_e electron temperature (in K)
@@ -52,6 +81,62 @@ private:
   //
   void CalculateAbundanceCorrection(double helium_to_hydrogen_ratio);
 
+  // Copy a stored row of results
+  // @i index of the step
+  // @row space for time, electron temperature, ion temperature, density, electron pressure, ion pressure, velocity and heating rate
+  //
+  void GetResultsRow(int i, double * row);
+
+  // Copy a stored row of terms
+  // @i index of the step
+  // @row space for electron heat flux, ion heat flux, $c_1$ and radiative loss
+  //
+  void GetTermsRow(int i, double * row);
+
+  // Update summary statistics
+  // @time current time (in s)
+  // @values electron temperature, ion temperature, density, electron pressure, ion pressure, velocity and heating rate
+  //
+  void UpdateSummary(double time,const double * values);
+
+  // Calculate velocity from precomputed terms
+  // @temperature_e electron temperature (in K)
+  // @temperature_i ion temperature (in K)
+  // @pressure_e electron pressure (in dyne cm$^{-2}$ s$^{-1}$)
+  // @f_e electron heat flux (in erg cm$^{-2}$ s$^{-1}$)
+  // @f_i ion heat flux (in erg cm$^{-2}$ s$^{-1}$)
+  // @R_tr transition region radiative losses (in erg cm$^{-2}$ s$^{-1}$)
+  // @scale_height temperature scale height (in cm)
+  //
+  // Combine heat fluxes and losses already evaluated at the density implied by
+  // the electron pressure into the velocity, as in <CalculateVelocity>.
+  //
+  // @return velocity averaged over the loop half-length (in cm s$^{-1}$)
+  //
+  static double CalculateVelocity(double temperature_e,double temperature_i,double pressure_e,double f_e,double f_i,double R_tr,double scale_height);
+
+  // Calculate velocity from the terms depending only on temperature
+  // @temperature_e electron temperature (in K)
+  // @temperature_i ion temperature (in K)
+  // @pressure_e electron pressure (in dyne cm$^{-2}$ s$^{-1}$)
+  // @radiative_loss radiative loss at <temperature_e> (in erg cm$^3$ s$^{-1}$)
+  // @scale_height temperature scale height (in cm)
+  //
+  // Same as <CalculateVelocity>, but reusing a radiative loss and scale height
+  // that have already been computed, since neither depends on the density.
+  //
+  // @return velocity averaged over the loop half-length (in cm s$^{-1}$)
+  //
+  static double CalculateVelocity(double temperature_e,double temperature_i,double pressure_e,double radiative_loss,double scale_height);
+
+  // Calculate derived quantities for a range of stored results
+  // @start index of the first entry
+  // @end index one past the last entry
+  //
+  // Worker for <CalculateDerivedQuantities>.
+  //
+  void CalculateDerivedQuantitiesRange(int start, int end);
+
 public:
 
   /* Instance of the <Heater> object */
@@ -70,7 +155,7 @@ public:
   // file <ebtel_config> into the <parameters> structure. The constructor also creates the <heater> object for calculating
   // the heating profile.
   //
-  Loop(char * config);
+  Loop(const char * config);
 
   // Default constructor
   //
@@ -85,7 +170,7 @@ public:
 
   // Setup object
   //
-  // Allocate space for results and set some parameters. If you
+  // Reset the results storage and set some parameters. If you
   // create the object with the empty constructor, you need to
   // call this later on. If you use the default config file approach,
   // this is called automatically.
@@ -107,10 +192,32 @@ public:
   //
   // Print results of EBTEL simulation to filename supplied in configuration file.
   // See documentation for the structure of the file itself and
-  // instructions on how to parse it.
+  // instructions on how to parse it. If only a window of results is kept, the
+  // summary statistics over the whole run are printed to a separate file. So are
+  // any changes of integration method made by the adaptive solver. Any
+  // results written to disk by <SpillToDisk> are read back and printed first.
   //
   void PrintToFile(int num_steps);
 
+  // @return paths of the files printed by <PrintToFile> and the DEM, results first
+  //
+  std::vector<std::string> GetOutputFiles(void);
+
+  // Record a change of integration method
+  // @time time of the change (in s)
+  // @tau timestep after the change (in s)
+  // @action description of the change
+  //
+  // Switches are printed to `<output_filename>.solver_switches` by <PrintToFile>.
+  //
+  void RecordSolverSwitch(double time, double tau, std::string action);
+
+  // Find the first step to print
+  //
+  // @return index of the oldest stored step
+  //
+  int GetWindowStart(void);
+
   // Save results to structure
   // @i Current timestep
   // @time Current time (in s)
@@ -121,6 +228,31 @@ public:
   //
   void SaveTerms(void);
 
+  // Memory used by stored results
+  //
+  // @return bytes allocated for results and terms
+  //
+  std::size_t GetMemory(void);
+
+  // Write completed results to disk
+  //
+  // Append every completed chunk of results and terms, except the one holding the most
+  // recent step, to scratch files in the binary output format and free them. The
+  // scratch files are read back and removed by <PrintToFile>, or by the destructor
+  // if the run fails first.
+  //
+  void SpillToDisk(void);
+
+  // Calculate derived quantities after integration
+  // @num_steps number of steps taken by the integration routine
+  //
+  // Used when <Parameters.defer_derived_quantities> is true. Only the state is stored
+  // during the integration; the heat fluxes, $c_1$, radiative loss, velocity and heating
+  // rate are filled in afterwards in a single pass over the stored results, split
+  // across all available hardware threads.
+  //
+  void CalculateDerivedQuantities(int num_steps);
+
   // Return current state publicly
   //
   // @return vector holding the current state of the loop
@@ -132,6 +264,25 @@ public:
   //
   void SetState(state_type state);
 
+  // Calculate intermediate quantities for the current state
+  // @time current time (in s)
+  //
+  // Evaluate the heat fluxes, radiative loss, $c_1$, scale height, velocity and
+  // heating rate once for the current state. These are then shared by <SaveTerms>,
+  // <SaveResults> and the <Dem> calculation rather than being recomputed by each.
+  // The velocity needs the heat fluxes and $c_1$ at the density implied by the
+  // electron pressure rather than that of the state, so only the radiative loss
+  // and scale height are shared with it. Should be called after every call to
+  // <SetState>.
+  //
+  void CalculateIntermediates(double time);
+
+  // Return intermediate quantities for the current state
+  //
+  // @return structure holding the quantities computed by <CalculateIntermediates>
+  //
+  const Intermediates & GetIntermediates(void);
+
   // Calculate $c_1$
   // @temperature_e electron temperature (in K)
   // @temperature_i ion temperature (in K)
@@ -219,6 +370,26 @@ public:
   // @return the time derivatives of the electron pressure, ion pressure, and density
   //
   static void CalculateDerivs(const state_type &state, state_type &derivs, double time);
+
+  // Calculate stiff part of the time derivatives
+  // @state current state of the loop
+  // @time current time (in s)
+  //
+  // Contribution of thermal conduction, transition region radiation and electron-ion
+  // equilibration to <CalculateDerivs>. These set the shortest timescales in the
+  // system, and conduction and transition region radiation nearly balance in the
+  // draining phase, so they are kept together.
+  //
+  static void CalculateStiffDerivs(const state_type &state, state_type &derivs, double time);
+
+  // Calculate non-stiff part of the time derivatives
+  // @state current state of the loop
+  // @time current time (in s)
+  //
+  // Contribution of heating to <CalculateDerivs>. The sum of
+  // this and <CalculateStiffDerivs> is equal to <CalculateDerivs>, up to rounding.
+  //
+  static void CalculateNonStiffDerivs(const state_type &state, state_type &derivs, double time);
 };
 // Pointer to the <Loop> class
 typedef Loop* LOOP;
@@ -4,29 +4,591 @@ A code for computing the evolution of dynamically heated, spatially-averaged sol
 */
 
 #include <time.h>
+#include <atomic>
+#include <map>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 #include "boost/program_options.hpp"
-#include "boost/numeric/odeint.hpp"
 #include "loop.h"
 #include "dem.h"
 #include "observer.h"
+#include "integrator.h"
+#include "affinity.h"
+#include "kernels.h"
+#include "reduction.h"
+#include "journal.h"
+#include "canonical.h"
+#include "lags.h"
+#include "nei.h"
+#include "container.h"
 
-int main(int argc, char *argv[])
+// Raised when a screening run fails and has to be repeated at the full tolerance
+//
+class ScreeningFailure : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Run a single simulation at a given tolerance
+// @config path to the configuration file
+// @screening if true, integrate with <Parameters.screening_error> rather than
+// <Parameters.adaptive_solver_error>, if it is set
+// @reduction ensemble statistics to add the results to once the run has finished; NULL if none
+// @lags time lags to find from the results once the run has finished; NULL if none
+// @copies number of identical ensemble members the run stands for in <reduction>
+//
+// Results are printed to the files given in the configuration file. Storage for
+// the results is taken from the chunk pool of the calling thread and returned to it
+// afterwards, so repeated calls on the same thread reuse the same memory. A
+// screening run throws <ScreeningFailure> if the integration fails or ends in a
+// non-physical state, in which case nothing is printed.
+//
+// @return paths of the files printed, results first
+//
+std::vector<std::string> Simulate(const std::string & config, bool screening, REDUCTION reduction, LAGS lags, int copies)
 {
   //Declarations
   int num_steps;
+  std::vector<std::string> output_files;
   state_type state;
-  char config[256];
   LOOP loop;
   DEM dem;
+  NEI nei = NULL;
   OBSERVER obs;
 
+  // Create loop object
+  loop = new Loop(config.c_str());
+  // Create DEM object
+  if(loop->parameters.calculate_dem)
+  {
+    dem = new Dem(loop);
+  }
+  else
+  {
+    dem = new Dem();
+  }
+  // Only screen if it loosens the tolerance
+  screening = screening && loop->parameters.screening_error > loop->parameters.adaptive_solver_error;
+  if(screening)
+  {
+    loop->parameters.adaptive_solver_error = loop->parameters.screening_error;
+  }
+  // The ensemble statistics and light curves need the velocity and heating at every step
+  if(reduction != NULL)
+  {
+    loop->parameters.defer_derived_quantities = false;
+    reduction->BeginMember();
+  }
+  if(lags != NULL)
+  {
+    loop->parameters.defer_derived_quantities = false;
+    lags->BeginMember();
+  }
+  // Follow the charge states as the loop is integrated
+  if(loop->parameters.calculate_nei && !loop->parameters.nei_post_process)
+  {
+    nei = new NonEquilibriumIonization(loop);
+  }
+  // Configure observer
+  obs = new Observer(loop,dem,reduction,lags,nei);
+
+  // Stop any DEM threads and free everything if the integration fails
+  try
+  {
+    // Set initional conditions of the loop
+    state = loop->CalculateInitialConditions();
+    // Set initial state for loop and dem
+    obs->Observe(state, 0.0);
+
+    // Integrate
+    num_steps = Integrate(loop,obs,state);
+
+    // Pressures, density and temperatures must stay positive and finite
+    if(screening)
+    {
+      for(std::size_t k=0;k<state.size();k++)
+      {
+        if(!std::isfinite(state[k]) || state[k] <= 0.0)
+        {
+          throw std::runtime_error("Non-physical state at the end of the integration.");
+        }
+      }
+    }
+
+    //Print results to file
+    if(!loop->parameters.use_adaptive_solver)
+    {
+      num_steps = std::fmin(loop->parameters.N,num_steps);
+    }
+    if(loop->parameters.defer_derived_quantities)
+    {
+      loop->CalculateDerivedQuantities(num_steps);
+    }
+    loop->PrintToFile(num_steps);
+    if(loop->parameters.calculate_dem)
+    {
+      dem->PrintToFile(num_steps);
+    }
+    // Otherwise follow the charge states through the printed results
+    if(loop->parameters.nei_post_process)
+    {
+      nei = new NonEquilibriumIonization(loop);
+      nei->AddStepsFromFile(loop->parameters.output_filename);
+    }
+    if(nei != NULL)
+    {
+      nei->Close(num_steps);
+    }
+    if(reduction != NULL)
+    {
+      reduction->CommitMember(copies);
+    }
+    if(lags != NULL)
+    {
+      lags->CommitMember(config);
+    }
+    output_files = loop->GetOutputFiles();
+  }
+  catch(std::exception &e)
+  {
+    delete obs;
+    delete nei;
+    delete dem;
+    delete loop;
+    if(screening)
+    {
+      throw ScreeningFailure(e.what());
+    }
+    throw;
+  }
+  catch(...)
+  {
+    delete obs;
+    delete nei;
+    delete dem;
+    delete loop;
+    throw;
+  }
+
+  //Cleanup
+  delete obs;
+  delete nei;
+  delete loop;
+  delete dem;
+
+  return output_files;
+}
+
+// Run a single simulation
+// @config path to the configuration file
+// @reduction ensemble statistics to add the results to; NULL if none
+// @lags time lags to find from the results; NULL if none
+// @copies number of identical ensemble members the run stands for in <reduction>
+//
+// If <Parameters.screening_error> is set, the run is first done at that
+// tolerance and only repeated at <Parameters.adaptive_solver_error> if it fails.
+//
+// @return paths of the files printed, results first
+//
+std::vector<std::string> Run(const std::string & config, REDUCTION reduction, LAGS lags, int copies=1)
+{
+  try
+  {
+    return Simulate(config,true,reduction,lags,copies);
+  }
+  catch(ScreeningFailure &e)
+  {
+    std::cout << "Screening run of " << config << " failed (" << e.what() << "); repeating at full tolerance" << std::endl;
+    return Simulate(config,false,reduction,lags,copies);
+  }
+}
+
+// Give a duplicate ensemble member the outputs of the member it duplicates
+// @output_files outputs of the member that was run, results first
+// @from output filename of the member that was run
+// @to output filename of the duplicate
+//
+// Each output is hard linked to the name the duplicate would have written it to,
+// or symbolically linked if it is on a different file system, so nothing is
+// copied. Any existing file of that name is replaced.
+//
+// @return paths of the outputs of the duplicate, results first
+//
+std::vector<std::string> LinkOutputs(std::vector<std::string> output_files, std::string from, std::string to)
+{
+  std::vector<std::string> linked_files;
+  for(std::size_t k=0;k<output_files.size();k++)
+  {
+    std::string linked = to + output_files[k].substr(from.size());
+    linked_files.push_back(linked);
+    if(linked.compare(output_files[k])==0)
+    {
+      continue;
+    }
+    std::remove(linked.c_str());
+#ifdef __linux__
+    if(link(output_files[k].c_str(),linked.c_str()) != 0)
+    {
+      char * target = realpath(output_files[k].c_str(),NULL);
+      bool linked_ok = target != NULL && symlink(target,linked.c_str()) == 0;
+      free(target);
+      if(!linked_ok)
+      {
+        throw std::runtime_error("Failed to link " + linked + " to " + output_files[k]);
+      }
+    }
+#else
+    std::ifstream f_in(output_files[k].c_str(),std::ios::binary);
+    std::ofstream f_out(linked.c_str(),std::ios::binary);
+    f_out << f_in.rdbuf();
+#endif
+  }
+  return linked_files;
+}
+
+// Run the members of an ensemble
+// @members configuration files of the members
+// @num_workers number of worker processes; 0 uses one per available CPU
+// @reduction ensemble statistics to add the results of every member to; NULL if none
+// @reduction_output file the statistics are printed to
+// @lags time lags to find for every member; NULL if none
+// @lags_output file the lag map is printed to
+// @journal_filename journal of completed members; empty if none
+// @container_filename container the outputs of every member are packed into; empty if none
+//
+// Each worker is a separate process pinned to its own CPU, so that the results
+// of the members it runs are stored on the NUMA node it runs on, and takes the
+// next member from a shared counter until none are left. Workers are spread
+// evenly across the NUMA nodes and never outnumber the CPUs allowed by the
+// affinity mask and cgroup quota of this process. A member that fails is
+// reported and does not stop the others. If statistics are requested, each
+// worker accumulates its own, which are merged once all the workers have finished.
+//
+// Members whose configurations are identical apart from their output filename,
+// as determined by <CanonicalizeConfig>, are only run once. The outputs of the
+// first of them are linked to the output filenames of the others with
+// <LinkOutputs>, and it counts once for each of them in the statistics and
+// has a row for each of them in the lag map.
+//
+// If a journal is given, every member that finishes is recorded in it, and
+// members recorded by an earlier run are skipped as long as their output files
+// are intact; see <Journal>. The statistics and lags of a skipped member are
+// found from its results file.
+//
+// If a container is given, the outputs of each member are appended to it as
+// soon as the member finishes and then removed, and duplicates are added to it
+// as references to the outputs of the member they duplicate; see
+// <ContainerWriter>. The index of the container is written once every worker
+// has finished.
+//
+// @return number of members that failed
+//
+int RunEnsemble(std::vector<std::string> members, int num_workers, REDUCTION reduction, std::string reduction_output, LAGS lags, std::string lags_output, std::string journal_filename, std::string container_filename)
+{
+  JOURNAL journal = NULL;
+  if(!journal_filename.empty())
+  {
+    journal = new Journal(journal_filename);
+  }
+  CONTAINER container = NULL;
+  if(!container_filename.empty())
+  {
+    container = new ContainerWriter(container_filename);
+  }
+
+  // Group identical members, first occurrence first
+  std::vector<CanonicalConfig> canonical(members.size());
+  std::vector<std::vector<int> > groups;
+  std::map<std::string,int> group_index;
+  for(std::size_t k=0;k<members.size();k++)
+  {
+    try
+    {
+      canonical[k] = CanonicalizeConfig(members[k]);
+    }
+    catch(std::exception &e)
+    {
+      // Run on its own, where it fails
+      groups.push_back(std::vector<int>(1,k));
+      continue;
+    }
+    std::map<std::string,int>::iterator group = group_index.find(canonical[k].text);
+    if(group == group_index.end())
+    {
+      group_index[canonical[k].text] = groups.size();
+      groups.push_back(std::vector<int>(1,k));
+    }
+    else
+    {
+      groups[group->second].push_back(k);
+    }
+  }
+  if(groups.size() < members.size())
+  {
+    std::cout << "Running " << groups.size() << " unique configurations for " << members.size() << " members" << std::endl;
+  }
+
+  std::vector<int> cpus = GetAvailableCpus();
+  if(num_workers <= 0 || num_workers > (int)cpus.size())
+  {
+    num_workers = cpus.size();
+  }
+  num_workers = std::min(num_workers,(int)groups.size());
+
+  // Counters shared between the workers
+  std::atomic<int> * counters;
+#ifdef __linux__
+  void * shared = mmap(NULL,3*sizeof(std::atomic<int>),PROT_READ | PROT_WRITE,MAP_SHARED | MAP_ANONYMOUS,-1,0);
+  if(shared == MAP_FAILED)
+  {
+    delete container;
+    delete journal;
+    throw std::runtime_error("Failed to allocate memory shared between ensemble workers.");
+  }
+  counters = static_cast<std::atomic<int> *>(shared);
+#else
+  // Members are run one at a time
+  num_workers = 1;
+  counters = new std::atomic<int>[3];
+#endif
+  std::atomic<int> & next_member = counters[0];
+  std::atomic<int> & num_failed = counters[1];
+  std::atomic<int> & num_skipped = counters[2];
+  next_member.store(0);
+  num_failed.store(0);
+  num_skipped.store(0);
+
+  std::vector<int> workers;
+  for(int w=0;w<num_workers;w++)
+  {
+#ifdef __linux__
+    // The last worker is this process
+    if(w < num_workers - 1)
+    {
+      pid_t pid = fork();
+      if(pid < 0)
+      {
+        // Stop the workers already started once their current member is done and
+        // wait for them, so that none is left running
+        next_member.store(groups.size());
+        for(std::size_t k=0;k<workers.size();k++)
+        {
+          waitpid(workers[k],NULL,0);
+          if(reduction != NULL)
+          {
+            std::remove((reduction_output + ".worker" + std::to_string(k)).c_str());
+          }
+          if(lags != NULL)
+          {
+            std::remove((lags_output + ".worker" + std::to_string(k)).c_str());
+          }
+        }
+        munmap(shared,3*sizeof(std::atomic<int>));
+        delete container;
+        delete journal;
+        throw std::runtime_error("Failed to start ensemble worker.");
+      }
+      if(pid > 0)
+      {
+        workers.push_back(pid);
+        continue;
+      }
+    }
+    if(num_workers > 1)
+    {
+      PinToCpu(cpus[w]);
+    }
+#endif
+    for(int k=next_member.fetch_add(1);k<(int)groups.size();k=next_member.fetch_add(1))
+    {
+      const std::vector<int> & group = groups[k];
+      const std::string & primary = members[group[0]];
+      // Keep going if a single member fails
+      try
+      {
+        std::vector<std::string> output_files;
+        if(journal != NULL && journal->IsComplete(primary,canonical[group[0]].hash))
+        {
+          std::vector<JournalOutput> outputs = journal->GetOutputs(primary);
+          for(std::size_t j=0;j<outputs.size();j++)
+          {
+            output_files.push_back(outputs[j].filename);
+          }
+          if(reduction != NULL)
+          {
+            reduction->AddMemberFromFile(output_files[0],group.size());
+          }
+          if(lags != NULL)
+          {
+            lags->AddMemberFromFile(primary,output_files[0]);
+          }
+          num_skipped++;
+        }
+        else
+        {
+          output_files = Run(primary,reduction,lags,group.size());
+          if(journal != NULL)
+          {
+            journal->Record(primary,canonical[group[0]].hash,output_files);
+          }
+        }
+        ContainerMember stored;
+        if(container != NULL)
+        {
+          stored = container->AddMember(primary,canonical[group[0]].hash,canonical[group[0]].output_filename,output_files);
+        }
+        // Hand the outputs to the duplicates
+        for(std::size_t j=1;j<group.size();j++)
+        {
+          const std::string & duplicate = members[group[j]];
+          if(lags != NULL)
+          {
+            lags->CopyMember(primary,duplicate);
+          }
+          if(container != NULL)
+          {
+            container->AddDuplicate(duplicate,stored);
+            continue;
+          }
+          if(journal != NULL && journal->IsComplete(duplicate,canonical[group[j]].hash))
+          {
+            num_skipped++;
+            continue;
+          }
+          std::vector<std::string> linked_files = LinkOutputs(output_files,canonical[group[0]].output_filename,canonical[group[j]].output_filename);
+          if(journal != NULL)
+          {
+            journal->Record(duplicate,canonical[group[j]].hash,linked_files);
+          }
+        }
+        // Only the container is kept
+        if(container != NULL)
+        {
+          for(std::size_t j=0;j<output_files.size();j++)
+          {
+            std::remove(output_files[j].c_str());
+          }
+        }
+      }
+      catch(std::exception &e)
+      {
+        for(std::size_t j=0;j<group.size();j++)
+        {
+          std::cerr << "Ensemble member " << members[group[j]] << " failed: " << e.what() << std::endl;
+        }
+        num_failed += group.size();
+      }
+    }
+#ifdef __linux__
+    if(w < num_workers - 1)
+    {
+      // Hand the statistics and lags of this worker to the parent
+      if(reduction != NULL || lags != NULL)
+      {
+        try
+        {
+          if(reduction != NULL)
+          {
+            reduction->WriteState(reduction_output + ".worker" + std::to_string(w));
+          }
+          if(lags != NULL)
+          {
+            lags->WriteState(lags_output + ".worker" + std::to_string(w));
+          }
+        }
+        catch(std::exception &e)
+        {
+          std::cerr << e.what() << std::endl;
+          std::cerr.flush();
+          _exit(1);
+        }
+      }
+      std::cout.flush();
+      std::cerr.flush();
+      _exit(0);
+    }
+#endif
+  }
+
+  int num_crashed = 0;
+#ifdef __linux__
+  for(std::size_t k=0;k<workers.size();k++)
+  {
+    int status;
+    waitpid(workers[k],&status,0);
+    // A worker that crashed may have left members unreported
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+      std::cerr << "Ensemble worker " << workers[k] << " exited abnormally" << std::endl;
+      num_crashed++;
+      continue;
+    }
+    if(reduction != NULL)
+    {
+      std::string scratch = reduction_output + ".worker" + std::to_string(k);
+      reduction->MergeState(scratch);
+      std::remove(scratch.c_str());
+    }
+    if(lags != NULL)
+    {
+      std::string scratch = lags_output + ".worker" + std::to_string(k);
+      lags->MergeState(scratch);
+      std::remove(scratch.c_str());
+    }
+  }
+#endif
+  if(reduction != NULL)
+  {
+    reduction->PrintToFile(reduction_output);
+  }
+  if(lags != NULL)
+  {
+    lags->PrintToFile(lags_output,members);
+  }
+  if(container != NULL)
+  {
+    container->WriteIndex();
+    delete container;
+  }
+  if(num_skipped.load() > 0)
+  {
+    std::cout << "Skipped " << num_skipped.load() << " members completed by an earlier run" << std::endl;
+  }
+  delete journal;
+  int total_failed = num_failed.load() + num_crashed;
+#ifdef __linux__
+  munmap(shared,3*sizeof(std::atomic<int>));
+#else
+  delete [] counters;
+#endif
+  return total_failed;
+}
+
+int main(int argc, char *argv[])
+{
   //Parse command line options with boost
   namespace po = boost::program_options;
   po::options_description description("\nebtel++\nA code for efficiently computing the evolution of dynamically-heated coronal loops. Based on the Enthalpy-based Thermal Evolution of Loops (EBTEL) model of Klimchuk et al. (2008) and Cargill et al. (2012). For more information, consult the documentation.\n\nOptional command line arguments");
   description.add_options()
     ("help,h","This help message")
     ("quiet,q",po::bool_switch()->default_value(false),"Suppress output.")
-    ("config,c",po::value<std::string>()->default_value("config/ebtel.example.cfg.xml"),"Configuration file for EBTEL.");
+    ("config,c",po::value<std::string>()->default_value("config/ebtel.example.cfg.xml"),"Configuration file for EBTEL.")
+    ("ensemble,e",po::value<std::string>(),"File listing the configuration files of an ensemble of runs, one per line. If given, --config is ignored.")
+    ("workers,w",po::value<int>()->default_value(1),"Number of worker processes for an ensemble, each pinned to its own CPU; 0 uses one per available CPU.")
+    ("kernel-isa",po::value<std::string>()->default_value("auto"),"Instruction set of the DEM kernels: auto, avx512, avx2, sse4.2 or generic. auto uses the widest supported by the CPU.")
+    ("report-kernel-isa",po::bool_switch()->default_value(false),"Print the instruction set of the DEM kernels chosen for this CPU to stderr.")
+    ("reduce",po::value<std::vector<std::string> >()->composing(),"Statistic of an ensemble to compute on a common time grid, as quantity:statistic,..., e.g. temperature_e:mean,variance,q0.95. May be given more than once. Requires --ensemble and --reduce-grid.")
+    ("reduce-grid",po::value<std::string>(),"Time grid of the ensemble statistics, as start:stop:step (in s).")
+    ("reduce-output",po::value<std::string>(),"File the ensemble statistics are printed to. Defaults to the ensemble file suffixed by .reduced.")
+    ("lag",po::value<std::vector<std::string> >()->composing(),"Pair of channels to find the time lag between, as first,second:min_lag:max_lag (in s), e.g. density,temperature_e:-1000:1000. May be given more than once. Requires --lag-grid.")
+    ("lag-channel",po::value<std::vector<std::string> >()->composing(),"Channel for --lag defined by a temperature response function, as name=file, where the file has two columns, temperature (in K) and response. May be given more than once.")
+    ("lag-grid",po::value<std::string>(),"Uniform time grid the light curves are interpolated onto for --lag, as start:stop:step (in s).")
+    ("lag-output",po::value<std::string>(),"File the lag map is printed to. Defaults to the ensemble file, or configuration file for a single run, suffixed by .lags.")
+    ("journal",po::value<std::string>(),"Journal of the completed members of an ensemble. Members recorded in it with intact outputs are skipped, so that an interrupted ensemble can be resumed.")
+    ("container",po::value<std::string>(),"Container file the outputs of every member of an ensemble are packed into, so that the ensemble leaves a single file. Each member's outputs are removed once they have been added. Cannot be combined with --journal.");
   po::variables_map vm;
   po::store(po::command_line_parser(argc,argv).options(description).run(), vm);
   if(vm.count("help"))
@@ -36,93 +598,86 @@ int main(int argc, char *argv[])
   }
   po::notify(vm);
 
-  //Copy parameter to char array
-  std::strcpy(config,vm["config"].as<std::string>().c_str());
-
-  // Create loop object
-  loop = new Loop(config);
-  // Create DEM object
-  if(loop->parameters.calculate_dem)
+  // Choose the DEM kernels for this CPU
+  SelectDemKernels(vm["kernel-isa"].as<std::string>());
+  if(vm["report-kernel-isa"].as<bool>())
   {
-    dem = new Dem(loop);
+    std::cerr << "Using " << GetDemKernels().isa << " DEM kernels" << std::endl;
   }
-  else
+
+  // Time lags between channels
+  LAGS lags = NULL;
+  std::string lags_output = (vm.count("ensemble") ? vm["ensemble"].as<std::string>() : vm["config"].as<std::string>()) + ".lags";
+  if(vm.count("lag"))
   {
-    dem = new Dem();
-  }
-  // Configure observer
-  obs = new Observer(loop,dem);
-
-  // Set initional conditions of the loop
-  state = loop->CalculateInitialConditions();
-  // Set initial state for loop and dem
-  obs->Observe(state, 0.0);
-
-  // Set up Runge-Kutta integrator
-  typedef boost::numeric::odeint::runge_kutta_cash_karp54< state_type > stepper_type;
-  auto controlled_stepper = boost::numeric::odeint::make_controlled(loop->parameters.adaptive_solver_error, loop->parameters.adaptive_solver_error, stepper_type());
-  
-  // Integrate
-  num_steps = 0;
-  if(loop->parameters.use_adaptive_solver)
-  {
-    // Set maximum number of allowed failures
-    int max_failures = 1000;
-    // Initialize time and timestep
-    double tau = loop->parameters.tau;
-    double t = loop->parameters.tau;
-    double old_tau,old_t;
-    // Start integration loop
-    while(t<loop->parameters.total_time)
-    {
-      int fail = 1;
-      int num_failures = 0;
-      while(fail>0)
-      {
-        // Throw error if exceeded max number of failures to avoid infinite loop
-        if(num_failures>max_failures)
-        {
-          throw std::runtime_error("Adaptive solver exceeded maximum number of allowed failures.");
-        }
-        old_tau = tau;
-        old_t = t;
-        fail = controlled_stepper.try_step(loop->CalculateDerivs,state,t,tau);
-        // Force NaNs to fail
-        if(!fail) fail = obs->CheckNan(state,t,tau,old_t,old_tau);
-        num_failures++;
-      }
-      // Enforce thermal conduction timescale limit
-      double tau_tc = 4e-10*state[2]*pow(loop->parameters.loop_length,2)*pow(std::fmax(state[3],state[4]),-2.5);
-      // Limit abrupt changes in the timestep with safety factor 
-      tau = std::fmax(std::fmin(tau,0.5*tau_tc),loop->parameters.adaptive_solver_safety*tau);
-      // Control maximum timestep
-      tau = std::fmin(tau,loop->parameters.tau_max);
-      // Save the state
-      obs->Observe(state,t);
-      num_steps += 1;
+    if(!vm.count("lag-grid"))
+    {
+      throw std::runtime_error("--lag requires --lag-grid.");
+    }
+    std::vector<std::string> channel_definitions;
+    if(vm.count("lag-channel"))
+    {
+      channel_definitions = vm["lag-channel"].as<std::vector<std::string> >();
+    }
+    lags = new LagAnalysis(channel_definitions,vm["lag"].as<std::vector<std::string> >(),vm["lag-grid"].as<std::string>());
+    if(vm.count("lag-output"))
+    {
+      lags_output = vm["lag-output"].as<std::string>();
     }
   }
-  else
+
+  // Single run
+  if(!vm.count("ensemble"))
   {
-    // Constant timestep integration
-    num_steps = boost::numeric::odeint::integrate_const( controlled_stepper, loop->CalculateDerivs, state, loop->parameters.tau, loop->parameters.total_time, loop->parameters.tau, obs->Observe);
+    std::string config = vm["config"].as<std::string>();
+    Run(config,NULL,lags);
+    if(lags != NULL)
+    {
+      lags->PrintToFile(lags_output,std::vector<std::string>(1,config));
+      delete lags;
+    }
+    return 0;
   }
 
-  //Print results to file
-  if(!loop->parameters.use_adaptive_solver)
+  // Ensemble of runs; each worker runs its members in turn, reusing the storage of the previous one
+  std::ifstream f_ensemble(vm["ensemble"].as<std::string>().c_str());
+  if(!f_ensemble.is_open())
   {
-    num_steps = std::fmin(loop->parameters.N,num_steps);
+    throw std::runtime_error("Failed to open ensemble file " + vm["ensemble"].as<std::string>());
   }
-  loop->PrintToFile(num_steps);
-  if(loop->parameters.calculate_dem)
+  std::vector<std::string> members;
+  std::string member_config;
+  while(std::getline(f_ensemble,member_config))
   {
-    dem->PrintToFile(num_steps);
+    if(!member_config.empty())
+    {
+      members.push_back(member_config);
+    }
   }
+  // Statistics across the members
+  REDUCTION reduction = NULL;
+  std::string reduction_output = vm["ensemble"].as<std::string>() + ".reduced";
+  if(vm.count("reduce"))
+  {
+    if(!vm.count("reduce-grid"))
+    {
+      throw std::runtime_error("--reduce requires --reduce-grid.");
+    }
+    reduction = new EnsembleReduction(vm["reduce"].as<std::vector<std::string> >(),vm["reduce-grid"].as<std::string>());
+    if(vm.count("reduce-output"))
+    {
+      reduction_output = vm["reduce-output"].as<std::string>();
+    }
+  }
+  std::string journal_filename = vm.count("journal") ? vm["journal"].as<std::string>() : "";
+  std::string container_filename = vm.count("container") ? vm["container"].as<std::string>() : "";
+  if(!journal_filename.empty() && !container_filename.empty())
+  {
+    throw std::runtime_error("--journal cannot be combined with --container, since the outputs the journal checks are removed.");
+  }
+  int num_failed = RunEnsemble(members,vm["workers"].as<int>(),reduction,reduction_output,lags,lags_output,journal_filename,container_filename);
+  delete reduction;
+  delete lags;
 
-  //Cleanup
-  delete obs;
-  delete loop;
-  delete dem;
-
-  return 0;
+  return num_failed > 0 ? 1 : 0;
 }
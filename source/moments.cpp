@@ -0,0 +1,158 @@
+/*
+moments.cpp
+Methods for emission measure moments of the DEM
+*/
+
+#include "moments.h"
+#include <limits>
+
+DemMoments::DemMoments(const std::vector<double> & temperature, double slope_log_min, double slope_log_max, double window, std::string filename, bool binary) : window(window)
+{
+  std::size_t num_bins = temperature.size();
+  if(num_bins < 2)
+  {
+    throw std::runtime_error("DEM moments need at least two temperature bins.");
+  }
+  if(window < 0.0)
+  {
+    throw std::runtime_error("DEM moments window must be non-negative.");
+  }
+  if(slope_log_max <= slope_log_min)
+  {
+    throw std::runtime_error("DEM moments slope range must have slope_log_max > slope_log_min.");
+  }
+  // Bins are equally spaced in log T, so each is delta_log_t wide centered on its temperature
+  double delta_log_t = log10(temperature[1]/temperature[0]);
+  log_temperature.resize(num_bins);
+  bin_width.resize(num_bins);
+  slope_first = num_bins;
+  slope_end = 0;
+  for(std::size_t j=0;j<num_bins;j++)
+  {
+    log_temperature[j] = log10(temperature[j]);
+    bin_width[j] = temperature[j]*(pow(10.0,0.5*delta_log_t) - pow(10.0,-0.5*delta_log_t));
+    if(log_temperature[j] >= slope_log_min && log_temperature[j] <= slope_log_max)
+    {
+      slope_first = std::min(slope_first,j);
+      slope_end = j + 1;
+    }
+  }
+  previous_em.resize(num_bins);
+  window_em.assign(num_bins,0.0);
+  window_start = std::numeric_limits<double>::quiet_NaN();
+
+  if(binary)
+  {
+    f_binary.Open(filename,5);
+    return;
+  }
+  f.open(filename.c_str());
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open DEM moments file " + filename);
+  }
+}
+
+void DemMoments::Accumulate(double from, double to)
+{
+  for(std::size_t j=0;j<window_em.size();j++)
+  {
+    window_em[j] += previous_em[j]*(to - from);
+  }
+}
+
+void DemMoments::PrintRow(double time, const std::vector<double> & em, double scale)
+{
+  double total = 0.0;
+  double sum_log_t = 0.0;
+  double sum_log_t2 = 0.0;
+  for(std::size_t j=0;j<em.size();j++)
+  {
+    total += em[j];
+    sum_log_t += em[j]*log_temperature[j];
+    sum_log_t2 += em[j]*log_temperature[j]*log_temperature[j];
+  }
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  double mean = total > 0.0 ? sum_log_t/total : nan;
+  double width = total > 0.0 ? sqrt(std::fmax(sum_log_t2/total - mean*mean,0.0)) : nan;
+
+  // Weighted least squares fit of log EM against log T
+  double sum_w = 0.0, sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+  for(std::size_t j=slope_first;j<slope_end;j++)
+  {
+    if(em[j] > 0.0)
+    {
+      double x = log_temperature[j];
+      double y = log10(em[j]*scale);
+      sum_w += em[j];
+      sum_x += em[j]*x;
+      sum_y += em[j]*y;
+      sum_xx += em[j]*x*x;
+      sum_xy += em[j]*x*y;
+    }
+  }
+  double denominator = sum_w*sum_xx - sum_x*sum_x;
+  double slope = denominator > 1e-12*sum_w*sum_w ? (sum_w*sum_xy - sum_x*sum_y)/denominator : nan;
+
+  double row[5] = {time,total*scale,mean,width,slope};
+  if(f_binary.IsOpen())
+  {
+    f_binary.WriteRow(row);
+    return;
+  }
+  f << std::fixed << std::setprecision(std::numeric_limits<double>::digits10) << row[0]
+  << std::setprecision(6) << std::scientific;
+  for(int k=1;k<5;k++)
+  {
+    f << "\t" << row[k];
+  }
+  f << "\n";
+}
+
+void DemMoments::AddRow(double time, const double * row_tr, const double * row_corona)
+{
+  std::vector<double> & em = previous_em;
+  if(window > 0.0 && !std::isnan(window_start))
+  {
+    // Close every window that ends before this row
+    while(time >= window_start + window)
+    {
+      double window_end = window_start + window;
+      Accumulate(std::fmax(previous_time,window_start),window_end);
+      PrintRow(window_start,window_em,1.0/window);
+      std::fill(window_em.begin(),window_em.end(),0.0);
+      window_start = window_end;
+    }
+    Accumulate(std::fmax(previous_time,window_start),time);
+  }
+  for(std::size_t j=0;j<em.size();j++)
+  {
+    em[j] = (row_tr[j] + row_corona[j])*bin_width[j];
+  }
+  if(window == 0.0)
+  {
+    PrintRow(time,em,1.0);
+  }
+  else if(std::isnan(window_start))
+  {
+    window_start = time;
+  }
+  previous_time = time;
+}
+
+void DemMoments::Close(void)
+{
+  // The last window ends at the last row
+  if(window > 0.0 && !std::isnan(window_start) && previous_time > window_start)
+  {
+    PrintRow(window_start,window_em,1.0/(previous_time - window_start));
+  }
+  if(f_binary.IsOpen())
+  {
+    f_binary.Close();
+  }
+  else
+  {
+    f.close();
+  }
+}
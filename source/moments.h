@@ -0,0 +1,88 @@
+/*
+moments.h
+Class definition for emission measure moments of the DEM
+*/
+
+#ifndef MOMENTS_H
+#define MOMENTS_H
+
+#include "helper.h"
+#include "binary.h"
+
+// DEM moments object
+//
+// Summarizes each row of the DEM, or the time average of the DEM over each
+// window of a fixed duration, by a few numbers as the rows are produced, so the
+// DEM itself need not be kept. The emission measure in a temperature bin,
+// EM_j = (DEM_tr + DEM_corona)(T_j) ΔT_j, gives the total emission measure, the
+// EM-weighted mean of log10 T and the EM-weighted standard deviation of log10 T
+// about that mean. The emission measure slope is the slope a of EM ∝ T^a, fitted
+// by weighted least squares to log10 EM_j against log10 T_j over the bins in a
+// given temperature range that have any emission, each bin weighted by its EM,
+// so that the fit follows the bins that carry the emission rather than the
+// steep tail of the distribution.
+//
+class DemMoments {
+private:
+  /* Base-10 logarithm of the bin temperatures */
+  std::vector<double> log_temperature;
+
+  /* Width of each temperature bin (in K) */
+  std::vector<double> bin_width;
+
+  /* Range of bins the slope is fitted over */
+  std::size_t slope_first;
+  std::size_t slope_end;
+
+  /* Duration (in s) of each averaging window; 0 to summarize every row */
+  double window;
+
+  /* Start of the current window (in s); NaN before the first row */
+  double window_start;
+
+  /* Time (in s) and emission measure in each bin of the previous row */
+  double previous_time;
+  std::vector<double> previous_em;
+
+  /* Emission measure in each bin integrated over time since the start of the current window */
+  std::vector<double> window_em;
+
+  /* Output streams */
+  std::ofstream f;
+  BinaryWriter f_binary;
+
+  // Add the emission measure of the previous row, held from <from> to <to>, to <window_em>
+  //
+  void Accumulate(double from, double to);
+
+  // Print the moments of an emission measure distribution
+  // @time time of the row, or start of the window (in s)
+  // @em emission measure in each bin
+  // @scale factor to multiply <em> by
+  //
+  void PrintRow(double time, const std::vector<double> & em, double scale);
+
+public:
+  // Constructor
+  // @temperature bin temperatures (in K), equally spaced in log T
+  // @slope_log_min lower limit of the slope fit in log10 T
+  // @slope_log_max upper limit of the slope fit in log10 T
+  // @window duration (in s) of each averaging window; 0 to summarize every row
+  // @filename output file
+  // @binary if true, print in the binary output format
+  //
+  DemMoments(const std::vector<double> & temperature, double slope_log_min, double slope_log_max, double window, std::string filename, bool binary);
+
+  // Add a row of the DEM
+  // @time time of the row (in s); rows must be added in order of time
+  // @row_tr TR DEM
+  // @row_corona coronal DEM
+  //
+  void AddRow(double time, const double * row_tr, const double * row_corona);
+
+  // Print the last window and close the output file
+  //
+  void Close(void);
+};
+
+#endif
@@ -0,0 +1,369 @@
+/*
+nei.cpp
+Methods for non-equilibrium ionization
+*/
+
+#include "nei.h"
+#include <limits>
+#include <sstream>
+
+/* Smallest rate (in cm^3 s^-1) used in the rate matrix */
+#define NEI_MIN_RATE 1e-30
+
+std::map<std::string, std::shared_ptr<const IonizationTables> > NonEquilibriumIonization::cache;
+
+// Eigensystem of a symmetric matrix by cyclic Jacobi rotations
+// @matrix n by n matrix, row major; overwritten
+// @n size of the matrix
+// @eigenvalues space for the n eigenvalues
+// @eigenvectors space for the n by n matrix of eigenvectors, as columns
+//
+static void SymmetricEigensystem(std::vector<double> & matrix, int n, double * eigenvalues, double * eigenvectors)
+{
+  for(int i=0;i<n;i++)
+  {
+    for(int k=0;k<n;k++)
+    {
+      eigenvectors[i*n+k] = i==k ? 1.0 : 0.0;
+    }
+  }
+  for(int sweep=0;sweep<100;sweep++)
+  {
+    double off_diagonal = 0.0, diagonal = 0.0;
+    for(int p=0;p<n;p++)
+    {
+      diagonal += matrix[p*n+p]*matrix[p*n+p];
+      for(int q=p+1;q<n;q++)
+      {
+        off_diagonal += matrix[p*n+q]*matrix[p*n+q];
+      }
+    }
+    if(off_diagonal <= 1e-32*diagonal)
+    {
+      break;
+    }
+    for(int p=0;p<n;p++)
+    {
+      for(int q=p+1;q<n;q++)
+      {
+        if(matrix[p*n+q] == 0.0)
+        {
+          continue;
+        }
+        // Rotation that zeroes the (p,q) element
+        double theta = (matrix[q*n+q] - matrix[p*n+p])/(2.0*matrix[p*n+q]);
+        double t = (theta >= 0.0 ? 1.0 : -1.0)/(fabs(theta) + sqrt(theta*theta + 1.0));
+        double c = 1.0/sqrt(t*t + 1.0);
+        double s = t*c;
+        for(int k=0;k<n;k++)
+        {
+          double a_kp = matrix[k*n+p], a_kq = matrix[k*n+q];
+          matrix[k*n+p] = c*a_kp - s*a_kq;
+          matrix[k*n+q] = s*a_kp + c*a_kq;
+        }
+        for(int k=0;k<n;k++)
+        {
+          double a_pk = matrix[p*n+k], a_qk = matrix[q*n+k];
+          matrix[p*n+k] = c*a_pk - s*a_qk;
+          matrix[q*n+k] = s*a_pk + c*a_qk;
+        }
+        for(int k=0;k<n;k++)
+        {
+          double v_kp = eigenvectors[k*n+p], v_kq = eigenvectors[k*n+q];
+          eigenvectors[k*n+p] = c*v_kp - s*v_kq;
+          eigenvectors[k*n+q] = s*v_kp + c*v_kq;
+        }
+      }
+    }
+  }
+  for(int i=0;i<n;i++)
+  {
+    eigenvalues[i] = matrix[i*n+i];
+  }
+}
+
+NonEquilibriumIonization::NonEquilibriumIonization(LOOP loop) : num_steps(0), num_printed(0)
+{
+  // Reuse the tables of an earlier run
+  std::size_t num_states = 0;
+  for(tinyxml2::XMLElement * element_node=loop->parameters.nei_options->FirstChildElement("element");element_node!=NULL;element_node=element_node->NextSiblingElement("element"))
+  {
+    std::string filename = element_node->GetText();
+    std::map<std::string, std::shared_ptr<const IonizationTables> >::iterator entry = cache.find(filename);
+    if(entry == cache.end())
+    {
+      entry = cache.insert(std::make_pair(filename,LoadTables(filename))).first;
+    }
+    tables.push_back(entry->second);
+    offsets.push_back(1 + num_states);
+    num_states += entry->second->num_states;
+  }
+  if(tables.empty())
+  {
+    throw std::runtime_error("Non-equilibrium ionization needs at least one element.");
+  }
+  row.resize(1 + num_states);
+  coefficients.resize(num_states);
+  step_eigenvalues.resize(num_states);
+  // In static mode, no state past the first N steps is printed
+  max_rows = loop->parameters.use_adaptive_solver ? -1 : loop->parameters.N;
+
+  std::string filename = loop->parameters.output_filename + ".nei";
+  if(loop->parameters.output_format.compare("binary")==0)
+  {
+    f_binary.Open(filename,row.size());
+    return;
+  }
+  f.open(filename.c_str());
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open non-equilibrium ionization file " + filename);
+  }
+}
+
+std::shared_ptr<const IonizationTables> NonEquilibriumIonization::LoadTables(std::string filename)
+{
+  std::ifstream f(filename.c_str());
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open ionization rate table " + filename);
+  }
+  std::shared_ptr<IonizationTables> tables(new IonizationTables);
+  std::vector<std::vector<double> > rates;
+  std::string line;
+  while(std::getline(f,line))
+  {
+    if(line.empty() || line[0] == '#')
+    {
+      continue;
+    }
+    std::istringstream line_stream(line);
+    std::vector<double> values;
+    double value;
+    while(line_stream >> value)
+    {
+      values.push_back(value);
+    }
+    if(values.empty())
+    {
+      continue;
+    }
+    if(values.size() < 3 || values.size() % 2 == 0 || (!rates.empty() && values.size() != rates[0].size()))
+    {
+      throw std::runtime_error("Each row of ionization rate table " + filename + " must hold the temperature and 2Z rates");
+    }
+    if(!(values[0] > 0.0) || (!tables->log_temperature.empty() && log10(values[0]) <= tables->log_temperature.back()))
+    {
+      throw std::runtime_error("Temperatures of ionization rate table " + filename + " must be positive and increasing");
+    }
+    tables->log_temperature.push_back(log10(values[0]));
+    rates.push_back(values);
+  }
+  if(rates.empty())
+  {
+    throw std::runtime_error("Ionization rate table " + filename + " is empty");
+  }
+
+  int n = (rates[0].size() + 1)/2;
+  std::size_t num_temperatures = rates.size();
+  tables->num_states = n;
+  tables->eigenvalues.resize(num_temperatures*n);
+  tables->eigenvectors.resize(num_temperatures*n*n);
+  tables->inverse.resize(num_temperatures*n*n);
+  tables->equilibrium.resize(num_temperatures*n);
+  std::vector<double> ionization(n), recombination(n), matrix(n*n), symmetric_eigenvectors(n*n), log_scale(n), log_equilibrium(n);
+  for(std::size_t t=0;t<num_temperatures;t++)
+  {
+    // Ionization out of states 0 to n-2 and recombination out of states 1 to n-1
+    for(int i=0;i<n;i++)
+    {
+      ionization[i] = i < n-1 ? std::fmax(rates[t][1+i],NEI_MIN_RATE) : 0.0;
+      recombination[i] = i > 0 ? std::fmax(rates[t][n+i-1],NEI_MIN_RATE) : 0.0;
+    }
+    // The rate matrix A is D^-1 S D, with S symmetric and D diagonal
+    std::fill(matrix.begin(),matrix.end(),0.0);
+    log_scale[0] = 0.0;
+    log_equilibrium[0] = 0.0;
+    for(int i=0;i<n;i++)
+    {
+      matrix[i*n+i] = -(ionization[i] + recombination[i]);
+      if(i < n-1)
+      {
+        matrix[i*n+i+1] = sqrt(ionization[i]*recombination[i+1]);
+        matrix[(i+1)*n+i] = matrix[i*n+i+1];
+        log_scale[i+1] = log_scale[i] + 0.5*(log(recombination[i+1]) - log(ionization[i]));
+        log_equilibrium[i+1] = log_equilibrium[i] + log(ionization[i]) - log(recombination[i+1]);
+      }
+    }
+    double center = 0.5*(*std::max_element(log_scale.begin(),log_scale.end()) + *std::min_element(log_scale.begin(),log_scale.end()));
+    double * eigenvalues = &tables->eigenvalues[t*n];
+    SymmetricEigensystem(matrix,n,eigenvalues,symmetric_eigenvectors.data());
+    // V = D^-1 Q and V^-1 = Q^T D; eigenvalues are at most zero
+    double * eigenvectors = &tables->eigenvectors[t*n*n];
+    double * inverse = &tables->inverse[t*n*n];
+    for(int i=0;i<n;i++)
+    {
+      double scale = exp(log_scale[i] - center);
+      for(int k=0;k<n;k++)
+      {
+        eigenvectors[i*n+k] = symmetric_eigenvectors[i*n+k]/scale;
+        inverse[k*n+i] = symmetric_eigenvectors[i*n+k]*scale;
+      }
+      eigenvalues[i] = std::fmin(eigenvalues[i],0.0);
+    }
+    // Equilibrium from detailed balance between neighbouring states
+    double log_max = *std::max_element(log_equilibrium.begin(),log_equilibrium.end());
+    double total = 0.0;
+    for(int i=0;i<n;i++)
+    {
+      tables->equilibrium[t*n+i] = exp(log_equilibrium[i] - log_max);
+      total += tables->equilibrium[t*n+i];
+    }
+    for(int i=0;i<n;i++)
+    {
+      tables->equilibrium[t*n+i] /= total;
+    }
+  }
+
+  return tables;
+}
+
+std::size_t NonEquilibriumIonization::FindTemperature(const IonizationTables & element, double temperature)
+{
+  const std::vector<double> & log_t = element.log_temperature;
+  double log_temperature = log10(temperature);
+  std::size_t t = std::lower_bound(log_t.begin(),log_t.end(),log_temperature) - log_t.begin();
+  if(t == log_t.size() || (t > 0 && log_temperature - log_t[t-1] < log_t[t] - log_temperature))
+  {
+    t--;
+  }
+  return t;
+}
+
+void NonEquilibriumIonization::AddStep(double time, double temperature_e, double density)
+{
+  // Start in equilibrium
+  if(num_steps == 0)
+  {
+    for(std::size_t e=0;e<tables.size();e++)
+    {
+      const IonizationTables & element = *tables[e];
+      const double * equilibrium = &element.equilibrium[FindTemperature(element,temperature_e)*element.num_states];
+      std::copy(equilibrium,equilibrium+element.num_states,row.begin()+offsets[e]);
+    }
+  }
+  else
+  {
+    PrintRow();
+    double temperature = sqrt(previous_temperature*temperature_e);
+    double exponent = 0.5*(previous_density + density)*(time - previous_time);
+    // Project the fractions of each element onto the modes of its rate matrix
+    for(std::size_t e=0;e<tables.size();e++)
+    {
+      const IonizationTables & element = *tables[e];
+      int n = element.num_states;
+      std::size_t t = FindTemperature(element,temperature);
+      const double * inverse = &element.inverse[t*n*n];
+      const double * fractions = &row[offsets[e]];
+      double * amplitudes = &coefficients[offsets[e]-1];
+      for(int k=0;k<n;k++)
+      {
+        double amplitude = 0.0;
+        for(int i=0;i<n;i++)
+        {
+          amplitude += inverse[k*n+i]*fractions[i];
+        }
+        amplitudes[k] = amplitude;
+      }
+      std::copy(&element.eigenvalues[t*n],&element.eigenvalues[t*n]+n,step_eigenvalues.begin()+offsets[e]-1);
+    }
+    // Decay of every mode of every element
+    for(std::size_t s=0;s<coefficients.size();s++)
+    {
+      coefficients[s] *= exp(step_eigenvalues[s]*exponent);
+    }
+    // Back to fractions, which must stay non-negative and sum to one
+    for(std::size_t e=0;e<tables.size();e++)
+    {
+      const IonizationTables & element = *tables[e];
+      int n = element.num_states;
+      std::size_t t = FindTemperature(element,temperature);
+      const double * eigenvectors = &element.eigenvectors[t*n*n];
+      const double * amplitudes = &coefficients[offsets[e]-1];
+      double * fractions = &row[offsets[e]];
+      double total = 0.0;
+      for(int i=0;i<n;i++)
+      {
+        double fraction = 0.0;
+        for(int k=0;k<n;k++)
+        {
+          fraction += eigenvectors[i*n+k]*amplitudes[k];
+        }
+        fractions[i] = std::fmax(fraction,0.0);
+        total += fractions[i];
+      }
+      for(int i=0;i<n;i++)
+      {
+        fractions[i] /= total;
+      }
+    }
+  }
+  row[0] = time;
+  previous_time = time;
+  previous_temperature = temperature_e;
+  previous_density = density;
+  num_steps++;
+}
+
+void NonEquilibriumIonization::AddStepsFromFile(std::string filename)
+{
+  double results_row[8];
+  ResultsReader f_results;
+  f_results.Open(filename);
+  if(f_results.GetNumColumns() != 8)
+  {
+    throw std::runtime_error("Unexpected number of columns in results file " + filename);
+  }
+  while(f_results.ReadRow(results_row))
+  {
+    AddStep(results_row[0],results_row[1],results_row[3]);
+  }
+  f_results.Close();
+}
+
+void NonEquilibriumIonization::PrintRow(void)
+{
+  if(max_rows >= 0 && num_printed >= max_rows)
+  {
+    return;
+  }
+  num_printed++;
+  if(f_binary.IsOpen())
+  {
+    f_binary.WriteRow(row.data());
+    return;
+  }
+  f << std::fixed << std::setprecision(std::numeric_limits<double>::digits10) << row[0]
+  << std::setprecision(6) << std::scientific;
+  for(std::size_t s=1;s<row.size();s++)
+  {
+    f << "\t" << row[s];
+  }
+  f << "\n";
+}
+
+void NonEquilibriumIonization::Close(long num_rows)
+{
+  if(num_steps > 0 && (num_rows < 0 || num_printed < num_rows))
+  {
+    PrintRow();
+  }
+  if(f_binary.IsOpen())
+  {
+    f_binary.Close();
+  }
+  else
+  {
+    f.close();
+  }
+}
@@ -0,0 +1,132 @@
+/*
+nei.h
+Class definition for non-equilibrium ionization
+*/
+
+#ifndef NEI_H
+#define NEI_H
+
+#include <map>
+#include <memory>
+#include "helper.h"
+#include "loop.h"
+#include "binary.h"
+
+// Ionization and recombination rates of one element, as the eigensystem of its rate matrix at each tabulated temperature
+//
+struct IonizationTables {
+  /* Number of charge states, including the neutral */
+  int num_states;
+  /* Base-10 logarithm of the tabulated temperatures (in K) */
+  std::vector<double> log_temperature;
+  /* Eigenvalues (in cm^3 s^-1) of the rate matrix, indexed [temperature][mode] */
+  std::vector<double> eigenvalues;
+  /* Eigenvectors of the rate matrix, as columns, indexed [temperature][state][mode] */
+  std::vector<double> eigenvectors;
+  /* Inverse of the matrix of eigenvectors, indexed [temperature][mode][state] */
+  std::vector<double> inverse;
+  /* Equilibrium charge state fractions, indexed [temperature][state] */
+  std::vector<double> equilibrium;
+};
+
+// Non-equilibrium ionization object
+//
+// Follows the charge state fractions f of a set of elements as the electron
+// temperature and density of the loop change, df/dt = n A(T) f, where A is the
+// tridiagonal matrix of ionization and recombination rates. The run starts in
+// ionization equilibrium. Between two steps, T is held at the tabulated
+// temperature nearest their geometric mean and n at their mean, so that the
+// fractions are propagated exactly with the eigensystem of A at that
+// temperature, f(t+Δt) = V exp(n Λ Δt) V^-1 f(t), as in Shen et al. (2015).
+// Since A is similar to a symmetric matrix, its eigensystem is computed once per
+// tabulated temperature when the tables are read; tables are shared by every run
+// in the process that uses the same files. Rates below 1e-30 cm^3 s^-1 are
+// raised to that value so that the similarity transform stays within range.
+// Each step propagates all elements together: the decay of every mode of every
+// element is applied in a single loop.
+//
+class NonEquilibriumIonization {
+private:
+  /* Rate tables of each element, shared between runs */
+  std::vector<std::shared_ptr<const IonizationTables> > tables;
+
+  /* Index of the first charge state of each element in <row> */
+  std::vector<std::size_t> offsets;
+
+  /* Time followed by the charge state fractions of every element, one element after another */
+  std::vector<double> row;
+
+  /* Amplitude and eigenvalue of each mode of every element for the step being taken */
+  std::vector<double> coefficients;
+  std::vector<double> step_eigenvalues;
+
+  /* Time (in s), electron temperature (in K) and density (in cm^-3) of the previous step */
+  double previous_time;
+  double previous_temperature;
+  double previous_density;
+
+  /* Number of steps added and of rows printed */
+  long num_steps;
+  long num_printed;
+
+  /* Most rows printed; -1 if there is no limit */
+  long max_rows;
+
+  /* Output streams */
+  std::ofstream f;
+  BinaryWriter f_binary;
+
+  /* Tables already read, keyed by file */
+  static std::map<std::string, std::shared_ptr<const IonizationTables> > cache;
+
+  // Read the rate table of an element and find its eigensystem at each temperature
+  // @filename rate table; see the constructor
+  //
+  static std::shared_ptr<const IonizationTables> LoadTables(std::string filename);
+
+  // @return index of the tabulated temperature of <element> nearest to <temperature>
+  //
+  std::size_t FindTemperature(const IonizationTables & element, double temperature);
+
+  // Print the fractions of the previous step
+  //
+  void PrintRow(void);
+
+public:
+  // Constructor
+  // @loop <Loop> object whose <Parameters.nei_options> list the rate table of
+  // each element, in the order of the output columns
+  //
+  // The fractions are printed to the output filename of <loop> suffixed by
+  // `.nei`, in its output format. Each rate table has one row per temperature,
+  // in increasing order: the temperature (in K), the ionization rate (in cm^3 s^-1) out of each charge
+  // state from the neutral up to the next-to-last, and then the recombination
+  // rate (in cm^3 s^-1) out of each charge state from the singly ionized up to
+  // the bare nucleus. An element of atomic number Z thus has 2Z + 1 columns.
+  // Lines starting with `#` are skipped.
+  //
+  NonEquilibriumIonization(LOOP loop);
+
+  // Add a step of the run
+  // @time time of the step (in s); steps must be added in order of time
+  // @temperature_e electron temperature (in K)
+  // @density electron density (in cm^-3)
+  //
+  // The fractions of a step are printed once the next step is added, or by
+  // <Close>, so that the last step of the integration can be left out.
+  //
+  void AddStep(double time, double temperature_e, double density);
+
+  // Add every step of a results file
+  // @filename results file, in either output format
+  //
+  void AddStepsFromFile(std::string filename);
+
+  // Print the remaining steps, up to <num_rows> rows in all, and close the output file
+  //
+  void Close(long num_rows);
+};
+// Pointer to the <NonEquilibriumIonization> class
+typedef NonEquilibriumIonization* NEI;
+
+#endif
@@ -7,14 +7,20 @@ Function definitions for Observer methods
 int Observer::i;
 LOOP Observer::loop;
 DEM Observer::dem;
+REDUCTION Observer::reduction;
+LAGS Observer::lags;
+NEI Observer::nei;
 
-Observer::Observer(LOOP loop_object,DEM dem_object)
+Observer::Observer(LOOP loop_object,DEM dem_object,REDUCTION reduction_object,LAGS lags_object,NEI nei_object)
 {
   // Initialize counter
   i = 0;
   // Set needed objects
   loop = loop_object;
   dem = dem_object;
+  reduction = reduction_object;
+  lags = lags_object;
+  nei = nei_object;
 }
 
 Observer::~Observer(void)
@@ -26,18 +32,52 @@ void Observer::Observe(const state_type &state, const double time)
 {
   // Store state
   loop->SetState(state);
-  // Save terms
-  if(loop->parameters.save_terms)
+  // Evaluate intermediate quantities once for this state unless they
+  // are being computed after the integration
+  if(!loop->parameters.defer_derived_quantities)
   {
-    loop->SaveTerms();
+    loop->CalculateIntermediates(time);
+    // Save terms
+    if(loop->parameters.save_terms)
+    {
+      loop->SaveTerms();
+    }
   }
   // Calculate DEM
   if(loop->parameters.calculate_dem)
   {
-    dem->CalculateDEM(i);
+    dem->CalculateDEM(i,time);
   }
   // Save results
   loop->SaveResults(i,time);
+  // Advance the charge states
+  if(nei != NULL)
+  {
+    nei->AddStep(time,state[3],state[2]);
+  }
+  // Add to the ensemble statistics and light curves
+  if(reduction != NULL || lags != NULL)
+  {
+    const Intermediates & intermediates = loop->GetIntermediates();
+    double row[8] = {time, state[3], state[4], state[2], state[0], state[1], intermediates.velocity, intermediates.heat};
+    if(reduction != NULL)
+    {
+      reduction->AddStep(row);
+    }
+    if(lags != NULL)
+    {
+      lags->AddStep(row);
+    }
+  }
+  // Write completed results to disk if over the memory budget
+  if(loop->parameters.max_memory > 0.0 && loop->GetMemory() + dem->GetMemory() >= loop->parameters.max_memory*1024*1024)
+  {
+    loop->SpillToDisk();
+    if(loop->parameters.calculate_dem)
+    {
+      dem->SpillToDisk();
+    }
+  }
   // Increment counter
   i++;
 }
@@ -45,7 +85,7 @@ void Observer::Observe(const state_type &state, const double time)
 int Observer::CheckNan(state_type &state, double &time, double &tau, double old_time, double old_tau)
 {
   // Check for NaNs in the state
-  for(int j=0; j<state.size(); j++)
+  for(std::size_t j=0; j<state.size(); j++)
   {
     if(std::isnan(state[j]))
     {
@@ -8,6 +8,9 @@ Class definition for observer class
 #include "helper.h"
 #include "loop.h"
 #include "dem.h"
+#include "reduction.h"
+#include "lags.h"
+#include "nei.h"
 
 // Observer object
 //
@@ -23,15 +26,24 @@ private:
   static LOOP loop;
   /* <Dem> object, used for calling save method */
   static DEM dem;
+  /* <EnsembleReduction> object the results are added to; NULL if there is none */
+  static REDUCTION reduction;
+  /* <LagAnalysis> object the results are added to; NULL if there is none */
+  static LAGS lags;
+  /* <NonEquilibriumIonization> object each step is added to; NULL if there is none */
+  static NEI nei;
 public:
   // Default constructor
   // @loop <Loop> instance used for saving loop results
   // @dem <Dem> instance used for saving emission measure results
+  // @reduction <EnsembleReduction> instance that each step is added to, if any
+  // @lags <LagAnalysis> instance that each step is added to, if any
+  // @nei <NonEquilibriumIonization> instance that each step is added to, if any
   //
   // Class for monitoring the integration routine. This object includes methods
   // for watching the integration and saving any needed parameters at each timestep.
   //
-  Observer(LOOP loop,DEM dem);
+  Observer(LOOP loop,DEM dem,REDUCTION reduction=NULL,LAGS lags=NULL,NEI nei=NULL);
 
   // Destructor
   ~Observer(void);
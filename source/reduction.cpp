@@ -0,0 +1,463 @@
+/*
+reduction.cpp
+Methods for statistics over the members of an ensemble
+*/
+
+#include "reduction.h"
+#include "binary.h"
+#include <limits>
+#include <sstream>
+#include "../rsp_toolkit/source/constants.h"
+
+// Results columns that can be reduced, in the order of a results row after time
+static const char * REDUCTION_COLUMNS[7] = {"temperature_e","temperature_i","density","pressure_e","pressure_i","velocity","heat"};
+
+TDigest::TDigest(double compression) : compression(compression), total_weight(0.0)
+{
+  minimum = std::numeric_limits<double>::infinity();
+  maximum = -std::numeric_limits<double>::infinity();
+}
+
+void TDigest::Add(double value, double weight)
+{
+  Centroid centroid = {value,weight};
+  buffer.push_back(centroid);
+  total_weight += weight;
+  minimum = std::fmin(minimum,value);
+  maximum = std::fmax(maximum,value);
+  if(buffer.size() >= 4*std::size_t(compression))
+  {
+    Compress();
+  }
+}
+
+void TDigest::Merge(const TDigest & other)
+{
+  buffer.insert(buffer.end(),other.centroids.begin(),other.centroids.end());
+  buffer.insert(buffer.end(),other.buffer.begin(),other.buffer.end());
+  total_weight += other.total_weight;
+  minimum = std::fmin(minimum,other.minimum);
+  maximum = std::fmax(maximum,other.maximum);
+  Compress();
+}
+
+void TDigest::Compress(void)
+{
+  if(buffer.empty())
+  {
+    return;
+  }
+  buffer.insert(buffer.end(),centroids.begin(),centroids.end());
+  std::sort(buffer.begin(),buffer.end());
+  centroids.clear();
+
+  // Merge neighbours while the centroid spans less than one unit of the scale
+  // function k(q) = compression/(2 pi) asin(2q - 1)
+  double normalizer = compression/(2.0*_PI_);
+  Centroid current = buffer[0];
+  double weight_before = 0.0;
+  double k_limit = normalizer*std::asin(-1.0) + 1.0;
+  for(std::size_t k=1;k<buffer.size();k++)
+  {
+    double q = (weight_before + current.weight + buffer[k].weight)/total_weight;
+    if(normalizer*std::asin(std::fmin(2.0*q - 1.0,1.0)) <= k_limit)
+    {
+      current.mean += (buffer[k].mean - current.mean)*buffer[k].weight/(current.weight + buffer[k].weight);
+      current.weight += buffer[k].weight;
+    }
+    else
+    {
+      centroids.push_back(current);
+      weight_before += current.weight;
+      k_limit = normalizer*std::asin(std::fmin(2.0*weight_before/total_weight - 1.0,1.0)) + 1.0;
+      current = buffer[k];
+    }
+  }
+  centroids.push_back(current);
+  buffer.clear();
+}
+
+double TDigest::Quantile(double q)
+{
+  Compress();
+  if(centroids.empty())
+  {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  if(centroids.size() == 1)
+  {
+    return centroids[0].mean;
+  }
+
+  // Interpolate between the centres of the centroids, and between the outermost
+  // centres and the extreme values
+  double target = q*total_weight;
+  double weight_before = 0.0;
+  double previous_centre = 0.0;
+  double previous_mean = minimum;
+  for(std::size_t k=0;k<centroids.size();k++)
+  {
+    double centre = weight_before + 0.5*centroids[k].weight;
+    if(target < centre)
+    {
+      double fraction = (target - previous_centre)/(centre - previous_centre);
+      return previous_mean + fraction*(centroids[k].mean - previous_mean);
+    }
+    previous_centre = centre;
+    previous_mean = centroids[k].mean;
+    weight_before += centroids[k].weight;
+  }
+  double fraction = (target - previous_centre)/(total_weight - previous_centre);
+  return previous_mean + std::fmin(fraction,1.0)*(maximum - previous_mean);
+}
+
+void TDigest::Write(std::ostream & f)
+{
+  Compress();
+  uint64_t num_centroids = centroids.size();
+  f.write(reinterpret_cast<const char *>(&total_weight),sizeof(double));
+  f.write(reinterpret_cast<const char *>(&minimum),sizeof(double));
+  f.write(reinterpret_cast<const char *>(&maximum),sizeof(double));
+  f.write(reinterpret_cast<const char *>(&num_centroids),sizeof(uint64_t));
+  for(std::size_t k=0;k<centroids.size();k++)
+  {
+    f.write(reinterpret_cast<const char *>(&centroids[k].mean),sizeof(double));
+    f.write(reinterpret_cast<const char *>(&centroids[k].weight),sizeof(double));
+  }
+}
+
+void TDigest::Read(std::istream & f)
+{
+  uint64_t num_centroids;
+  f.read(reinterpret_cast<char *>(&total_weight),sizeof(double));
+  f.read(reinterpret_cast<char *>(&minimum),sizeof(double));
+  f.read(reinterpret_cast<char *>(&maximum),sizeof(double));
+  f.read(reinterpret_cast<char *>(&num_centroids),sizeof(uint64_t));
+  centroids.resize(num_centroids);
+  buffer.clear();
+  for(std::size_t k=0;k<centroids.size();k++)
+  {
+    f.read(reinterpret_cast<char *>(&centroids[k].mean),sizeof(double));
+    f.read(reinterpret_cast<char *>(&centroids[k].weight),sizeof(double));
+  }
+}
+
+int FindResultsColumn(std::string quantity)
+{
+  for(int c=0;c<7;c++)
+  {
+    if(quantity.compare(REDUCTION_COLUMNS[c])==0)
+    {
+      return c + 1;
+    }
+  }
+  return -1;
+}
+
+GridInterpolator::GridInterpolator(void) : num_values(0)
+{
+  // Default constructor
+}
+
+GridInterpolator::GridInterpolator(std::string grid_spec, std::size_t num_values) : num_values(num_values)
+{
+  std::stringstream grid_stream(grid_spec);
+  std::string field;
+  std::vector<double> limits;
+  while(std::getline(grid_stream,field,':'))
+  {
+    limits.push_back(std::stod(field));
+  }
+  if(limits.size() != 3 || limits[2] <= 0.0 || limits[1] < limits[0])
+  {
+    throw std::runtime_error("Time grid " + grid_spec + " must be of the form start:stop:step with stop >= start and step > 0.");
+  }
+  int num_times = int(std::floor((limits[1] - limits[0])/limits[2]*(1.0 + 1e-12))) + 1;
+  for(int g=0;g<num_times;g++)
+  {
+    grid.push_back(limits[0] + g*limits[2]);
+  }
+  values.resize(grid.size()*num_values);
+  previous_values.resize(num_values);
+  Begin();
+}
+
+void GridInterpolator::Begin(void)
+{
+  first = 0;
+  end = 0;
+  previous_time = std::numeric_limits<double>::quiet_NaN();
+}
+
+void GridInterpolator::Add(double time, const double * step_values)
+{
+  std::size_t g = end;
+  if(std::isnan(previous_time))
+  {
+    // Skip grid times before the first step, and take any at the first step as they are
+    while(g < grid.size() && grid[g] < time)
+    {
+      g++;
+    }
+    first = g;
+    for(;g<grid.size() && grid[g]==time;g++)
+    {
+      std::copy(step_values,step_values+num_values,values.begin()+g*num_values);
+    }
+  }
+  else
+  {
+    // Interpolate to every grid time since the previous step
+    for(;g<grid.size() && grid[g]<=time;g++)
+    {
+      double weight = (grid[g] - previous_time)/(time - previous_time);
+      for(std::size_t v=0;v<num_values;v++)
+      {
+        values[g*num_values + v] = previous_values[v] + weight*(step_values[v] - previous_values[v]);
+      }
+    }
+  }
+  end = g;
+  previous_time = time;
+  std::copy(step_values,step_values+num_values,previous_values.begin());
+}
+
+std::size_t GridInterpolator::GetFirst(void)
+{
+  return first;
+}
+
+std::size_t GridInterpolator::GetEnd(void)
+{
+  return end;
+}
+
+const double * GridInterpolator::GetValues(std::size_t g)
+{
+  return &values[g*num_values];
+}
+
+const std::vector<double> & GridInterpolator::GetGrid(void)
+{
+  return grid;
+}
+
+EnsembleReduction::EnsembleReduction(std::vector<std::string> specifications, std::string grid_spec)
+{
+  // Parse the quantities and statistics
+  for(std::size_t k=0;k<specifications.size();k++)
+  {
+    std::size_t colon = specifications[k].find(':');
+    if(colon == std::string::npos)
+    {
+      throw std::runtime_error("Reduction " + specifications[k] + " must be of the form quantity:statistic,...");
+    }
+    ColumnReduction reduction;
+    std::string quantity = specifications[k].substr(0,colon);
+    reduction.column = FindResultsColumn(quantity);
+    if(reduction.column < 0)
+    {
+      throw std::runtime_error("Unrecognized reduction quantity " + quantity + ". Use temperature_e, temperature_i, density, pressure_e, pressure_i, velocity or heat.");
+    }
+    reduction.use_digest = false;
+    std::stringstream statistics(specifications[k].substr(colon+1));
+    std::string statistic;
+    while(std::getline(statistics,statistic,','))
+    {
+      if(!statistic.empty() && statistic[0] == 'q')
+      {
+        double fraction = std::stod(statistic.substr(1));
+        if(fraction < 0.0 || fraction > 1.0)
+        {
+          throw std::runtime_error("Quantile " + statistic + " must be between q0 and q1.");
+        }
+        reduction.use_digest = true;
+      }
+      else if(statistic.compare("mean")!=0 && statistic.compare("variance")!=0 && statistic.compare("min")!=0 && statistic.compare("max")!=0)
+      {
+        throw std::runtime_error("Unrecognized reduction statistic " + statistic + ". Use mean, variance, min, max or q<fraction>.");
+      }
+      reduction.statistics.push_back(statistic);
+    }
+    if(reduction.statistics.empty())
+    {
+      throw std::runtime_error("Reduction " + specifications[k] + " has no statistics.");
+    }
+    reductions.push_back(reduction);
+  }
+
+  interpolator = GridInterpolator(grid_spec,reductions.size());
+  step_values.resize(reductions.size());
+  const std::vector<double> & grid = interpolator.GetGrid();
+
+  Accumulator empty = {0.0,0.0,0.0,std::numeric_limits<double>::infinity(),-std::numeric_limits<double>::infinity()};
+  accumulators.assign(grid.size()*reductions.size(),empty);
+  digests.assign(grid.size()*reductions.size(),TDigest());
+  BeginMember();
+}
+
+void EnsembleReduction::BeginMember(void)
+{
+  interpolator.Begin();
+}
+
+void EnsembleReduction::AddStep(const double * row)
+{
+  for(std::size_t r=0;r<reductions.size();r++)
+  {
+    step_values[r] = row[reductions[r].column];
+  }
+  interpolator.Add(row[0],step_values.data());
+}
+
+void EnsembleReduction::CommitMember(int copies)
+{
+  std::size_t num_reductions = reductions.size();
+  for(std::size_t g=interpolator.GetFirst();g<interpolator.GetEnd();g++)
+  {
+    const double * member_values = interpolator.GetValues(g);
+    for(std::size_t r=0;r<num_reductions;r++)
+    {
+      std::size_t index = g*num_reductions + r;
+      double value = member_values[r];
+      // Welford's update of the mean and sum of squared deviations
+      Accumulator & acc = accumulators[index];
+      acc.count += copies;
+      double delta = value - acc.mean;
+      acc.mean += copies*delta/acc.count;
+      acc.sum_squares += copies*delta*(value - acc.mean);
+      acc.minimum = std::fmin(acc.minimum,value);
+      acc.maximum = std::fmax(acc.maximum,value);
+      if(reductions[r].use_digest)
+      {
+        // Kept as separate values, so that quantiles are exact for small ensembles
+        for(int c=0;c<copies;c++)
+        {
+          digests[index].Add(value);
+        }
+      }
+    }
+  }
+  BeginMember();
+}
+
+void EnsembleReduction::AddMemberFromFile(std::string filename, int copies)
+{
+  double row[8];
+  ResultsReader f;
+  f.Open(filename);
+  if(f.GetNumColumns() != 8)
+  {
+    throw std::runtime_error("Unexpected number of columns in results file " + filename);
+  }
+  BeginMember();
+  while(f.ReadRow(row))
+  {
+    AddStep(row);
+  }
+  f.Close();
+  CommitMember(copies);
+}
+
+void EnsembleReduction::WriteState(std::string filename)
+{
+  std::ofstream f(filename.c_str(),std::ios::out | std::ios::binary | std::ios::trunc);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open reduction scratch file " + filename);
+  }
+  f.write(reinterpret_cast<const char *>(&accumulators[0]),accumulators.size()*sizeof(Accumulator));
+  for(std::size_t index=0;index<digests.size();index++)
+  {
+    if(reductions[index%reductions.size()].use_digest)
+    {
+      digests[index].Write(f);
+    }
+  }
+  f.close();
+}
+
+void EnsembleReduction::MergeState(std::string filename)
+{
+  std::ifstream f(filename.c_str(),std::ios::in | std::ios::binary);
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open reduction scratch file " + filename);
+  }
+  std::vector<Accumulator> other(accumulators.size());
+  f.read(reinterpret_cast<char *>(&other[0]),other.size()*sizeof(Accumulator));
+  for(std::size_t index=0;index<accumulators.size();index++)
+  {
+    // Combine the means and sums of squares of the two sets of members (Chan et al. 1979)
+    Accumulator & acc = accumulators[index];
+    if(other[index].count > 0.0)
+    {
+      double count = acc.count + other[index].count;
+      double delta = other[index].mean - acc.mean;
+      acc.mean += delta*other[index].count/count;
+      acc.sum_squares += other[index].sum_squares + delta*delta*acc.count*other[index].count/count;
+      acc.count = count;
+      acc.minimum = std::fmin(acc.minimum,other[index].minimum);
+      acc.maximum = std::fmax(acc.maximum,other[index].maximum);
+    }
+    if(reductions[index%reductions.size()].use_digest)
+    {
+      TDigest digest;
+      digest.Read(f);
+      digests[index].Merge(digest);
+    }
+  }
+  if(!f)
+  {
+    throw std::runtime_error("Reduction scratch file " + filename + " is incomplete");
+  }
+  f.close();
+}
+
+void EnsembleReduction::PrintToFile(std::string filename)
+{
+  std::ofstream f(filename.c_str());
+  if(!f.is_open())
+  {
+    throw std::runtime_error("Failed to open reduction output file " + filename);
+  }
+  std::size_t num_reductions = reductions.size();
+  const std::vector<double> & grid = interpolator.GetGrid();
+  f << std::setprecision(6) << std::scientific;
+  for(std::size_t g=0;g<grid.size();g++)
+  {
+    f << grid[g] << "\t" << (num_reductions > 0 ? int(accumulators[g*num_reductions].count) : 0);
+    for(std::size_t r=0;r<num_reductions;r++)
+    {
+      Accumulator & acc = accumulators[g*num_reductions + r];
+      for(std::size_t s=0;s<reductions[r].statistics.size();s++)
+      {
+        const std::string & statistic = reductions[r].statistics[s];
+        double value = std::numeric_limits<double>::quiet_NaN();
+        if(statistic.compare("mean")==0 && acc.count > 0.0)
+        {
+          value = acc.mean;
+        }
+        else if(statistic.compare("variance")==0 && acc.count > 1.0)
+        {
+          value = acc.sum_squares/(acc.count - 1.0);
+        }
+        else if(statistic.compare("min")==0 && acc.count > 0.0)
+        {
+          value = acc.minimum;
+        }
+        else if(statistic.compare("max")==0 && acc.count > 0.0)
+        {
+          value = acc.maximum;
+        }
+        else if(statistic[0] == 'q')
+        {
+          value = digests[g*num_reductions + r].Quantile(std::stod(statistic.substr(1)));
+        }
+        f << "\t" << value;
+      }
+    }
+    f << "\n";
+  }
+  f.close();
+}
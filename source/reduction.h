@@ -0,0 +1,259 @@
+/*
+reduction.h
+Class definitions for statistics over the members of an ensemble
+*/
+
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include "helper.h"
+
+// Streaming quantile estimate
+//
+// Merging t-digest of Dunning & Ertl (2019). Values are summarized by a sorted
+// list of weighted centroids, which are small near the extremes and large near
+// the median, so that tail quantiles stay accurate while the memory needed is
+// bounded by the compression, whatever the number of values added. Two digests
+// can be merged, e.g. when they were filled by different workers.
+//
+class TDigest {
+private:
+  // Group of nearby values
+  //
+  struct Centroid {
+    double mean;
+    double weight;
+    bool operator<(const Centroid & other) const
+    {
+      return mean < other.mean;
+    }
+  };
+
+  /* Larger values give more accurate quantiles and use more memory */
+  double compression;
+
+  /* Merged centroids, sorted by mean */
+  std::vector<Centroid> centroids;
+
+  /* Values added since the last merge */
+  std::vector<Centroid> buffer;
+
+  /* Total weight of all values added */
+  double total_weight;
+
+  /* Smallest and largest values added */
+  double minimum;
+  double maximum;
+
+  // Merge <buffer> into <centroids>
+  //
+  void Compress(void);
+
+public:
+  // Constructor
+  // @compression accuracy parameter; about this many centroids are kept
+  //
+  TDigest(double compression=200.0);
+
+  // Add a value
+  // @value value to add
+  // @weight weight of the value
+  //
+  void Add(double value, double weight=1.0);
+
+  // Add all values added to another digest
+  // @other digest to merge into this one
+  //
+  void Merge(const TDigest & other);
+
+  // Estimate a quantile
+  // @q fraction between 0 and 1
+  //
+  // @return value below which a fraction <q> of the values lie; NaN if no values were added
+  //
+  double Quantile(double q);
+
+  // Write the digest to a binary stream
+  //
+  void Write(std::ostream & f);
+
+  // Read a digest written by <Write>
+  //
+  void Read(std::istream & f);
+};
+
+// Find a column of the results
+// @quantity `temperature_e`, `temperature_i`, `density`, `pressure_e`, `pressure_i`, `velocity` or `heat`
+//
+// @return index of <quantity> in a results row; -1 if it is not recognized
+//
+int FindResultsColumn(std::string quantity);
+
+// Grid interpolator object
+//
+// Interpolates values given at each step of a run linearly onto a fixed time
+// grid as the run proceeds. Grid times before the first step or after the last
+// step are not filled.
+//
+class GridInterpolator {
+private:
+  /* Grid times (in s) */
+  std::vector<double> grid;
+
+  /* Number of values at each step */
+  std::size_t num_values;
+
+  /* Values interpolated to the grid, grid time first */
+  std::vector<double> values;
+
+  /* Range of grid times filled so far */
+  std::size_t first;
+  std::size_t end;
+
+  /* Time and values at the previous step; the time is NaN before the first step */
+  double previous_time;
+  std::vector<double> previous_values;
+
+public:
+  /* Default constructor */
+  GridInterpolator(void);
+
+  // Constructor
+  // @grid_spec string of the form `start:stop:step` giving the grid times (in s)
+  // @num_values number of values at each step
+  //
+  GridInterpolator(std::string grid_spec, std::size_t num_values);
+
+  // Start a new run, discarding the values of the previous one
+  //
+  void Begin(void);
+
+  // Add a step
+  // @time time of the step (in s); steps must be added in order of time
+  // @step_values <num_values> values at the step
+  //
+  void Add(double time, const double * step_values);
+
+  // @return index of the first grid time filled
+  //
+  std::size_t GetFirst(void);
+
+  // @return one past the index of the last grid time filled
+  //
+  std::size_t GetEnd(void);
+
+  // @return <num_values> values at grid time <g>
+  //
+  const double * GetValues(std::size_t g);
+
+  // @return grid times (in s)
+  //
+  const std::vector<double> & GetGrid(void);
+};
+
+// Ensemble reduction object
+//
+// Accumulates statistics of the results of every member of an ensemble on a
+// common time grid, so that the population can be summarized without keeping
+// the results of every member. Each member is interpolated linearly onto the
+// grid as it is integrated. Its values are only added to the statistics once the
+// member has finished, so that a member that fails does not contribute. Grid
+// times outside the time range of a member are left out for that member.
+//
+// Each reduced quantity is given by a specification `quantity:statistic,...`,
+// where the quantity is one of the columns of the results, `temperature_e`,
+// `temperature_i`, `density`, `pressure_e`, `pressure_i`, `velocity` or `heat`,
+// and the statistics are any of `mean`, `variance` (unbiased), `min`, `max`
+// and `q<fraction>`, e.g. `q0.95`. Quantiles are estimated with a <TDigest>.
+//
+class EnsembleReduction {
+private:
+  // Reduction of a single results column
+  //
+  struct ColumnReduction {
+    /* Index of the column in a results row */
+    int column;
+    /* Names of the statistics to print */
+    std::vector<std::string> statistics;
+    /* True if any quantiles are requested */
+    bool use_digest;
+  };
+
+  // Statistics of one column at one grid time
+  //
+  struct Accumulator {
+    double count;
+    double mean;
+    double sum_squares;
+    double minimum;
+    double maximum;
+  };
+
+  /* Reduced columns */
+  std::vector<ColumnReduction> reductions;
+
+  /* Values of the current member interpolated to the grid, one per reduced column */
+  GridInterpolator interpolator;
+
+  /* Values of the reduced columns at the current step */
+  std::vector<double> step_values;
+
+  /* Accumulators, one per grid time and reduced column, grid time first */
+  std::vector<Accumulator> accumulators;
+
+  /* Quantile digests, in the same order as <accumulators>; only filled for columns with quantiles */
+  std::vector<TDigest> digests;
+
+public:
+  // Constructor
+  // @specifications one `quantity:statistic,...` specification per reduced quantity
+  // @grid string of the form `start:stop:step` giving the grid times (in s)
+  //
+  EnsembleReduction(std::vector<std::string> specifications, std::string grid);
+
+  // Start accumulating a new member, discarding any uncommitted values
+  //
+  void BeginMember(void);
+
+  // Add a step of the current member
+  // @row results row at this step, in the same order as the columns of the results file
+  //
+  // Steps must be added in order of time.
+  //
+  void AddStep(const double * row);
+
+  // Add the values of the current member to the statistics
+  // @copies number of identical members the current member stands for
+  //
+  void CommitMember(int copies=1);
+
+  // Add a member from its results file
+  // @filename results file of the member, in either output format
+  // @copies number of identical members it stands for
+  //
+  // Used for members whose results were printed by an earlier run. Only the
+  // steps printed to the file are added, at the precision they were printed with.
+  //
+  void AddMemberFromFile(std::string filename, int copies=1);
+
+  // Write the accumulated statistics to a binary scratch file
+  //
+  void WriteState(std::string filename);
+
+  // Add the statistics from a scratch file written by <WriteState>
+  //
+  void MergeState(std::string filename);
+
+  // Print the statistics
+  // @filename output file
+  //
+  // There is one row per grid time. The columns are the time, the number of
+  // members that cover it, and then each requested statistic, in the order they
+  // were specified.
+  //
+  void PrintToFile(std::string filename);
+};
+// Pointer to the <EnsembleReduction> class
+typedef EnsembleReduction* REDUCTION;
+
+#endif
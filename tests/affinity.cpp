@@ -0,0 +1,50 @@
+/*
+affinity.cpp
+Expose the functions placing ensemble workers on CPUs to the tests:
+
+  affinity quota <root>  print the CPU quota found under the directory <root>
+  affinity cpus          print the CPUs available to workers
+  affinity pin <cpu>     pin to <cpu> and print the CPUs then allowed
+*/
+
+#include <sched.h>
+#include "../source/affinity.h"
+
+int main(int argc, char *argv[])
+{
+  std::string command = argc > 1 ? argv[1] : "";
+  if(command.compare("quota") == 0)
+  {
+    std::cout << GetCpuQuota(argc > 2 ? argv[2] : "") << std::endl;
+    return 0;
+  }
+  std::vector<int> cpus;
+  if(command.compare("cpus") == 0)
+  {
+    cpus = GetAvailableCpus();
+  }
+  else if(command.compare("pin") == 0 && argc > 2)
+  {
+    PinToCpu(std::stoi(argv[2]));
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0,sizeof(allowed),&allowed);
+    for(int cpu=0;cpu<CPU_SETSIZE;cpu++)
+    {
+      if(CPU_ISSET(cpu,&allowed))
+      {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  else
+  {
+    std::cerr << "Usage: affinity quota <root> | cpus | pin <cpu>" << std::endl;
+    return 2;
+  }
+  for(std::size_t k=0;k<cpus.size();k++)
+  {
+    std::cout << cpus[k] << (k+1 < cpus.size() ? " " : "\n");
+  }
+  return 0;
+}
@@ -10,13 +10,51 @@ import hissw
 
 TOPDIR = os.path.dirname(os.path.dirname(os.path.realpath(__file__)))
 sys.path.append(os.path.join(TOPDIR, 'examples'))
-from util import run_ebtel
+from util import run_ebtel, read_binary, write_xml
 
 
 def run_ebtelplusplus(config):
     return run_ebtel(config, TOPDIR)
 
 
+def write_config(config, directory, name):
+    """
+    Write a configuration to `directory/name.xml`, with its output to `directory/name`,
+    and return the path to the configuration file
+    """
+    config = config.copy()
+    config['output_filename'] = os.path.join(directory, name)
+    config_filename = os.path.join(directory, f'{name}.xml')
+    write_xml(config, config_filename)
+    return config_filename
+
+
+def write_ensemble(configs, directory, name='members'):
+    """
+    Write each configuration to `directory/member_<i>.xml` and list them in
+    `directory/name.txt`, and return the path to the list
+    """
+    ensemble_filename = os.path.join(directory, f'{name}.txt')
+    with open(ensemble_filename, 'w') as f:
+        for i, config in enumerate(configs):
+            f.write(write_config(config, directory, f'member_{i}') + '\n')
+    return ensemble_filename
+
+
+def run_executable(name, *args):
+    """
+    Run one of the executables in `bin/` with the given arguments and return the
+    completed process, with its output decoded
+    """
+    return subprocess.run(
+        [os.path.join(TOPDIR, 'bin', name)] + [str(a) for a in args],
+        shell=False,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        universal_newlines=True,
+    )
+
+
 def generate_idl_test_data(ebtel_idl_path, config):
     flags = []
     if 'dem' not in config or not config['dem']['use_new_method']:
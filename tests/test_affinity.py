@@ -0,0 +1,142 @@
+"""
+Test finding the CPUs available to ensemble workers, including the CPU quota of
+the cgroups of a process on cgroup files laid out in a temporary directory, and
+pinning workers to them
+"""
+import os
+import shlex
+import subprocess
+
+import pytest
+
+from .helpers import TOPDIR
+
+
+@pytest.fixture(scope='module')
+def affinity(tmp_path_factory):
+    """
+    Build a program exposing the affinity functions and return a function running it
+    """
+    executable = str(tmp_path_factory.mktemp('affinity') / 'affinity')
+    compiler = os.environ.get('CXX', 'g++')
+    flags = shlex.split(os.environ.get('CXXFLAGS', ''))
+    try:
+        build = subprocess.run(
+            [compiler, '-std=c++11'] + flags + [
+                os.path.join(TOPDIR, 'tests', 'affinity.cpp'),
+                os.path.join(TOPDIR, 'source', 'affinity.cpp'),
+                '-o', executable],
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    except FileNotFoundError:
+        pytest.skip(f'No C++ compiler {compiler}')
+    assert build.returncode == 0, build.stderr
+
+    def run(*args, allowed=None):
+        preexec_fn = None if allowed is None else lambda: os.sched_setaffinity(0, allowed)
+        cmd = subprocess.run([executable] + [str(a) for a in args], stdout=subprocess.PIPE,
+                             stderr=subprocess.PIPE, universal_newlines=True,
+                             preexec_fn=preexec_fn)
+        assert cmd.returncode == 0
+        assert not cmd.stderr
+        return [int(x) for x in cmd.stdout.split()]
+    return run
+
+
+@pytest.fixture
+def cpu_quota(affinity):
+    return lambda root: affinity('quota', root)[0]
+
+
+def write_file(root, path, text):
+    filename = os.path.join(root, path)
+    os.makedirs(os.path.dirname(filename), exist_ok=True)
+    with open(filename, 'w') as f:
+        f.write(text)
+
+
+def test_no_cgroups(cpu_quota, tmp_path):
+    assert cpu_quota(tmp_path) == 0
+
+
+def test_v2_root_without_proc(cpu_quota, tmp_path):
+    write_file(tmp_path, 'sys/fs/cgroup/cpu.max', '250000 100000\n')
+    assert cpu_quota(tmp_path) == 3
+
+
+def test_v2_no_quota(cpu_quota, tmp_path):
+    write_file(tmp_path, 'proc/self/cgroup', '0::/\n')
+    write_file(tmp_path, 'sys/fs/cgroup/cpu.max', 'max 100000\n')
+    assert cpu_quota(tmp_path) == 0
+
+
+def test_v2_nested(cpu_quota, tmp_path):
+    # Quota on the job, as set by a batch system, but none at the mount root
+    write_file(tmp_path, 'proc/self/cgroup', '0::/system.slice/job_42/step_0\n')
+    write_file(tmp_path, 'sys/fs/cgroup/cpu.max', 'max 100000\n')
+    write_file(tmp_path, 'sys/fs/cgroup/system.slice/job_42/cpu.max', '400000 100000\n')
+    write_file(tmp_path, 'sys/fs/cgroup/system.slice/job_42/step_0/cpu.max', 'max 100000\n')
+    assert cpu_quota(tmp_path) == 4
+
+
+def test_v2_tightest_of_parents(cpu_quota, tmp_path):
+    write_file(tmp_path, 'proc/self/cgroup', '0::/a/b\n')
+    write_file(tmp_path, 'sys/fs/cgroup/a/cpu.max', '150000 100000\n')
+    write_file(tmp_path, 'sys/fs/cgroup/a/b/cpu.max', '600000 100000\n')
+    assert cpu_quota(tmp_path) == 2
+
+
+def test_v2_fraction_of_cpu(cpu_quota, tmp_path):
+    write_file(tmp_path, 'proc/self/cgroup', '0::/a\n')
+    write_file(tmp_path, 'sys/fs/cgroup/a/cpu.max', '20000 100000\n')
+    assert cpu_quota(tmp_path) == 1
+
+
+def test_v1_nested(cpu_quota, tmp_path):
+    write_file(tmp_path, 'proc/self/cgroup',
+               '4:memory:/slurm/uid_1000/job_7\n'
+               '3:cpu,cpuacct:/slurm/uid_1000/job_7\n'
+               '1:name=systemd:/user.slice\n')
+    controller = 'sys/fs/cgroup/cpu,cpuacct'
+    write_file(tmp_path, f'{controller}/cpu.cfs_quota_us', '-1\n')
+    write_file(tmp_path, f'{controller}/cpu.cfs_period_us', '100000\n')
+    write_file(tmp_path, f'{controller}/slurm/uid_1000/job_7/cpu.cfs_quota_us', '200000\n')
+    write_file(tmp_path, f'{controller}/slurm/uid_1000/job_7/cpu.cfs_period_us', '100000\n')
+    # Quotas of other controllers are ignored
+    write_file(tmp_path, 'sys/fs/cgroup/memory/slurm/uid_1000/job_7/cpu.cfs_quota_us', '100000\n')
+    write_file(tmp_path, 'sys/fs/cgroup/memory/slurm/uid_1000/job_7/cpu.cfs_period_us', '100000\n')
+    assert cpu_quota(tmp_path) == 2
+
+
+def test_v1_cpu_mount(cpu_quota, tmp_path):
+    write_file(tmp_path, 'proc/self/cgroup', '2:cpuacct,cpu:/docker/abc\n')
+    write_file(tmp_path, 'sys/fs/cgroup/cpu/docker/cpu.cfs_quota_us', '300000\n')
+    write_file(tmp_path, 'sys/fs/cgroup/cpu/docker/cpu.cfs_period_us', '50000\n')
+    assert cpu_quota(tmp_path) == 6
+
+
+def test_malformed_files(cpu_quota, tmp_path):
+    write_file(tmp_path, 'proc/self/cgroup', 'garbage\n0::relative\n0::/a\n')
+    write_file(tmp_path, 'sys/fs/cgroup/a/cpu.max', 'lots 100000\n')
+    write_file(tmp_path, 'sys/fs/cgroup/cpu.max', '100000\n')
+    assert cpu_quota(tmp_path) == 0
+
+
+def test_available_cpus(affinity):
+    allowed = os.sched_getaffinity(0)
+    quota = affinity('quota', '')[0]
+    cpus = affinity('cpus')
+    assert len(cpus) == len(set(cpus))
+    assert set(cpus) <= allowed
+    assert len(cpus) == (min(quota, len(allowed)) if quota > 0 else len(allowed))
+
+
+def test_available_cpus_follow_affinity(affinity):
+    cpu = max(os.sched_getaffinity(0))
+    assert affinity('cpus', allowed={cpu}) == [cpu]
+
+
+def test_pin(affinity):
+    for cpu in sorted(os.sched_getaffinity(0))[:4]:
+        assert affinity('pin', cpu) == [cpu]
+    # A CPU that cannot be determined leaves the affinity unchanged
+    assert set(affinity('pin', -1)) == os.sched_getaffinity(0)
@@ -0,0 +1,79 @@
+"""
+Test that storing the results in chunks does not change them across chunk boundaries
+"""
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import run_ebtelplusplus
+
+# Rows in each chunk of the result arenas
+ROWS_PER_CHUNK = 4096
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 0.5,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': False,
+        'use_adaptive_solver': False,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def results(base_config):
+    return run_ebtelplusplus(base_config.copy())
+
+
+def test_rows_span_several_chunks(base_config, results):
+    # The run stops before the last step reaches total_time
+    num_rows = int(np.round(base_config['total_time'] / base_config['tau'])) - 1
+    assert results['time'].shape == (num_rows,)
+    assert num_rows > 2 * ROWS_PER_CHUNK
+    assert np.allclose(results['time'], base_config['tau'] * np.arange(num_rows), atol=1e-6, rtol=0.)
+    assert results['dem_tr'].shape[0] == num_rows
+    assert results['dem_corona'].shape[0] == num_rows
+
+
+@pytest.mark.parametrize('num_rows', [ROWS_PER_CHUNK - 1, ROWS_PER_CHUNK, ROWS_PER_CHUNK + 1])
+def test_shorter_run_is_prefix(base_config, results, num_rows):
+    # A run that ends at, just before, or just after a chunk boundary has the same
+    # rows as the start of a longer run
+    config = base_config.copy()
+    config['total_time'] = (num_rows + 1) * config['tau']
+    r_short = run_ebtelplusplus(config)
+    assert r_short['time'].shape == (num_rows,)
+    for k in r_short:
+        if k == 'dem_temperature':
+            assert np.array_equal(r_short[k], results[k])
+        else:
+            assert np.array_equal(r_short[k], results[k][:num_rows])
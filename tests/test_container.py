@@ -0,0 +1,126 @@
+"""
+Test that the outputs of an ensemble packed into a container are read back unchanged
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_executable, write_config, write_ensemble
+
+MAGNITUDES = [0.05, 0.1, 0.2, 0.1]
+SUFFIXES = ['', '.terms', '.dem_tr', '.dem_corona']
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': True,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+def with_magnitude(config, magnitude):
+    config = config.copy()
+    config['heating'] = config['heating'].copy()
+    event = config['heating']['events'][0]['event'].copy()
+    event['magnitude'] = magnitude
+    config['heating']['events'] = [{'event': event}]
+    return config
+
+
+@pytest.fixture
+def members(base_config):
+    return [with_magnitude(base_config, m) for m in MAGNITUDES]
+
+
+@pytest.fixture
+def reference(members, tmp_path):
+    """
+    Outputs of each member run without a container
+    """
+    directory = os.path.join(tmp_path, 'reference')
+    os.mkdir(directory)
+    cmd = run_executable('ebtel++.run', '--ensemble', write_ensemble(members, directory))
+    assert not cmd.stderr
+    return {(i, suffix): read_binary(os.path.join(directory, f'member_{i}{suffix}'))
+            for i in range(len(members)) for suffix in SUFFIXES}
+
+
+def extract(container_filename, member, suffix, npy_filename):
+    cmd = run_executable('ebtel-slice.run', '--member', member, '--suffix', suffix,
+                         '--format', 'npy', '--output', npy_filename, container_filename)
+    assert not cmd.stderr
+    return np.load(npy_filename)
+
+
+def test_container_round_trip(members, reference, tmp_path):
+    ensemble_filename = write_ensemble(members, tmp_path)
+    container_filename = os.path.join(tmp_path, 'members.ebc')
+    cmd = run_executable('ebtel++.run', '--ensemble', ensemble_filename, '--container', container_filename)
+    assert not cmd.stderr
+    # Only the container is left
+    for i in range(len(members)):
+        for suffix in SUFFIXES:
+            assert not os.path.exists(os.path.join(tmp_path, f'member_{i}{suffix}'))
+    listing = run_executable('ebtel-slice.run', '--list', container_filename)
+    assert sorted([line.split('\t')[0] for line in listing.stdout.splitlines()]) == \
+        sorted([os.path.join(tmp_path, f'member_{i}.xml') for i in range(len(members))])
+    npy_filename = os.path.join(tmp_path, 'slice.npy')
+    for i in range(len(members)):
+        for suffix in SUFFIXES:
+            data = extract(container_filename, os.path.join(tmp_path, f'member_{i}.xml'), suffix,
+                           npy_filename)
+            assert np.array_equal(data, reference[(i, suffix)])
+
+
+def test_container_append(members, reference, tmp_path):
+    container_filename = os.path.join(tmp_path, 'members.ebc')
+    cmd = run_executable('ebtel++.run', '--ensemble', write_ensemble(members[:2], tmp_path),
+                         '--container', container_filename)
+    assert not cmd.stderr
+    # Run the first member again, with the configuration of the third; the member added
+    # last takes precedence
+    config_filename = write_config(members[2], tmp_path, 'member_0')
+    ensemble_filename = os.path.join(tmp_path, 'rerun.txt')
+    with open(ensemble_filename, 'w') as f:
+        f.write(config_filename + '\n')
+    cmd = run_executable('ebtel++.run', '--ensemble', ensemble_filename, '--container', container_filename)
+    assert not cmd.stderr
+    npy_filename = os.path.join(tmp_path, 'slice.npy')
+    for suffix in SUFFIXES:
+        data = extract(container_filename, config_filename, suffix, npy_filename)
+        assert np.array_equal(data, reference[(2, suffix)])
+        data = extract(container_filename, os.path.join(tmp_path, 'member_1.xml'), suffix, npy_filename)
+        assert np.array_equal(data, reference[(1, suffix)])
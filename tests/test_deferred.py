@@ -0,0 +1,73 @@
+"""
+Test that deferring the derived quantities does not change the results
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import run_ebtelplusplus, run_executable, write_config
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': False,
+        'save_terms': True,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+    }
+    return base_config
+
+
+@pytest.mark.parametrize('use_adaptive_solver', [True, False])
+def test_deferred_equal_inline(base_config, use_adaptive_solver):
+    config = base_config.copy()
+    config['use_adaptive_solver'] = use_adaptive_solver
+    config['defer_derived_quantities'] = False
+    r_inline = run_ebtelplusplus(config)
+    config['defer_derived_quantities'] = True
+    r_deferred = run_ebtelplusplus(config)
+    for k in r_inline:
+        assert np.allclose(r_inline[k], r_deferred[k], atol=0., rtol=1e-12)
+
+
+@pytest.mark.parametrize('save_terms', [True, False])
+def test_deferred_terms_equal_inline(base_config, tmp_path, save_terms):
+    config = base_config.copy()
+    config['save_terms'] = save_terms
+    outputs = {}
+    for defer in [False, True]:
+        config['defer_derived_quantities'] = defer
+        name = f'deferred_{defer}'
+        cmd = run_executable('ebtel++.run', '-q', '-c', write_config(config, tmp_path, name))
+        assert cmd.returncode == 0
+        assert not cmd.stderr
+        assert os.path.isfile(os.path.join(tmp_path, f'{name}.terms')) == save_terms
+        outputs[defer] = np.loadtxt(os.path.join(tmp_path, name))
+        if save_terms:
+            outputs[defer] = np.hstack([outputs[defer], np.loadtxt(os.path.join(tmp_path, f'{name}.terms'))])
+    assert np.array_equal(outputs[False], outputs[True])
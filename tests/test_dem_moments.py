@@ -0,0 +1,127 @@
+"""
+Test that the DEM moments match those computed from the printed DEM
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_executable, write_config
+
+SLOPE_LOG_MIN = 6.0
+SLOPE_LOG_MAX = 6.5
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+def run_with_moments(config, directory, name, window, save_dem=True):
+    config = config.copy()
+    config['dem'] = config['dem'].copy()
+    config['dem']['save_dem'] = save_dem
+    config['dem']['moments'] = {'slope_log_min': SLOPE_LOG_MIN, 'slope_log_max': SLOPE_LOG_MAX,
+                                'window': window}
+    config_filename = write_config(config, directory, name)
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    return os.path.join(directory, name)
+
+
+def emission_measure(output_filename):
+    """
+    Time, temperature bins and emission measure in each bin from the printed DEM
+    """
+    dem_tr = read_binary(f'{output_filename}.dem_tr')
+    dem_corona = read_binary(f'{output_filename}.dem_corona')
+    temperature = dem_tr[0, :]
+    delta_log_t = np.log10(temperature[1] / temperature[0])
+    bin_width = temperature * (10**(0.5*delta_log_t) - 10**(-0.5*delta_log_t))
+    time = read_binary(output_filename)[:, 0]
+    return time, temperature, (dem_tr[1:, :] + dem_corona[1:, :]) * bin_width
+
+
+def moments(temperature, em):
+    log_t = np.log10(temperature)
+    total = em.sum()
+    mean = np.sum(em * log_t) / total
+    width = np.sqrt(np.sum(em * (log_t - mean)**2) / total)
+    i = np.where((log_t >= SLOPE_LOG_MIN) & (log_t <= SLOPE_LOG_MAX) & (em > 0))[0]
+    if i.shape[0] < 2:
+        slope = np.nan
+    else:
+        # Least squares weighted by the emission measure; polyfit weights the residuals
+        slope = np.polyfit(log_t[i], np.log10(em[i]), 1, w=np.sqrt(em[i]))[0]
+    return [total, mean, width, slope]
+
+
+def test_moments_equal_dem(base_config, tmp_path):
+    output_filename = run_with_moments(base_config, tmp_path, 'results', 0)
+    time, temperature, em = emission_measure(output_filename)
+    results = read_binary(f'{output_filename}.dem_moments')
+    assert results.shape == (time.shape[0], 5)
+    assert np.array_equal(results[:, 0], time)
+    assert np.any(np.isfinite(results[:, 4]))
+    expected = np.array([moments(temperature, em[k, :]) for k in range(time.shape[0])])
+    assert np.allclose(results[:, 1:], expected, atol=0., rtol=1e-8, equal_nan=True)
+
+
+def test_window_moments_equal_dem(base_config, tmp_path):
+    window = 100.
+    output_filename = run_with_moments(base_config, tmp_path, 'results', window)
+    time, temperature, em = emission_measure(output_filename)
+    results = read_binary(f'{output_filename}.dem_moments')
+    # The DEM of each row holds until the next row, and the last window ends at the last row
+    starts = np.arange(time[0], time[-1], window)
+    assert np.allclose(results[:, 0], starts, atol=1e-9, rtol=0.)
+    for start, row in zip(starts, results):
+        end = min(start + window, time[-1])
+        overlap = np.clip(time[1:], start, end) - np.clip(time[:-1], start, end)
+        window_em = np.sum(overlap[:, np.newaxis] * em[:-1, :], axis=0) / (end - start)
+        assert np.allclose(row[1:], moments(temperature, window_em), atol=0., rtol=1e-8,
+                           equal_nan=True)
+
+
+@pytest.mark.parametrize('window', [0, 100.])
+def test_moments_without_dem(base_config, tmp_path, window):
+    with_dem = run_with_moments(base_config, tmp_path, 'with_dem', window)
+    without_dem = run_with_moments(base_config, tmp_path, 'without_dem', window, save_dem=False)
+    assert not os.path.exists(f'{without_dem}.dem_tr')
+    assert not os.path.exists(f'{without_dem}.dem_corona')
+    assert np.array_equal(read_binary(f'{with_dem}.dem_moments'),
+                          read_binary(f'{without_dem}.dem_moments'), equal_nan=True)
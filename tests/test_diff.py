@@ -0,0 +1,162 @@
+"""
+Test the exit codes of ebtel-diff for identical, perturbed and invalid runs
+"""
+import os
+import shutil
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import run_executable, write_config, write_ensemble
+
+# Size of the header of the binary output format (in bytes)
+HEADER_SIZE = 24
+SUFFIXES = ['', '.terms', '.dem_tr', '.dem_corona']
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': True,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+def run(config, directory):
+    os.makedirs(directory)
+    cmd = run_executable('ebtel++.run', '-c', write_config(config, directory, 'results'))
+    assert not cmd.stderr
+    return os.path.join(directory, 'results')
+
+
+@pytest.fixture
+def runs(base_config, tmp_path):
+    reference = run(base_config, os.path.join(tmp_path, 'reference'))
+    candidate = os.path.join(tmp_path, 'candidate', 'results')
+    shutil.copytree(os.path.dirname(reference), os.path.dirname(candidate))
+    return reference, candidate
+
+
+def perturb(filename, row, column, factor):
+    with open(filename, 'rb') as f:
+        num_columns = int(np.frombuffer(f.read(HEADER_SIZE)[12:16], dtype='=u4')[0])
+    data = np.memmap(filename, dtype='=f8', mode='r+', offset=HEADER_SIZE)
+    data[row * num_columns + column] *= factor
+    data.flush()
+
+
+def test_identical(runs):
+    cmd = run_executable('ebtel-diff.run', *runs)
+    assert cmd.returncode == 0, cmd.stdout + cmd.stderr
+
+
+def test_rerun_identical(base_config, runs, tmp_path):
+    reference, _ = runs
+    candidate = run(base_config, os.path.join(tmp_path, 'rerun'))
+    assert run_executable('ebtel-diff.run', reference, candidate).returncode == 0
+
+
+@pytest.mark.parametrize('suffix,column', [('', 1), ('.terms', 0), ('.dem_tr', 45)])
+def test_perturbed(runs, suffix, column):
+    reference, candidate = runs
+    # Within the tolerances
+    perturb(f'{candidate}{suffix}', 100, column, 1 + 1e-6)
+    assert run_executable('ebtel-diff.run', reference, candidate).returncode == 0
+    # Outside them
+    perturb(f'{candidate}{suffix}', 100, column, 1.1)
+    cmd = run_executable('ebtel-diff.run', reference, candidate)
+    assert cmd.returncode == 1
+    assert run_executable('ebtel-diff.run', '--max-tolerance', '0.2', '--rms-tolerance', '0.2',
+                          reference, candidate).returncode == 0
+
+
+def test_different_heating(base_config, runs, tmp_path):
+    reference, _ = runs
+    config = base_config.copy()
+    config['heating'] = base_config['heating'].copy()
+    event = base_config['heating']['events'][0]['event'].copy()
+    event['magnitude'] = 0.11
+    config['heating']['events'] = [{'event': event}]
+    candidate = run(config, os.path.join(tmp_path, 'different'))
+    assert run_executable('ebtel-diff.run', reference, candidate).returncode == 1
+
+
+@pytest.mark.parametrize('side', [0, 1])
+def test_missing_output(runs, side):
+    os.remove(f'{runs[side]}.terms')
+    assert run_executable('ebtel-diff.run', *runs).returncode == 1
+
+
+def test_invalid(runs, tmp_path):
+    reference, _ = runs
+    assert run_executable('ebtel-diff.run', '--not-an-option', *runs).returncode == 2
+    assert run_executable('ebtel-diff.run', reference).returncode == 2
+    cmd = run_executable('ebtel-diff.run', reference, os.path.join(tmp_path, 'missing', 'results'))
+    assert cmd.returncode == 2
+    assert cmd.stderr.startswith('ebtel-diff: ')
+
+
+def test_unreadable(runs):
+    reference, candidate = runs
+    with open(f'{candidate}.terms', 'w') as f:
+        f.write('0.0\t1.0\n')
+    cmd = run_executable('ebtel-diff.run', reference, candidate)
+    assert cmd.returncode == 2
+    assert 'not an ebtel++ binary file' in cmd.stdout
+
+
+def test_containers(base_config, tmp_path):
+    # Members are matched by their configuration file, so both containers are from the same files
+    config = base_config.copy()
+    config['heating'] = base_config['heating'].copy()
+    event = base_config['heating']['events'][0]['event'].copy()
+    event['magnitude'] = 0.2
+    config['heating']['events'] = [{'event': event}]
+    ensemble_filename = write_ensemble([base_config, config], tmp_path)
+    containers = [os.path.join(tmp_path, f'{name}.ebc') for name in ['reference', 'candidate', 'perturbed']]
+    for container_filename in containers:
+        if container_filename == containers[2]:
+            perturbed = config.copy()
+            perturbed['heating'] = config['heating'].copy()
+            perturbed['heating']['events'] = [{'event': dict(event, magnitude=0.21)}]
+            write_config(perturbed, tmp_path, 'member_1')
+        cmd = run_executable('ebtel++.run', '--ensemble', ensemble_filename, '--container', container_filename)
+        assert not cmd.stderr
+    assert run_executable('ebtel-diff.run', containers[0], containers[1]).returncode == 0
+    cmd = run_executable('ebtel-diff.run', containers[0], containers[2])
+    assert cmd.returncode == 1
+    assert run_executable('ebtel-diff.run', '--member', os.path.join(tmp_path, 'member_0.xml'),
+                          containers[0], containers[2]).returncode == 0
+    # A container and a single run cannot be compared
+    assert run_executable('ebtel-diff.run', containers[0], os.path.join(tmp_path, 'member_0')).returncode == 2
@@ -0,0 +1,93 @@
+"""
+Test that duplicate ensemble members are run once and linked to each output
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_ebtelplusplus, run_executable, write_ensemble
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': True,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}},
+                {'event': {'rise_start': 2000.0, 'rise_end': 2100.0, 'decay_start': 2100.0,
+                           'decay_end': 2200.0, 'magnitude': 0.05}},
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def members(base_config):
+    # Same as the first member, with the parameters in a different order and the
+    # numbers and booleans written differently
+    rewritten = {k: base_config[k] for k in reversed(list(base_config))}
+    rewritten['loop_length'] = '40.0e+8'
+    rewritten['use_flux_limiting'] = 'true'
+    # Same events in a different order, so not a duplicate
+    reordered = base_config.copy()
+    reordered['heating'] = base_config['heating'].copy()
+    reordered['heating']['events'] = base_config['heating']['events'][::-1]
+    return [base_config, rewritten, reordered, base_config.copy()]
+
+
+def test_duplicates_linked(members, tmp_path):
+    ensemble_filename = write_ensemble(members, tmp_path)
+    cmd = run_executable('ebtel++.run', '--ensemble', ensemble_filename,
+                         '--reduce', 'temperature_e:mean', '--reduce-grid', '0:4000:100')
+    assert not cmd.stderr
+    assert 'Running 2 unique configurations for 4 members' in cmd.stdout
+    for suffix in ['', '.terms', '.dem_tr', '.dem_corona']:
+        first = os.path.join(tmp_path, f'member_0{suffix}')
+        assert os.path.samefile(first, os.path.join(tmp_path, f'member_1{suffix}'))
+        assert os.path.samefile(first, os.path.join(tmp_path, f'member_3{suffix}'))
+        assert not os.path.samefile(first, os.path.join(tmp_path, f'member_2{suffix}'))
+    # Each duplicate counts in the statistics
+    reduced = np.loadtxt(f'{ensemble_filename}.reduced')
+    assert np.all(reduced[:, 1] == len(members))
+
+
+def test_duplicate_outputs_equal_single_run(members, tmp_path):
+    ensemble_filename = write_ensemble(members, tmp_path)
+    cmd = run_executable('ebtel++.run', '--ensemble', ensemble_filename)
+    assert not cmd.stderr
+    results = run_ebtelplusplus(members[0].copy())
+    for i in [1, 3]:
+        data = read_binary(os.path.join(tmp_path, f'member_{i}'))
+        assert np.array_equal(data[:, 0], results['time'])
+        assert np.array_equal(data[:, 1], results['electron_temperature'])
+        dem_tr = read_binary(os.path.join(tmp_path, f'member_{i}.dem_tr'))
+        assert np.array_equal(dem_tr[1:, :], results['dem_tr'])
@@ -0,0 +1,96 @@
+"""
+Test that members of an ensemble, run in turn on storage pooled between them,
+give the same results as when each is run on its own
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+
+from .helpers import run_executable, write_config, write_ensemble
+
+SUFFIXES = ['', '.terms', '.dem_tr', '.dem_corona']
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': True,
+        'use_adaptive_solver': False,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def member_configs(base_config):
+    """
+    Members that take more and fewer chunks of storage than the one before them,
+    with and without the DEM and terms
+    """
+    configs = []
+    for total_time, magnitude, calculate_dem in [(1e4, 0.1, True), (1e3, 0.05, True),
+                                                 (6e3, 0.2, False), (2e3, 0.1, True)]:
+        config = base_config.copy()
+        config['total_time'] = total_time
+        config['calculate_dem'] = calculate_dem
+        config['save_terms'] = calculate_dem
+        config['heating'] = base_config['heating'].copy()
+        config['heating']['events'] = [
+            {'event': {**base_config['heating']['events'][0]['event'], 'magnitude': magnitude}}
+        ]
+        configs.append(config)
+    return configs
+
+
+def read_outputs(filename):
+    outputs = {}
+    for suffix in SUFFIXES:
+        if os.path.isfile(filename + suffix):
+            with open(filename + suffix, 'rb') as f:
+                outputs[suffix] = f.read()
+    return outputs
+
+
+def test_pooled_members_equal_single_runs(member_configs, tmp_path):
+    singles = []
+    for i, config in enumerate(member_configs):
+        cmd = run_executable('ebtel++.run', '-q', '-c', write_config(config, tmp_path, f'single_{i}'))
+        assert cmd.returncode == 0
+        singles.append(read_outputs(os.path.join(tmp_path, f'single_{i}')))
+    ensemble_filename = write_ensemble(member_configs, tmp_path)
+    cmd = run_executable('ebtel++.run', '-q', '--ensemble', ensemble_filename, '--workers', 1)
+    assert cmd.returncode == 0
+    assert not cmd.stderr
+    for i, single in enumerate(singles):
+        member = read_outputs(os.path.join(tmp_path, f'member_{i}'))
+        assert sorted(member) == sorted(single)
+        for suffix in single:
+            assert member[suffix] == single[suffix]
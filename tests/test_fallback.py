@@ -0,0 +1,79 @@
+"""
+Test that a run whose steps keep failing falls back on safer settings and finishes
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import run_ebtelplusplus, run_executable, write_config
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': False,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+    }
+    return base_config
+
+
+def test_no_switches_written(base_config, tmp_path):
+    config_filename = write_config(base_config, tmp_path, 'results')
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    assert os.path.isfile(os.path.join(tmp_path, 'results'))
+    assert not os.path.exists(os.path.join(tmp_path, 'results.solver_switches'))
+
+
+def test_fallback_equal_reference(base_config, tmp_path):
+    # A first step so long that the state is no longer finite is retried with the
+    # same timestep when adaptive_solver_safety is 1, so the step keeps failing
+    config = base_config.copy()
+    config['tau'] = 100.0
+    config['tau_max'] = 100.0
+    config['adaptive_solver_safety'] = 1.0
+    config_filename = write_config(config, tmp_path, 'results')
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    with open(os.path.join(tmp_path, 'results.solver_switches')) as f:
+        switches = [line.split('\t') for line in f.read().splitlines()]
+    assert len(switches) == 1
+    assert float(switches[0][0]) == config['tau']
+    assert switches[0][2] == 'reduced adaptive_solver_safety to 0.1'
+    data = np.loadtxt(os.path.join(tmp_path, 'results'))
+    assert data[-1, 0] >= config['total_time'] - config['tau_max']
+    # The run with the reduced safety factor agrees with a run that used it from the start
+    config['adaptive_solver_safety'] = 0.1
+    config['adaptive_solver_error'] = 1e-9
+    reference = run_ebtelplusplus(config)
+    names = ['electron_temperature', 'ion_temperature', 'density', 'electron_pressure',
+             'ion_pressure', 'velocity']
+    for i, k in enumerate(names):
+        expected = np.interp(data[:, 0], reference['time'], reference[k])
+        assert np.max(np.fabs(data[:, i+1] - expected)) <= 1e-3 * np.max(np.fabs(reference[k]))
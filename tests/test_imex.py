@@ -0,0 +1,80 @@
+"""
+Test that the IMEX stepper agrees with a tight-tolerance Cash-Karp reference
+"""
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import run_ebtelplusplus
+
+STATE_VARIABLES = ['electron_temperature', 'ion_temperature', 'density', 'electron_pressure',
+                   'ion_pressure', 'velocity']
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': False,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def reference(base_config):
+    config = base_config.copy()
+    config['stepper'] = 'cash_karp'
+    config['adaptive_solver_error'] = 1e-9
+    return run_ebtelplusplus(config)
+
+
+@pytest.mark.parametrize('adaptive_solver_error', [1e-6, 1e-8])
+def test_imex_equal_reference(base_config, reference, adaptive_solver_error):
+    config = base_config.copy()
+    config['stepper'] = 'imex'
+    config['adaptive_solver_error'] = adaptive_solver_error
+    results = run_ebtelplusplus(config)
+    # Compare at the times of the IMEX run, relative to the peak of each quantity. The
+    # reference is not interpolated across its first step, where the heating is switched on
+    i = np.where(results['time'] >= reference['time'][1])
+    for k in STATE_VARIABLES:
+        expected = np.interp(results['time'][i], reference['time'], reference[k])
+        assert np.max(np.fabs(results[k][i] - expected)) <= 1e-3 * np.max(np.fabs(reference[k]))
+
+
+def test_imex_constant_timestep(base_config):
+    config = base_config.copy()
+    config['use_adaptive_solver'] = False
+    config['tau'] = 0.1
+    config['stepper'] = 'cash_karp'
+    r_cash_karp = run_ebtelplusplus(config.copy())
+    config['stepper'] = 'imex'
+    results = run_ebtelplusplus(config)
+    assert np.array_equal(results['time'], r_cash_karp['time'])
+    for k in STATE_VARIABLES:
+        assert np.max(np.fabs(results[k] - r_cash_karp[k])) <= 1e-3 * np.max(np.fabs(r_cash_karp[k]))
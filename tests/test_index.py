@@ -0,0 +1,126 @@
+"""
+Test that the time index points at the indexed rows and selects time windows of every output
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_executable, write_config
+
+# Size of the header of the binary output format (in bytes)
+HEADER_SIZE = 24
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': True,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+def run_with_index(config, directory, index_interval, output_format='binary'):
+    config = config.copy()
+    config['index_interval'] = index_interval
+    config['output_format'] = output_format
+    config_filename = write_config(config, directory, 'results')
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    return os.path.join(directory, 'results')
+
+
+@pytest.mark.parametrize('index_interval', [1, 7])
+def test_index_binary(base_config, tmp_path, index_interval):
+    output_filename = run_with_index(base_config, tmp_path, index_interval)
+    results = read_binary(output_filename)
+    indexed = np.arange(0, results.shape[0], index_interval)
+    for suffix, first_row in [('', 0), ('.terms', 0), ('.dem_tr', 1), ('.dem_corona', 1)]:
+        num_columns = read_binary(f'{output_filename}{suffix}').shape[1]
+        index = read_binary(f'{output_filename}{suffix}.index')
+        assert index.shape == (indexed.shape[0], 3)
+        assert np.array_equal(index[:, 0], results[indexed, 0])
+        # The temperature row of the DEM files is not indexed, but is counted
+        assert np.array_equal(index[:, 1], indexed + first_row)
+        assert np.array_equal(index[:, 2], HEADER_SIZE + 8 * num_columns * (indexed + first_row))
+
+
+def test_index_text(base_config, tmp_path):
+    index_interval = 5
+    output_filename = run_with_index(base_config, tmp_path, index_interval, output_format='text')
+    for suffix in ['', '.terms', '.dem_tr']:
+        index = read_binary(f'{output_filename}{suffix}.index')
+        with open(f'{output_filename}{suffix}', 'rb') as f:
+            content = f.read()
+        lines = content.splitlines(keepends=True)
+        first_row = 1 if suffix == '.dem_tr' else 0
+        offsets = np.cumsum([0] + [len(line) for line in lines])
+        indexed = np.arange(0, len(lines) - first_row, index_interval)
+        assert np.array_equal(index[:, 1], indexed + first_row)
+        assert np.array_equal(index[:, 2], offsets[indexed + first_row])
+        # Each entry points at the start of the indexed row
+        for offset, time in zip(index[:, 2].astype(int), index[:, 0]):
+            if suffix == '':
+                assert float(content[offset:].split(b'\t', 1)[0]) == pytest.approx(time, rel=1e-12)
+
+
+@pytest.mark.parametrize('index_interval', [1, 7])
+@pytest.mark.parametrize('window', [(1000., 2000.), (None, 500.), (4000., None)])
+def test_slice_by_index(base_config, tmp_path, index_interval, window):
+    output_filename = run_with_index(base_config, tmp_path, index_interval)
+    time = read_binary(output_filename)[:, 0]
+    start, stop = window
+    in_window = np.ones(time.shape, dtype=bool)
+    if start is not None:
+        in_window &= time >= start
+    if stop is not None:
+        in_window &= time <= stop
+    rows = np.where(in_window)[0]
+    # Rows between the indexed rows either side of the window are included too
+    indexed = np.arange(0, time.shape[0], index_interval)
+    before = indexed[indexed <= rows[0]]
+    first = before[-1] + 1 if before[-1] < rows[0] else before[-1]
+    after = indexed[indexed > rows[-1]]
+    end = after[0] if after.shape[0] > 0 else time.shape[0]
+    if index_interval == 1:
+        assert first == rows[0] and end == rows[-1] + 1
+    assert rows[0] - first < index_interval and end - rows[-1] <= index_interval
+    npy_filename = os.path.join(tmp_path, 'slice.npy')
+    time_range = ':'.join(['' if bound is None else str(bound) for bound in window])
+    for suffix, first_row in [('', 0), ('.terms', 0), ('.dem_tr', 1)]:
+        data = read_binary(f'{output_filename}{suffix}')
+        cmd = run_executable('ebtel-slice.run', '--index', '--time', time_range, '--format', 'npy',
+                             '--output', npy_filename, f'{output_filename}{suffix}')
+        assert not cmd.stderr
+        assert np.array_equal(np.load(npy_filename), data[first+first_row:end+first_row])
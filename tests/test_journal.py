@@ -0,0 +1,130 @@
+"""
+Test that an ensemble resumed from its journal only reruns the members that did not finish
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+
+from .helpers import run_executable, write_config, write_ensemble
+
+MAGNITUDES = [0.05, 0.1, 0.2]
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': False,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+    }
+    return base_config
+
+
+def with_magnitude(config, magnitude):
+    config = config.copy()
+    config['heating'] = config['heating'].copy()
+    event = config['heating']['events'][0]['event'].copy()
+    event['magnitude'] = magnitude
+    config['heating']['events'] = [{'event': event}]
+    return config
+
+
+@pytest.fixture
+def ensemble(base_config, tmp_path):
+    members = [with_magnitude(base_config, m) for m in MAGNITUDES]
+    ensemble_filename = write_ensemble(members, tmp_path)
+    journal_filename = os.path.join(tmp_path, 'members.journal')
+    cmd = run_executable('ebtel++.run', '--ensemble', ensemble_filename, '--journal', journal_filename)
+    assert not cmd.stderr
+    outputs = [os.path.join(tmp_path, f'member_{i}') for i in range(len(members))]
+    contents = []
+    for filename in outputs:
+        with open(filename, 'rb') as f:
+            contents.append(f.read())
+    return members, ensemble_filename, journal_filename, outputs, contents
+
+
+def resume(ensemble):
+    _, ensemble_filename, journal_filename, outputs, _ = ensemble
+    # Outputs that are printed again no longer have their modification time reset
+    for filename in outputs:
+        if os.path.exists(filename):
+            os.utime(filename, ns=(0, 0))
+    cmd = run_executable('ebtel++.run', '--ensemble', ensemble_filename, '--journal', journal_filename)
+    assert not cmd.stderr
+    rerun = [os.stat(filename).st_mtime_ns != 0 for filename in outputs]
+    return cmd.stdout, rerun
+
+
+def check_outputs(ensemble):
+    _, _, _, outputs, contents = ensemble
+    for filename, content in zip(outputs, contents):
+        with open(filename, 'rb') as f:
+            assert f.read() == content
+
+
+def test_resume_complete(ensemble):
+    stdout, rerun = resume(ensemble)
+    assert f'Skipped {len(MAGNITUDES)} members completed by an earlier run' in stdout
+    assert not any(rerun)
+    check_outputs(ensemble)
+
+
+def test_resume_truncated_output(ensemble):
+    _, _, _, outputs, contents = ensemble
+    os.truncate(outputs[1], len(contents[1]) // 2)
+    stdout, rerun = resume(ensemble)
+    assert f'Output {outputs[1]} of {outputs[1]}.xml is missing or incomplete; rerunning' in stdout
+    assert f'Skipped {len(MAGNITUDES) - 1} members completed by an earlier run' in stdout
+    assert rerun == [False, True, False]
+    check_outputs(ensemble)
+
+
+def test_resume_missing_output(ensemble):
+    _, _, _, outputs, _ = ensemble
+    os.remove(outputs[0])
+    _, rerun = resume(ensemble)
+    assert rerun == [True, False, False]
+    check_outputs(ensemble)
+
+
+def test_resume_truncated_journal(ensemble):
+    # The line of the last member to finish was cut short when the run was stopped
+    _, _, journal_filename, _, _ = ensemble
+    os.truncate(journal_filename, os.path.getsize(journal_filename) - 5)
+    stdout, rerun = resume(ensemble)
+    assert rerun == [False, False, True]
+    check_outputs(ensemble)
+
+
+def test_resume_changed_configuration(ensemble, tmp_path):
+    members, _, _, outputs, _ = ensemble
+    write_config(with_magnitude(members[0], 0.3), tmp_path, 'member_0')
+    stdout, rerun = resume(ensemble)
+    assert f'Configuration of {outputs[0]}.xml has changed since it was run; rerunning' in stdout
+    assert rerun == [True, False, False]
@@ -0,0 +1,99 @@
+"""
+Test the selection and report of the instruction set of the DEM kernels
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import run_executable, write_config
+
+ISAS = ['sse4.2', 'avx2', 'avx512']
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 500.0,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+def test_report_forced_kernels(base_config, tmp_path):
+    config = base_config.copy()
+    config['results_window_steps'] = 10
+    config_filename = write_config(config, tmp_path, 'generic')
+    cmd = run_executable('ebtel++.run', '-q', '-c', config_filename,
+                         '--kernel-isa', 'generic', '--report-kernel-isa')
+    assert cmd.returncode == 0
+    assert cmd.stderr.strip() == 'Using generic DEM kernels'
+    with open(os.path.join(tmp_path, 'generic.summary')) as f:
+        assert f.readline().strip() == '# DEM kernels: generic'
+    assert np.loadtxt(os.path.join(tmp_path, 'generic.summary')).shape == (3, 7)
+
+
+def test_no_report_by_default(base_config, tmp_path):
+    config_filename = write_config(base_config, tmp_path, 'quiet')
+    cmd = run_executable('ebtel++.run', '-q', '-c', config_filename, '--kernel-isa', 'generic')
+    assert cmd.returncode == 0
+    assert not cmd.stderr
+
+
+def test_unknown_kernels(base_config, tmp_path):
+    config_filename = write_config(base_config, tmp_path, 'unknown')
+    cmd = run_executable('ebtel++.run', '-q', '-c', config_filename, '--kernel-isa', 'mmx')
+    assert cmd.returncode != 0
+    assert 'Unrecognized kernel instruction set mmx' in cmd.stderr
+
+
+@pytest.mark.parametrize('isa', ISAS)
+@pytest.mark.parametrize('use_new_method', [True, False])
+def test_kernels_identical(base_config, tmp_path, isa, use_new_method):
+    config = base_config.copy()
+    config['dem'] = config['dem'].copy()
+    config['dem']['use_new_method'] = use_new_method
+    # Binary output holds every bit of the results
+    config['output_format'] = 'binary'
+    config_filename = write_config(config, tmp_path, 'generic')
+    cmd = run_executable('ebtel++.run', '-q', '-c', config_filename, '--kernel-isa', 'generic')
+    assert cmd.returncode == 0
+    config_filename = write_config(config, tmp_path, isa)
+    cmd = run_executable('ebtel++.run', '-q', '-c', config_filename, '--kernel-isa', isa)
+    if 'not supported by this CPU' in cmd.stderr:
+        pytest.skip(f'{isa} is not supported by this CPU')
+    assert cmd.returncode == 0
+    for suffix in ['', '.dem_tr', '.dem_corona']:
+        with open(os.path.join(tmp_path, f'generic{suffix}'), 'rb') as f:
+            expected = f.read()
+        with open(os.path.join(tmp_path, f'{isa}{suffix}'), 'rb') as f:
+            assert f.read() == expected
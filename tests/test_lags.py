@@ -0,0 +1,94 @@
+"""
+Test that the time lags found during the run match those of the printed light curves
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_executable, write_config
+
+GRID = np.arange(0, 4900 + 1, 5.)
+MAX_LAG = 2000.
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': False,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+    }
+    return base_config
+
+
+def find_lag(first, second):
+    """
+    Lag of `second` behind `first` at the peak of their normalized cross-correlation,
+    refined with a parabola through the peak, and the peak correlation
+    """
+    x = first - first.mean()
+    y = second - second.mean()
+    norm = np.sqrt(np.sum(x**2) * np.sum(y**2))
+    step = GRID[1] - GRID[0]
+    shifts = np.arange(-int(MAX_LAG / step), int(MAX_LAG / step) + 1)
+    values = np.array([np.sum(x[max(0, -s):len(x) - max(0, s)] * y[max(0, s):len(y) - max(0, -s)])
+                       for s in shifts]) / norm
+    peak = np.argmax(values)
+    curvature = values[peak-1] - 2 * values[peak] + values[peak+1]
+    offset = 0.5 * (values[peak-1] - values[peak+1]) / curvature
+    return (shifts[peak] + offset) * step, values[peak]
+
+
+def test_lags_equal_light_curves(base_config, tmp_path):
+    # Response linear in log T, so the channel is n^2 (log10(T) - 5)
+    response_filename = os.path.join(tmp_path, 'response.txt')
+    np.savetxt(response_filename, np.array([[1e5, 0.], [1e6, 1.], [1e7, 2.], [1e8, 3.]]),
+               header='temperature response')
+    config_filename = write_config(base_config, tmp_path, 'results')
+    cmd = run_executable('ebtel++.run', '-c', config_filename,
+                         '--lag-channel', f'linear={response_filename}',
+                         '--lag', f'temperature_e,density:{-MAX_LAG}:{MAX_LAG}',
+                         '--lag', f'density,linear:{-MAX_LAG}:{MAX_LAG}',
+                         '--lag-grid', f'{GRID[0]}:{GRID[-1]}:{GRID[1] - GRID[0]}')
+    assert not cmd.stderr
+    with open(f'{config_filename}.lags') as f:
+        rows = [line.split('\t') for line in f.read().splitlines()]
+    assert len(rows) == 1
+    assert rows[0][0] == config_filename
+    lags = np.array(rows[0][1:], dtype=float)
+    data = read_binary(os.path.join(tmp_path, 'results'))
+    temperature = np.interp(GRID, data[:, 0], data[:, 1])
+    density = np.interp(GRID, data[:, 0], data[:, 3])
+    linear = np.interp(GRID, data[:, 0], data[:, 3]**2 * (np.log10(data[:, 1]) - 5))
+    lag, correlation = find_lag(temperature, density)
+    # The density peaks after the temperature as the loop is filled by evaporation
+    assert lag > 0
+    assert np.allclose(lags[:2], [lag, correlation], atol=0., rtol=1e-5)
+    lag, correlation = find_lag(density, linear)
+    assert np.allclose(lags[2:], [lag, correlation], atol=0., rtol=1e-5)
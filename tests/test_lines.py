@@ -0,0 +1,132 @@
+"""
+Test that the line intensities match those computed from the printed DEM
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_executable, write_config
+
+# Boltzmann constant (in erg K^-1), as used by ebtel++
+BOLTZMANN_CONSTANT = 1.3806488e-16
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def tables(tmp_path):
+    """
+    Two small contribution functions, one at several densities and one independent of
+    density, that cover only part of the temperatures of the DEM
+    """
+    rng = np.random.RandomState(42)
+    log_t = np.linspace(5, 7.5, 26)
+    density = np.array([1e8, 1e9, 1e10, 1e11])
+    g_density = rng.uniform(0, 1e-24, size=(log_t.shape[0], density.shape[0]))
+    g_single = rng.uniform(0, 1e-24, size=(log_t.shape[0], 1))
+    filenames = []
+    for name, g, n in [('density', g_density, density), ('single', g_single, density[:1])]:
+        filename = os.path.join(tmp_path, f'{name}.gofnt')
+        with open(filename, 'w') as f:
+            f.write('# Contribution function for testing\n')
+            f.write(' '.join([f'{x:.17e}' for x in n]) + '\n')
+            for t, row in zip(10**log_t, g):
+                f.write(' '.join([f'{x:.17e}' for x in [t] + list(row)]) + '\n')
+        filenames.append(filename)
+    return filenames, log_t, np.log10(density), g_density, g_single
+
+
+def contribution(log_t_table, log_n_table, g, log_t, log_n):
+    """
+    G interpolated linearly in log T and log n, zero outside the temperatures of the table
+    and held at its end values outside its densities
+    """
+    log_n = np.clip(log_n, log_n_table[0], log_n_table[-1])
+    g_t = np.array([np.interp(log_t, log_t_table, g[:, k], left=0., right=0.)
+                    for k in range(g.shape[1])])
+    if g.shape[1] == 1:
+        return g_t[0]
+    return np.array([np.interp(log_n[j], log_n_table, g_t[:, j]) for j in range(log_t.shape[0])])
+
+
+def run_with_lines(config, directory, name, filenames, save_dem=True):
+    config = config.copy()
+    config['dem'] = config['dem'].copy()
+    config['dem']['save_dem'] = save_dem
+    config['dem']['lines'] = [{'line': filename} for filename in filenames]
+    config_filename = write_config(config, directory, name)
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    return os.path.join(directory, name)
+
+
+def test_lines_equal_dem(base_config, tmp_path, tables):
+    filenames, log_t_table, log_n_table, g_density, g_single = tables
+    output_filename = run_with_lines(base_config, tmp_path, 'results', filenames)
+    results = read_binary(output_filename)
+    lines = read_binary(f'{output_filename}.lines')
+    dem_tr = read_binary(f'{output_filename}.dem_tr')
+    dem_corona = read_binary(f'{output_filename}.dem_corona')
+    temperature = dem_tr[0, :]
+    log_t = np.log10(temperature)
+    delta_log_t = log_t[1] - log_t[0]
+    bin_width = temperature * (10**(0.5*delta_log_t) - 10**(-0.5*delta_log_t))
+    assert lines.shape == (results.shape[0], 3)
+    assert np.array_equal(lines[:, 0], results[:, 0])
+    assert np.all(lines[:, 1:] > 0)
+    for k in range(results.shape[0]):
+        # The corona is at the coronal density and the TR at the coronal electron pressure
+        log_n_corona = np.full(log_t.shape, np.log10(results[k, 3]))
+        log_n_tr = np.log10(results[k, 4] / BOLTZMANN_CONSTANT) - log_t
+        for l, g in enumerate([g_density, g_single]):
+            g_corona = contribution(log_t_table, log_n_table, g, log_t, log_n_corona)
+            g_tr = contribution(log_t_table, log_n_table, g, log_t, log_n_tr)
+            intensity = np.sum((dem_corona[k+1, :] * g_corona + dem_tr[k+1, :] * g_tr) * bin_width)
+            assert np.allclose(lines[k, l+1], intensity, atol=0., rtol=1e-6)
+
+
+def test_lines_without_dem(base_config, tmp_path, tables):
+    filenames = tables[0]
+    with_dem = run_with_lines(base_config, tmp_path, 'with_dem', filenames)
+    without_dem = run_with_lines(base_config, tmp_path, 'without_dem', filenames, save_dem=False)
+    assert not os.path.exists(f'{without_dem}.dem_tr')
+    assert not os.path.exists(f'{without_dem}.dem_corona')
+    assert np.array_equal(read_binary(f'{with_dem}.lines'), read_binary(f'{without_dem}.lines'))
@@ -0,0 +1,131 @@
+"""
+Test that the non-equilibrium ionization fractions match those computed from the results
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_executable, write_config
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': False,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def tables(tmp_path):
+    """
+    Rate tables of two small elements, with ionization and recombination rates that
+    make the equilibrium shift over the temperatures of the run
+    """
+    temperature = np.logspace(4, 8, 41)
+    tables = []
+    for name, thresholds in [('h', [2e5]), ('he', [3e5, 1e6])]:
+        ionization = np.array([1e-11 * np.exp(-e / temperature) for e in thresholds]).T
+        recombination = np.array([1e-13 * (i + 1) * (temperature / 1e6)**-0.7
+                                  for i in range(len(thresholds))]).T
+        filename = os.path.join(tmp_path, f'{name}.rates')
+        np.savetxt(filename, np.hstack([temperature[:, np.newaxis], ionization, recombination]),
+                   header='temperature ionization recombination')
+        tables.append((filename, np.log10(temperature), ionization, recombination))
+    return tables
+
+
+def rate_matrix(ionization, recombination):
+    n = ionization.shape[0] + 1
+    matrix = np.zeros((n, n))
+    for i in range(n - 1):
+        matrix[i, i] -= ionization[i]
+        matrix[i+1, i] += ionization[i]
+        matrix[i+1, i+1] -= recombination[i]
+        matrix[i, i+1] += recombination[i]
+    return matrix
+
+
+def nearest(log_t_table, temperature):
+    return np.argmin(np.fabs(log_t_table - np.log10(temperature)))
+
+
+def fractions(table, time, temperature, density):
+    """
+    Advance the fractions of one element over the steps of a run from equilibrium, with
+    the rates of the tabulated temperature nearest the geometric mean of each step
+    """
+    _, log_t_table, ionization, recombination = table
+    t = nearest(log_t_table, temperature[0])
+    eigenvalues, eigenvectors = np.linalg.eig(rate_matrix(ionization[t], recombination[t]))
+    x = np.real(eigenvectors[:, np.argmin(np.fabs(eigenvalues))])
+    x = [x / x.sum()]
+    for k in range(1, time.shape[0]):
+        t = nearest(log_t_table, np.sqrt(temperature[k-1] * temperature[k]))
+        eigenvalues, eigenvectors = np.linalg.eig(rate_matrix(ionization[t], recombination[t]))
+        exponent = 0.5 * (density[k-1] + density[k]) * (time[k] - time[k-1])
+        amplitudes = np.linalg.solve(eigenvectors, x[-1]) * np.exp(eigenvalues * exponent)
+        x_new = np.fmax(np.real(eigenvectors @ amplitudes), 0)
+        x.append(x_new / x_new.sum())
+    return np.array(x)
+
+
+def run_with_nei(config, directory, name, tables, post_process):
+    config = config.copy()
+    config['nei'] = [{'element': table[0]} for table in tables] + [{'post_process': post_process}]
+    config_filename = write_config(config, directory, name)
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    return os.path.join(directory, name)
+
+
+def test_nei_equal_results(base_config, tmp_path, tables):
+    output_filename = run_with_nei(base_config, tmp_path, 'results', tables, False)
+    results = read_binary(output_filename)
+    nei = read_binary(f'{output_filename}.nei')
+    assert nei.shape == (results.shape[0], 1 + 2 + 3)
+    assert np.array_equal(nei[:, 0], results[:, 0])
+    h = fractions(tables[0], results[:, 0], results[:, 1], results[:, 3])
+    he = fractions(tables[1], results[:, 0], results[:, 1], results[:, 3])
+    assert np.allclose(nei[:, 1:3], h, atol=1e-10, rtol=1e-6)
+    assert np.allclose(nei[:, 3:], he, atol=1e-10, rtol=1e-6)
+    # The loop is out of equilibrium as it is heated
+    for k in np.searchsorted(results[:, 0], [50, 150]):
+        t = nearest(tables[1][1], results[k, 1])
+        eigenvalues, eigenvectors = np.linalg.eig(rate_matrix(tables[1][2][t], tables[1][3][t]))
+        equilibrium = np.real(eigenvectors[:, np.argmin(np.fabs(eigenvalues))])
+        assert not np.allclose(he[k], equilibrium / equilibrium.sum(), atol=1e-2, rtol=0.)
+
+
+def test_post_process_equal_inline(base_config, tmp_path, tables):
+    inline = run_with_nei(base_config, tmp_path, 'inline', tables, False)
+    post_processed = run_with_nei(base_config, tmp_path, 'post_processed', tables, True)
+    assert np.array_equal(read_binary(f'{inline}.nei'), read_binary(f'{post_processed}.nei'))
@@ -0,0 +1,67 @@
+"""
+Test that the output format and memory limit do not change the results
+"""
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import run_ebtelplusplus
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': False,
+        'use_adaptive_solver': False,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 451, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def text_results(base_config):
+    return run_ebtelplusplus(base_config.copy())
+
+
+def test_binary_equal_text(base_config, text_results):
+    config = base_config.copy()
+    config['output_format'] = 'binary'
+    results = run_ebtelplusplus(config)
+    for k in text_results:
+        assert np.allclose(text_results[k], results[k], atol=0., rtol=1e-5)
+
+
+def test_spill_equal_in_memory(base_config, text_results):
+    config = base_config.copy()
+    config['max_memory'] = 1.0
+    results = run_ebtelplusplus(config)
+    for k in text_results:
+        assert np.array_equal(text_results[k], results[k])
@@ -0,0 +1,88 @@
+"""
+Test that the ensemble statistics match those computed from the results of each member
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_executable, write_ensemble
+
+MAGNITUDES = [0.02, 0.05, 0.1, 0.2, 0.5]
+GRID = np.arange(0, 4900 + 1, 10.)
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': False,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def members(base_config):
+    members = []
+    for magnitude in MAGNITUDES:
+        config = base_config.copy()
+        config['heating'] = base_config['heating'].copy()
+        event = base_config['heating']['events'][0]['event'].copy()
+        event['magnitude'] = magnitude
+        config['heating']['events'] = [{'event': event}]
+        members.append(config)
+    return members
+
+
+@pytest.mark.parametrize('workers', [1, 3])
+def test_reduce_equal_member_statistics(members, tmp_path, workers):
+    ensemble_filename = write_ensemble(members, tmp_path)
+    cmd = run_executable('ebtel++.run', '--ensemble', ensemble_filename, '--workers', workers,
+                         '--reduce', 'temperature_e:mean,variance,min,max',
+                         '--reduce', 'density:mean,variance',
+                         '--reduce-grid', f'{GRID[0]}:{GRID[-1]}:{GRID[1] - GRID[0]}')
+    assert not cmd.stderr
+    reduced = np.loadtxt(f'{ensemble_filename}.reduced')
+    assert np.allclose(reduced[:, 0], GRID, atol=1e-6, rtol=0.)
+    assert np.all(reduced[:, 1] == len(members))
+    # Interpolate the results of each member onto the grid
+    temperature = []
+    density = []
+    for i in range(len(members)):
+        data = read_binary(os.path.join(tmp_path, f'member_{i}'))
+        temperature.append(np.interp(GRID, data[:, 0], data[:, 1]))
+        density.append(np.interp(GRID, data[:, 0], data[:, 3]))
+    temperature = np.array(temperature)
+    density = np.array(density)
+    assert np.allclose(reduced[:, 2], temperature.mean(axis=0), atol=0., rtol=1e-5)
+    assert np.allclose(reduced[:, 3], temperature.var(axis=0, ddof=1), atol=0., rtol=1e-5)
+    assert np.allclose(reduced[:, 4], temperature.min(axis=0), atol=0., rtol=1e-5)
+    assert np.allclose(reduced[:, 5], temperature.max(axis=0), atol=0., rtol=1e-5)
+    assert np.allclose(reduced[:, 6], density.mean(axis=0), atol=0., rtol=1e-5)
+    assert np.allclose(reduced[:, 7], density.var(axis=0, ddof=1), atol=0., rtol=1e-5)
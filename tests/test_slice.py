@@ -0,0 +1,122 @@
+"""
+Test that slices of binary output files match the same rows and columns read in full
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import read_binary, run_executable, write_config
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': True,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'output_format': 'binary',
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+@pytest.fixture
+def output_filename(base_config, tmp_path):
+    config_filename = write_config(base_config, tmp_path, 'results')
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    return os.path.join(tmp_path, 'results')
+
+
+def slice_npy(tmp_path, *args):
+    npy_filename = os.path.join(tmp_path, 'slice.npy')
+    cmd = run_executable('ebtel-slice.run', '--format', 'npy', '--output', npy_filename, *args)
+    assert not cmd.stderr
+    assert cmd.returncode == 0
+    return np.load(npy_filename)
+
+
+def test_columns(output_filename, tmp_path):
+    data = read_binary(output_filename)
+    sliced = slice_npy(tmp_path, '--columns', 'time,temperature_e,3', output_filename)
+    assert np.array_equal(sliced, data[:, [0, 1, 3]])
+    assert np.array_equal(slice_npy(tmp_path, output_filename), data)
+
+
+@pytest.mark.parametrize('window', [(1000., 2000.), (None, 500.), (4000., None), (-10., 1e4)])
+def test_time_window(output_filename, tmp_path, window):
+    data = read_binary(output_filename)
+    start, stop = window
+    i = np.ones(data.shape[0], dtype=bool)
+    if start is not None:
+        i &= data[:, 0] >= start
+    if stop is not None:
+        i &= data[:, 0] <= stop
+    time = ':'.join(['' if bound is None else str(bound) for bound in window])
+    sliced = slice_npy(tmp_path, '--time', time, '--columns', 'time,density', output_filename)
+    assert np.array_equal(sliced, data[i][:, [0, 3]])
+
+
+def test_rows(output_filename, tmp_path):
+    dem_tr = read_binary(f'{output_filename}.dem_tr')
+    # Skip the temperature row
+    assert np.array_equal(slice_npy(tmp_path, '--rows', '1:', f'{output_filename}.dem_tr'), dem_tr[1:])
+    terms = read_binary(f'{output_filename}.terms')
+    sliced = slice_npy(tmp_path, '--rows', '10:20', '--columns', '2', f'{output_filename}.terms')
+    assert np.array_equal(sliced, terms[10:20, [2]])
+
+
+def test_concatenated(output_filename, tmp_path):
+    data = read_binary(output_filename)
+    sliced = slice_npy(tmp_path, '--rows', ':5', output_filename, output_filename)
+    assert np.array_equal(sliced, np.vstack([data[:5], data[:5]]))
+
+
+def test_raw_and_text(output_filename, tmp_path):
+    data = read_binary(output_filename)
+    raw = run_executable('ebtel-slice.run', '--columns', 'time,velocity', '--rows', '100:200',
+                         '--output', os.path.join(tmp_path, 'slice.raw'), output_filename)
+    assert raw.returncode == 0
+    assert np.array_equal(np.fromfile(os.path.join(tmp_path, 'slice.raw'), dtype='=f8').reshape(100, 2),
+                          data[100:200, [0, 6]])
+    text = run_executable('ebtel-slice.run', '--columns', 'time,velocity', '--rows', '100:200',
+                          '--format', 'text', output_filename)
+    assert text.returncode == 0
+    assert np.allclose(np.loadtxt(text.stdout.splitlines()), data[100:200, [0, 6]], atol=0., rtol=1e-5)
+
+
+def test_not_binary(tmp_path):
+    filename = os.path.join(tmp_path, 'results.txt')
+    with open(filename, 'w') as f:
+        f.write('0.0\t1.0\n')
+    cmd = run_executable('ebtel-slice.run', filename)
+    assert cmd.returncode != 0
+    assert 'not an ebtel++ binary file' in cmd.stderr
@@ -0,0 +1,92 @@
+"""
+Test that keeping only the last steps gives the end of the full run and its statistics
+"""
+import os
+from collections import OrderedDict
+
+import pytest
+import numpy as np
+
+from .helpers import run_ebtelplusplus, run_executable, write_config
+
+WINDOW_STEPS = 100
+
+
+@pytest.fixture
+def base_config():
+    base_config = {
+        'total_time': 5e3,
+        'tau': 1.0,
+        'tau_max': 10.0,
+        'loop_length': 4e9,
+        'saturation_limit': 1/6,
+        'force_single_fluid': False,
+        'use_c1_loss_correction': True,
+        'use_c1_grav_correction': True,
+        'use_flux_limiting': True,
+        'calculate_dem': True,
+        'save_terms': False,
+        'use_adaptive_solver': True,
+        'adaptive_solver_error': 1e-6,
+        'adaptive_solver_safety': 0.5,
+        'c1_cond0': 2.0,
+        'c1_rad0': 0.6,
+        'helium_to_hydrogen_ratio': 0.075,
+        'surface_gravity': 1.0,
+        'heating': OrderedDict({
+            'partition': 1.0,
+            'background': 1e-6,
+            'events': [
+                {'event': {'rise_start': 0.0, 'rise_end': 100.0, 'decay_start': 100.0,
+                           'decay_end': 200.0, 'magnitude': 0.1}}
+            ]
+        }),
+        'dem': OrderedDict({
+            'use_new_method': True,
+            'temperature': {'bins': 91, 'log_min': 4, 'log_max': 8.5},
+        }),
+    }
+    return base_config
+
+
+@pytest.mark.parametrize('use_adaptive_solver', [True, False])
+def test_window_equal_end_of_run(base_config, tmp_path, use_adaptive_solver):
+    config = base_config.copy()
+    config['use_adaptive_solver'] = use_adaptive_solver
+    r_full = run_ebtelplusplus(config.copy())
+    config['results_window_steps'] = WINDOW_STEPS
+    config_filename = write_config(config, tmp_path, 'window')
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    output_filename = os.path.join(tmp_path, 'window')
+    data = np.loadtxt(output_filename)
+    assert data.shape[0] == WINDOW_STEPS
+    assert np.array_equal(data[:, 0], r_full['time'][-WINDOW_STEPS:])
+    assert np.array_equal(data[:, 1], r_full['electron_temperature'][-WINDOW_STEPS:])
+    assert np.array_equal(data[:, 3], r_full['density'][-WINDOW_STEPS:])
+    assert np.array_equal(data[:, 7], r_full['heat'][-WINDOW_STEPS:])
+    for k in ['dem_tr', 'dem_corona']:
+        dem = np.loadtxt(f'{output_filename}.{k}')
+        assert np.array_equal(dem[0, :], r_full['dem_temperature'])
+        assert np.array_equal(dem[1:, :], r_full[k][-WINDOW_STEPS:, :])
+
+
+def test_summary_of_whole_run(base_config, tmp_path):
+    config = base_config.copy()
+    config['output_format'] = 'binary'
+    r_full = run_ebtelplusplus(config.copy())
+    config['results_window_steps'] = WINDOW_STEPS
+    config_filename = write_config(config, tmp_path, 'window')
+    cmd = run_executable('ebtel++.run', '-c', config_filename)
+    assert not cmd.stderr
+    summary = np.loadtxt(os.path.join(tmp_path, 'window.summary'))
+    assert summary.shape == (3, 7)
+    names = ['electron_temperature', 'ion_temperature', 'density', 'electron_pressure',
+             'ion_pressure', 'velocity', 'heat']
+    time = r_full['time']
+    for i, k in enumerate(names):
+        assert np.allclose(summary[0, i], r_full[k].min(), atol=0., rtol=1e-5)
+        assert np.allclose(summary[1, i], r_full[k].max(), atol=0., rtol=1e-5)
+        # Trapezoidal rule, written out as numpy has renamed np.trapz
+        average = np.sum(0.5 * (r_full[k][1:] + r_full[k][:-1]) * np.diff(time)) / (time[-1] - time[0])
+        assert np.allclose(summary[2, i], average, atol=0., rtol=1e-5)
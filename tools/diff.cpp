@@ -0,0 +1,644 @@
+/*
+ebtel-diff
+Compare the binary outputs of two ebtel++ runs or ensemble containers within tolerances.
+*/
+
+#include <atomic>
+#include <map>
+#include <sstream>
+#include "boost/program_options.hpp"
+#include "../source/binary.h"
+#include "../source/container.h"
+#include "../source/reduction.h"
+
+// Names of the columns of the results, time first
+static const char * RESULTS_COLUMNS[] = {"time","temperature_e","temperature_i","density","pressure_e","pressure_i","velocity","heat"};
+
+// Outputs compared by default for runs that are not in a container, if the reference has them
+static const char * DEFAULT_OUTPUTS[] = {"",".terms",".dem_corona",".dem_tr",".lines",".nei"};
+
+// Largest allowed maximum and RMS relative error of a column
+//
+struct Tolerance {
+  double max;
+  double rms;
+};
+
+// Where the outputs of a run are found
+//
+struct RunSource {
+  /* Identifier of the run: its member id in a container, or its output filename */
+  std::string id;
+  /* Path of the container, or output filename of a run that is not in a container */
+  std::string filename;
+  /* True if the run is a member of a container */
+  bool in_container;
+  /* Member stored in the container */
+  ContainerMember member;
+};
+
+// Relative errors of one column
+//
+struct ColumnError {
+  /* Largest relative error and the time it occurs at; NaN for a row that is not at a step, e.g. the temperatures of a DEM file */
+  double max;
+  double time;
+  /* Sum of squared relative errors and number of values compared */
+  double sum_squares;
+  uint64_t count;
+};
+
+// Comparison of one output of one run
+//
+struct Comparison {
+  /* Position of the run in the list of runs compared */
+  std::size_t run;
+  /* Suffix of the output; empty for the results */
+  std::string suffix;
+  /* Reason the output could not be compared; empty if it was */
+  std::string error;
+  /* Index of the first column compared, 1 if the first column is the time */
+  int first_column;
+  /* Errors of each column */
+  std::vector<ColumnError> columns;
+  /* Number of reference steps outside the time range of the candidate, which are not compared */
+  uint64_t num_outside;
+};
+
+// Split a string at commas
+//
+std::vector<std::string> SplitList(std::string list)
+{
+  std::vector<std::string> fields;
+  std::stringstream list_stream(list);
+  std::string field;
+  while(std::getline(list_stream,field,','))
+  {
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+// @return name of an output for messages: `results` for the results, otherwise its suffix
+//
+std::string OutputName(const std::string & suffix)
+{
+  return suffix.empty() ? "results" : suffix;
+}
+
+// @return suffix of an output given by name, the inverse of <OutputName>
+//
+std::string OutputSuffix(const std::string & name)
+{
+  return name.compare("results")==0 ? "" : name;
+}
+
+// @return name of a column of an output: its name for results columns, otherwise its index
+//
+std::string ColumnName(const std::string & suffix, int column)
+{
+  if(suffix.empty() && column < 8)
+  {
+    return RESULTS_COLUMNS[column];
+  }
+  return std::to_string(column);
+}
+
+// @return true if <filename> starts like an ensemble container
+//
+bool IsContainer(std::string filename)
+{
+  std::ifstream f(filename.c_str(),std::ios::in | std::ios::binary);
+  char magic[8] = {0};
+  f.read(magic,8);
+  return f && std::string(magic,8).compare("EBTELCON")==0;
+}
+
+// Map an output of a run
+// @source run
+// @suffix suffix of the output
+// @file reader to map the output with
+//
+// @return false if the run has no such output
+//
+bool OpenOutput(const RunSource & source, const std::string & suffix, MappedReader & file)
+{
+  if(!source.in_container)
+  {
+    std::ifstream f((source.filename + suffix).c_str());
+    if(!f.is_open())
+    {
+      return false;
+    }
+    f.close();
+    file.Open(source.filename + suffix);
+    return true;
+  }
+  for(std::size_t k=0;k<source.member.files.size();k++)
+  {
+    if(source.member.files[k].suffix.compare(suffix)==0)
+    {
+      file.Open(source.filename,source.member.files[k].offset,source.member.files[k].size);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Find the outputs of a run
+// @source run
+//
+// @return suffix of each output, results first, apart from time indexes
+//
+std::vector<std::string> FindOutputs(const RunSource & source)
+{
+  std::vector<std::string> suffixes;
+  if(source.in_container)
+  {
+    for(std::size_t j=0;j<source.member.files.size();j++)
+    {
+      const std::string & suffix = source.member.files[j].suffix;
+      if(suffix.size() < 6 || suffix.compare(suffix.size()-6,6,".index") != 0)
+      {
+        suffixes.push_back(suffix);
+      }
+    }
+    return suffixes;
+  }
+  for(std::size_t j=0;j<sizeof(DEFAULT_OUTPUTS)/sizeof(DEFAULT_OUTPUTS[0]);j++)
+  {
+    std::ifstream f((source.filename + DEFAULT_OUTPUTS[j]).c_str());
+    if(f.is_open())
+    {
+      suffixes.push_back(DEFAULT_OUTPUTS[j]);
+    }
+  }
+  return suffixes;
+}
+
+// Find the tolerance of a column
+// @tolerances tolerances given on the command line, keyed by output, by output and column, or by results column name
+// @default_tolerance tolerance of columns with none of their own
+//
+Tolerance FindTolerance(const std::map<std::string, Tolerance> & tolerances, const Tolerance & default_tolerance, const std::string & suffix, int column)
+{
+  std::map<std::string, Tolerance>::const_iterator entry = tolerances.find(OutputName(suffix) + ":" + ColumnName(suffix,column));
+  if(entry == tolerances.end() && suffix.empty())
+  {
+    entry = tolerances.find(ColumnName(suffix,column));
+  }
+  if(entry == tolerances.end())
+  {
+    entry = tolerances.find(OutputName(suffix));
+  }
+  return entry == tolerances.end() ? default_tolerance : entry->second;
+}
+
+// Compare one output of a run with the same output of the reference run
+// @reference reference run
+// @candidate run checked against it
+// @comparison output to compare; filled with the errors of each column
+// @floor fraction of the largest magnitude of each reference column below which errors are taken relative to that fraction
+// @span_tolerance fraction of the duration of the reference that the candidate may fall short of it by at either end
+//
+// Each output is aligned with the steps of the results of its run, with at most
+// one extra row at the start, such as the temperatures of a DEM file, which is
+// compared as it is. Rows at steps are compared at each reference step by linear
+// interpolation between the candidate steps on either side of it, so runs with
+// different time grids, e.g. from the adaptive solver with different settings,
+// can be compared. The relative error of a value a of the reference and b of
+// the candidate is |b - a|/max(|a|, floor max|a|), where the maximum is over
+// the steps of the reference column, or of the whole output if it has an extra
+// row, since its columns are then bins of a single quantity.
+//
+void CompareOutput(const RunSource & reference, const RunSource & candidate, Comparison & comparison, double floor, double span_tolerance)
+{
+  MappedReader reference_results, candidate_results, reference_file, candidate_file;
+  if(!OpenOutput(reference,"",reference_results))
+  {
+    comparison.error = "no results in reference";
+    return;
+  }
+  if(!OpenOutput(candidate,"",candidate_results))
+  {
+    comparison.error = "no results in candidate";
+    return;
+  }
+  if(!OpenOutput(reference,comparison.suffix,reference_file))
+  {
+    comparison.error = "not in reference";
+    return;
+  }
+  if(!OpenOutput(candidate,comparison.suffix,candidate_file))
+  {
+    comparison.error = "not in candidate";
+    return;
+  }
+  int num_columns = reference_file.GetNumColumns();
+  if(candidate_file.GetNumColumns() != num_columns)
+  {
+    comparison.error = "candidate has " + std::to_string(candidate_file.GetNumColumns()) + " columns, reference has " + std::to_string(num_columns);
+    return;
+  }
+
+  // Rows before the first step
+  uint64_t num_steps_reference = reference_results.GetNumRows();
+  uint64_t num_steps_candidate = candidate_results.GetNumRows();
+  uint64_t num_header = reference_file.GetNumRows() - std::min(num_steps_reference,reference_file.GetNumRows());
+  if(num_header > 1 || reference_file.GetNumRows() < num_steps_reference || candidate_file.GetNumRows() != num_steps_candidate + num_header)
+  {
+    comparison.error = "rows do not line up with the steps of the results";
+    return;
+  }
+  if(num_steps_reference == 0 || num_steps_candidate == 0)
+  {
+    comparison.error = "no steps to compare";
+    return;
+  }
+  double reference_start = reference_results.GetRow(0)[0];
+  double reference_stop = reference_results.GetRow(num_steps_reference-1)[0];
+  double candidate_start = candidate_results.GetRow(0)[0];
+  double candidate_stop = candidate_results.GetRow(num_steps_candidate-1)[0];
+  double slack = span_tolerance*(reference_stop - reference_start);
+  if(candidate_start > reference_start + slack || candidate_stop < reference_stop - slack)
+  {
+    std::ostringstream message;
+    message << "candidate covers " << candidate_start << " to " << candidate_stop << " s, reference " << reference_start << " to " << reference_stop << " s";
+    comparison.error = message.str();
+    return;
+  }
+
+  // Leave out a time column
+  comparison.first_column = 0;
+  if(num_header == 0 && num_columns > 1)
+  {
+    comparison.first_column = 1;
+    for(uint64_t i=0;i<num_steps_reference && comparison.first_column == 1;i++)
+    {
+      comparison.first_column = reference_file.GetRow(i)[0] == reference_results.GetRow(i)[0] ? 1 : 0;
+    }
+  }
+
+  // Errors are relative to at least a fraction of the largest magnitude of each
+  // column, or of every column if they are bins of a single quantity, as in a DEM
+  std::vector<double> scale(num_columns,0.0);
+  for(uint64_t i=num_header;i<reference_file.GetNumRows();i++)
+  {
+    const double * row = reference_file.GetRow(i);
+    for(int c=0;c<num_columns;c++)
+    {
+      scale[c] = std::fmax(scale[c],std::fabs(row[c]));
+    }
+  }
+  double largest = *std::max_element(scale.begin(),scale.end());
+  for(int c=0;c<num_columns;c++)
+  {
+    scale[c] = floor*(num_header > 0 ? largest : scale[c]);
+  }
+  ColumnError zero = {0.0,NAN,0.0,0};
+  comparison.columns.assign(num_columns,zero);
+  std::vector<double> interpolated(num_columns);
+  for(uint64_t i=0;i<reference_file.GetNumRows();i++)
+  {
+    const double * row = reference_file.GetRow(i);
+    double time = NAN;
+    if(i < num_header)
+    {
+      std::copy(candidate_file.GetRow(i),candidate_file.GetRow(i)+num_columns,interpolated.begin());
+    }
+    else
+    {
+      // Candidate steps on either side of the reference step
+      time = reference_results.GetRow(i - num_header)[0];
+      if(time < candidate_start || time > candidate_stop)
+      {
+        comparison.num_outside++;
+        continue;
+      }
+      uint64_t j = std::min(candidate_results.FindRow(time),num_steps_candidate-1);
+      const double * after = candidate_file.GetRow(j + num_header);
+      double time_after = candidate_results.GetRow(j)[0];
+      if(time_after == time || j == 0)
+      {
+        std::copy(after,after+num_columns,interpolated.begin());
+      }
+      else
+      {
+        const double * before = candidate_file.GetRow(j - 1 + num_header);
+        double time_before = candidate_results.GetRow(j-1)[0];
+        double weight = (time - time_before)/(time_after - time_before);
+        for(int c=0;c<num_columns;c++)
+        {
+          interpolated[c] = before[c] + weight*(after[c] - before[c]);
+        }
+      }
+    }
+    for(int c=comparison.first_column;c<num_columns;c++)
+    {
+      double difference = std::fabs(interpolated[c] - row[c]);
+      double denominator = i < num_header ? std::fabs(row[c]) : std::fmax(std::fabs(row[c]),scale[c]);
+      double error;
+      if(std::isnan(row[c]) || std::isnan(interpolated[c]))
+      {
+        error = std::isnan(row[c]) && std::isnan(interpolated[c]) ? 0.0 : INFINITY;
+      }
+      else
+      {
+        error = difference == 0.0 ? 0.0 : (denominator > 0.0 ? difference/denominator : INFINITY);
+      }
+      ColumnError & column = comparison.columns[c];
+      if(error > column.max || column.count == 0)
+      {
+        column.max = error;
+        column.time = time;
+      }
+      column.sum_squares += error*error;
+      column.count++;
+    }
+  }
+}
+
+// Compare two runs as requested on the command line
+//
+// @return exit code of the program
+//
+int Diff(int argc, char *argv[])
+{
+  namespace po = boost::program_options;
+  po::options_description description("Compare the binary outputs of a candidate ebtel++ run, or ensemble container, with those of a reference. Files are memory-mapped and runs are compared in parallel. The exit code is 1 if any column of any output is outside its tolerances, or if an output or member is missing from either side, and 2 if the options are invalid or the runs cannot be read.\nUsage: ebtel-diff [options] REFERENCE CANDIDATE");
+  description.add_options()
+    ("help,h","This help message")
+    ("max-tolerance",po::value<double>()->default_value(1e-3),"Largest allowed relative error of any value of a column.")
+    ("rms-tolerance",po::value<double>()->default_value(1e-4),"Largest allowed root mean square relative error of a column.")
+    ("tolerance",po::value<std::vector<std::string> >()->composing(),"Tolerances of some columns, as target=max[,rms], where the target is an output (results, .terms, .dem_corona, ...), an output and column (e.g. .dem_tr:120 or results:density) or the name of a results column (e.g. velocity). rms defaults to max. May be given more than once.")
+    ("floor",po::value<double>()->default_value(1e-6),"Errors are relative to at least this fraction of the largest magnitude of the reference column, so that values near zero, e.g. of the velocity, do not dominate.")
+    ("span-tolerance",po::value<double>()->default_value(1e-2),"Fraction of the duration of the reference by which the candidate may start later or end earlier. Reference steps outside the candidate are not compared.")
+    ("outputs",po::value<std::string>(),"Comma-separated list of the outputs to compare, e.g. results,.terms. Defaults to every output of the reference except time indexes.")
+    ("member,m",po::value<std::vector<std::string> >()->composing(),"Member of the containers to compare. May be given more than once. Defaults to every member.")
+    ("all-columns,a",po::bool_switch()->default_value(false),"Print the errors of every column, rather than only those outside their tolerances.")
+    ("threads,j",po::value<int>()->default_value(0),"Number of threads; 0 uses one per available CPU.")
+    ("runs",po::value<std::vector<std::string> >(),"Reference and candidate: the output filenames of two runs, whose results and other outputs are in the binary output format, or two ensemble containers.");
+  po::positional_options_description positional;
+  positional.add("runs",2);
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc,argv).options(description).positional(positional).run(), vm);
+  if(vm.count("help") || !vm.count("runs") || vm["runs"].as<std::vector<std::string> >().size() != 2)
+  {
+    std::cout << description;
+    return vm.count("help") ? 0 : 2;
+  }
+  po::notify(vm);
+
+  Tolerance default_tolerance = {vm["max-tolerance"].as<double>(),vm["rms-tolerance"].as<double>()};
+  std::map<std::string, Tolerance> tolerances;
+  if(vm.count("tolerance"))
+  {
+    std::vector<std::string> specifications = vm["tolerance"].as<std::vector<std::string> >();
+    for(std::size_t k=0;k<specifications.size();k++)
+    {
+      std::size_t equals = specifications[k].rfind('=');
+      if(equals == std::string::npos)
+      {
+        throw std::runtime_error("Tolerance " + specifications[k] + " must be of the form target=max[,rms]");
+      }
+      std::vector<std::string> values = SplitList(specifications[k].substr(equals+1));
+      if(values.empty() || values.size() > 2)
+      {
+        throw std::runtime_error("Tolerance " + specifications[k] + " must be of the form target=max[,rms]");
+      }
+      Tolerance tolerance = {std::stod(values[0]),std::stod(values.back())};
+      std::string target = specifications[k].substr(0,equals);
+      if(FindResultsColumn(target) >= 0)
+      {
+        target = "results:" + target;
+      }
+      tolerances[target] = tolerance;
+    }
+  }
+
+  // Pair up the runs
+  std::vector<std::string> runs = vm["runs"].as<std::vector<std::string> >();
+  bool containers = IsContainer(runs[0]);
+  if(IsContainer(runs[1]) != containers)
+  {
+    throw std::runtime_error("Either both or neither of " + runs[0] + " and " + runs[1] + " must be ensemble containers");
+  }
+  std::vector<RunSource> references, candidates;
+  std::vector<std::string> unmatched;
+  if(!containers)
+  {
+    for(int k=0;k<2;k++)
+    {
+      std::ifstream f(runs[k].c_str());
+      if(!f.is_open())
+      {
+        throw std::runtime_error("Failed to open results file " + runs[k]);
+      }
+    }
+    RunSource reference = {runs[0],runs[0],false,ContainerMember()};
+    RunSource candidate = {runs[1],runs[1],false,ContainerMember()};
+    references.push_back(reference);
+    candidates.push_back(candidate);
+  }
+  else
+  {
+    ContainerReader reference_container, candidate_container;
+    reference_container.Open(runs[0]);
+    candidate_container.Open(runs[1]);
+    std::vector<std::string> ids;
+    if(vm.count("member"))
+    {
+      ids = vm["member"].as<std::vector<std::string> >();
+    }
+    else
+    {
+      // Every member of either, each once, the last added taking precedence
+      for(std::size_t k=0;k<reference_container.GetNumMembers();k++)
+      {
+        if(reference_container.FindMember(reference_container.GetMember(k).id) == long(k))
+        {
+          ids.push_back(reference_container.GetMember(k).id);
+        }
+      }
+      for(std::size_t k=0;k<candidate_container.GetNumMembers();k++)
+      {
+        const std::string & id = candidate_container.GetMember(k).id;
+        if(candidate_container.FindMember(id) == long(k) && reference_container.FindMember(id) < 0)
+        {
+          ids.push_back(id);
+        }
+      }
+    }
+    for(std::size_t k=0;k<ids.size();k++)
+    {
+      long reference_member = reference_container.FindMember(ids[k]);
+      long candidate_member = candidate_container.FindMember(ids[k]);
+      if(reference_member < 0 || candidate_member < 0)
+      {
+        unmatched.push_back(ids[k] + "\t*\t*\t-\t-\t-\tFAIL: not in " + (reference_member < 0 ? "reference" : "candidate"));
+        continue;
+      }
+      RunSource reference = {ids[k],runs[0],true,reference_container.GetMember(reference_member)};
+      RunSource candidate = {ids[k],runs[1],true,candidate_container.GetMember(candidate_member)};
+      references.push_back(reference);
+      candidates.push_back(candidate);
+    }
+  }
+
+  // Outputs to compare for each run
+  std::vector<Comparison> comparisons;
+  for(std::size_t k=0;k<references.size();k++)
+  {
+    std::vector<std::string> suffixes;
+    if(vm.count("outputs"))
+    {
+      std::vector<std::string> names = SplitList(vm["outputs"].as<std::string>());
+      for(std::size_t j=0;j<names.size();j++)
+      {
+        suffixes.push_back(OutputSuffix(names[j]));
+      }
+    }
+    else
+    {
+      // Outputs of either run, so that one missing from either side is reported
+      suffixes = FindOutputs(references[k]);
+      std::vector<std::string> candidate_suffixes = FindOutputs(candidates[k]);
+      for(std::size_t j=0;j<candidate_suffixes.size();j++)
+      {
+        if(std::find(suffixes.begin(),suffixes.end(),candidate_suffixes[j]) == suffixes.end())
+        {
+          suffixes.push_back(candidate_suffixes[j]);
+        }
+      }
+    }
+    for(std::size_t j=0;j<suffixes.size();j++)
+    {
+      Comparison comparison;
+      comparison.run = k;
+      comparison.suffix = suffixes[j];
+      comparison.first_column = 0;
+      comparison.num_outside = 0;
+      comparisons.push_back(comparison);
+    }
+  }
+
+  // Each thread takes the next output until none are left
+  int num_threads = vm["threads"].as<int>();
+  if(num_threads <= 0)
+  {
+    num_threads = std::max(1,int(std::thread::hardware_concurrency()));
+  }
+  num_threads = std::max(1,std::min(num_threads,int(comparisons.size())));
+  double floor = vm["floor"].as<double>();
+  double span_tolerance = vm["span-tolerance"].as<double>();
+  std::atomic<std::size_t> next(0);
+  // Outputs that cannot be read are reported like the others, but change the exit code
+  std::atomic<bool> unreadable(false);
+  std::vector<std::thread> threads;
+  for(int t=0;t<num_threads;t++)
+  {
+    threads.push_back(std::thread([&]() {
+      for(std::size_t k=next.fetch_add(1);k<comparisons.size();k=next.fetch_add(1))
+      {
+        try
+        {
+          CompareOutput(references[comparisons[k].run],candidates[comparisons[k].run],comparisons[k],floor,span_tolerance);
+        }
+        catch(std::exception &e)
+        {
+          comparisons[k].error = e.what();
+          unreadable.store(true);
+        }
+      }
+    }));
+  }
+  for(std::size_t t=0;t<threads.size();t++)
+  {
+    threads[t].join();
+  }
+
+  // Report each column, each output and each run, in the order of the reference
+  bool all_columns = vm["all-columns"].as<bool>();
+  std::cout << "# run\toutput\tcolumn\tmax_error\ttime_of_max\trms_error\tstatus\n";
+  std::cout << std::setprecision(6);
+  int num_failed = unmatched.size();
+  std::size_t first = 0;
+  for(std::size_t k=0;k<references.size();k++)
+  {
+    double run_max = 0.0, run_sum_squares = 0.0;
+    uint64_t run_count = 0;
+    bool run_failed = false;
+    for(;first<comparisons.size() && comparisons[first].run == k;first++)
+    {
+      const Comparison & comparison = comparisons[first];
+      std::string output = OutputName(comparison.suffix);
+      if(!comparison.error.empty())
+      {
+        std::cout << references[k].id << "\t" << output << "\t*\t-\t-\t-\tFAIL: " << comparison.error << "\n";
+        run_failed = true;
+        continue;
+      }
+      ColumnError worst = {0.0,NAN,0.0,0};
+      std::string worst_column = "-";
+      bool output_failed = false;
+      for(std::size_t c=comparison.first_column;c<comparison.columns.size();c++)
+      {
+        const ColumnError & column = comparison.columns[c];
+        double rms = column.count > 0 ? std::sqrt(column.sum_squares/column.count) : 0.0;
+        Tolerance tolerance = FindTolerance(tolerances,default_tolerance,comparison.suffix,c);
+        bool failed = !(column.max <= tolerance.max && rms <= tolerance.rms);
+        if(failed || all_columns)
+        {
+          std::cout << references[k].id << "\t" << output << "\t" << ColumnName(comparison.suffix,c) << "\t" << column.max << "\t" << column.time << "\t" << rms << "\t" << (failed ? "FAIL" : "ok") << "\n";
+        }
+        output_failed = output_failed || failed;
+        if(column.max > worst.max || worst.count == 0)
+        {
+          worst.max = column.max;
+          worst.time = column.time;
+          worst_column = ColumnName(comparison.suffix,c);
+        }
+        worst.sum_squares += column.sum_squares;
+        worst.count += column.count;
+      }
+      double rms = worst.count > 0 ? std::sqrt(worst.sum_squares/worst.count) : 0.0;
+      std::cout << references[k].id << "\t" << output << "\t*\t" << worst.max << "\t" << worst.time << "\t" << rms << "\t" << (output_failed ? "FAIL" : "ok") << " (largest in " << worst_column;
+      if(comparison.num_outside > 0)
+      {
+        std::cout << "; reference steps outside the candidate: " << comparison.num_outside;
+      }
+      std::cout << ")\n";
+      run_failed = run_failed || output_failed;
+      run_max = std::fmax(run_max,worst.max);
+      run_sum_squares += worst.sum_squares;
+      run_count += worst.count;
+    }
+    std::cout << references[k].id << "\t*\t*\t" << run_max << "\t-\t" << (run_count > 0 ? std::sqrt(run_sum_squares/run_count) : 0.0) << "\t" << (run_failed ? "FAIL" : "ok") << "\n";
+    num_failed += run_failed ? 1 : 0;
+  }
+  for(std::size_t k=0;k<unmatched.size();k++)
+  {
+    std::cout << unmatched[k] << "\n";
+  }
+  std::cout << "# " << num_failed << " of " << references.size() + unmatched.size() << " runs outside tolerances" << std::endl;
+
+  if(unreadable.load())
+  {
+    return 2;
+  }
+  return num_failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+  // Errors are told apart from regressions by the exit code
+  try
+  {
+    return Diff(argc,argv);
+  }
+  catch(std::exception &e)
+  {
+    std::cerr << "ebtel-diff: " << e.what() << std::endl;
+    return 2;
+  }
+}
@@ -0,0 +1,346 @@
+/*
+ebtel-slice
+Extract columns and time windows from ebtel++ binary output files without reading the whole file.
+*/
+
+#include <sstream>
+#include "boost/program_options.hpp"
+#include "../source/binary.h"
+#include "../source/reduction.h"
+#include "../source/container.h"
+
+// Binary file to read, either on its own or stored in an ensemble container
+//
+struct Input {
+  /* Name used in messages */
+  std::string name;
+  /* Path of the file or container, and byte offset and length of the file within it; 0 for a file on its own */
+  std::string filename;
+  uint64_t offset;
+  uint64_t length;
+  /* Byte offset and length of the time index of a file in a container */
+  uint64_t index_offset;
+  uint64_t index_length;
+};
+
+// Rows of one input file to extract
+//
+struct Selection {
+  /* Index of the input */
+  std::size_t file;
+  /* First row and one past the last row */
+  uint64_t first;
+  uint64_t end;
+};
+
+// Parse the list of columns to extract
+// @specification comma-separated list of column indices or names of results columns
+//
+// @return index of each column
+//
+std::vector<int> ParseColumns(std::string specification)
+{
+  std::vector<int> columns;
+  std::stringstream column_stream(specification);
+  std::string column;
+  while(std::getline(column_stream,column,','))
+  {
+    if(column.compare("time")==0)
+    {
+      columns.push_back(0);
+    }
+    else if(!column.empty() && column.find_first_not_of("0123456789") == std::string::npos)
+    {
+      columns.push_back(std::stoi(column));
+    }
+    else if(FindResultsColumn(column) >= 0)
+    {
+      columns.push_back(FindResultsColumn(column));
+    }
+    else
+    {
+      throw std::runtime_error("Unrecognized column " + column + ". Use an index or time, temperature_e, temperature_i, density, pressure_e, pressure_i, velocity or heat.");
+    }
+  }
+  return columns;
+}
+
+// Split a range of the form `start:stop`
+//
+void ParseRange(std::string range, std::string & start, std::string & stop)
+{
+  std::size_t colon = range.find(':');
+  if(colon == std::string::npos)
+  {
+    throw std::runtime_error("Range " + range + " must be of the form start:stop");
+  }
+  start = range.substr(0,colon);
+  stop = range.substr(colon+1);
+}
+
+// Write the header of a NumPy .npy file holding a two-dimensional array of doubles
+//
+void WriteNpyHeader(std::ostream & out, uint64_t num_rows, std::size_t num_columns)
+{
+  uint16_t one = 1;
+  bool little_endian = *reinterpret_cast<char *>(&one) == 1;
+  std::ostringstream dictionary;
+  dictionary << "{'descr': '" << (little_endian ? '<' : '>') << "f8', 'fortran_order': False, 'shape': (" << num_rows << ", " << num_columns << "), }";
+  // Pad with spaces so that the data starts on a multiple of 64 bytes
+  std::string header = dictionary.str();
+  std::size_t total = 10 + header.size() + 1;
+  header.append((64 - total % 64) % 64,' ');
+  header.push_back('\n');
+  uint16_t header_length = header.size();
+  out.write("\x93NUMPY\x01\x00",8);
+  unsigned char length_bytes[2] = {(unsigned char)(header_length & 0xff),(unsigned char)(header_length >> 8)};
+  out.write(reinterpret_cast<const char *>(length_bytes),2);
+  out.write(header.data(),header.size());
+}
+
+int main(int argc, char *argv[])
+{
+  namespace po = boost::program_options;
+  po::options_description description("Extract rows and columns from ebtel++ binary output files or from the members of ensemble containers. Files are memory-mapped, so only the rows extracted are read from disk.\nUsage: ebtel-slice [options] FILE...");
+  description.add_options()
+    ("help,h","This help message")
+    ("columns,c",po::value<std::string>(),"Columns to extract, as a comma-separated list of indices or of the names of results columns (time, temperature_e, temperature_i, density, pressure_e, pressure_i, velocity, heat). Defaults to every column.")
+    ("time,t",po::value<std::string>(),"Extract only the rows whose first column, e.g. the time, is in start:stop (in s). Either bound may be left out. The first column must be non-decreasing.")
+    ("index,i",po::bool_switch()->default_value(false),"Find the rows of --time from the time index of each file, written if index_interval is set, rather than from its first column. Needed for DEM and terms files, which have no time column. Rows are extracted from just after the last indexed row before start up to just before the first indexed row after stop, so up to index_interval-1 rows either side of the window are included, and the window is exact only if every row is indexed. Rows that are not indexed, e.g. the temperatures of a DEM file, are left out.")
+    ("rows,r",po::value<std::string>(),"Extract only rows first:last, not including last, counted from 0 at the first row of the file or of the --time window. Either bound may be left out.")
+    ("format,f",po::value<std::string>()->default_value("raw"),"Output format: raw (doubles in native byte order, row by row), npy (NumPy array with one row per row extracted) or text.")
+    ("output,o",po::value<std::string>(),"Output file. Defaults to standard output.")
+    ("member,m",po::value<std::vector<std::string> >()->composing(),"Member to extract from, by the configuration file it was listed as in the ensemble. May be given more than once. The input files are then ensemble containers, and the rows extracted from each member of each are concatenated in order.")
+    ("suffix,s",po::value<std::string>()->default_value(""),"Output of each --member to extract, by the suffix it would have had as a file: empty for the results, or .terms, .dem_corona, .dem_tr, ...")
+    ("list,l",po::bool_switch()->default_value(false),"List the members of each ensemble container with the hash of their configuration and the size of each of their outputs, and exit.")
+    ("file",po::value<std::vector<std::string> >(),"Input files, in the binary output format, or ensemble containers. The rows extracted from each are concatenated in order.");
+  po::positional_options_description positional;
+  positional.add("file",-1);
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc,argv).options(description).positional(positional).run(), vm);
+  if(vm.count("help") || !vm.count("file"))
+  {
+    std::cout << description;
+    return vm.count("help") ? 0 : 1;
+  }
+  po::notify(vm);
+
+  std::string format = vm["format"].as<std::string>();
+  if(format.compare("raw")!=0 && format.compare("npy")!=0 && format.compare("text")!=0)
+  {
+    throw std::runtime_error("Unrecognized output format " + format + ". Use raw, npy or text.");
+  }
+
+  // Find the files to read, looking members up in the index of each container
+  std::vector<std::string> filenames = vm["file"].as<std::vector<std::string> >();
+  std::vector<Input> inputs;
+  for(std::size_t k=0;k<filenames.size();k++)
+  {
+    if(!vm.count("member") && !vm["list"].as<bool>())
+    {
+      Input input = {filenames[k],filenames[k],0,0,0,0};
+      inputs.push_back(input);
+      continue;
+    }
+    ContainerReader container;
+    container.Open(filenames[k]);
+    if(vm["list"].as<bool>())
+    {
+      for(std::size_t j=0;j<container.GetNumMembers();j++)
+      {
+        const ContainerMember & member = container.GetMember(j);
+        std::cout << member.id << "\t" << member.hash;
+        for(std::size_t i=0;i<member.files.size();i++)
+        {
+          std::cout << "\t" << (member.files[i].suffix.empty() ? "results" : member.files[i].suffix) << ":" << member.files[i].size;
+        }
+        std::cout << "\n";
+      }
+      continue;
+    }
+    std::string suffix = vm["suffix"].as<std::string>();
+    std::vector<std::string> ids = vm["member"].as<std::vector<std::string> >();
+    for(std::size_t j=0;j<ids.size();j++)
+    {
+      long m = container.FindMember(ids[j]);
+      if(m < 0)
+      {
+        throw std::runtime_error("No member " + ids[j] + " in " + filenames[k]);
+      }
+      const ContainerFile & file = container.FindFile(m,suffix);
+      Input input = {filenames[k] + ":" + ids[j],filenames[k],file.offset,file.size,0,0};
+      if(vm.count("time") && vm["index"].as<bool>())
+      {
+        const ContainerFile & index = container.FindFile(m,suffix + ".index");
+        input.index_offset = index.offset;
+        input.index_length = index.size;
+      }
+      inputs.push_back(input);
+    }
+  }
+  if(vm["list"].as<bool>())
+  {
+    return 0;
+  }
+
+  // Map every file and find the rows to extract from each
+  std::vector<std::unique_ptr<MappedReader> > files;
+  std::vector<Selection> selections;
+  std::vector<int> columns;
+  uint64_t num_rows = 0;
+  for(std::size_t k=0;k<inputs.size();k++)
+  {
+    files.push_back(std::unique_ptr<MappedReader>(new MappedReader));
+    MappedReader & file = *files.back();
+    file.Open(inputs[k].filename,inputs[k].offset,inputs[k].length);
+    if(k == 0)
+    {
+      if(vm.count("columns"))
+      {
+        columns = ParseColumns(vm["columns"].as<std::string>());
+      }
+      else
+      {
+        for(int c=0;c<file.GetNumColumns();c++)
+        {
+          columns.push_back(c);
+        }
+      }
+    }
+    for(std::size_t c=0;c<columns.size();c++)
+    {
+      if(columns[c] < 0 || columns[c] >= file.GetNumColumns())
+      {
+        throw std::runtime_error("Column " + std::to_string(columns[c]) + " is not in " + inputs[k].name);
+      }
+    }
+
+    Selection selection;
+    selection.file = k;
+    selection.first = 0;
+    selection.end = file.GetNumRows();
+    std::string start, stop;
+    if(vm.count("time") && vm["index"].as<bool>())
+    {
+      ParseRange(vm["time"].as<std::string>(),start,stop);
+      TimeIndex index;
+      if(inputs[k].index_length > 0)
+      {
+        MappedReader index_file;
+        index_file.Open(inputs[k].filename,inputs[k].index_offset,inputs[k].index_length);
+        index.Open(index_file);
+      }
+      else
+      {
+        index.Open(inputs[k].filename);
+      }
+      // Indexed rows outside the window are left out, so the window is exact if every row is
+      // indexed. Rows before the first indexed row, e.g. the temperatures of a DEM file, have no time
+      if(index.GetNumEntries() > 0)
+      {
+        selection.first = index.GetRow(0);
+      }
+      if(index.GetNumEntries() > 0 && !start.empty())
+      {
+        std::size_t entry = index.FindEntry(std::stod(start));
+        selection.first = index.GetRow(entry) + (index.GetTime(entry) < std::stod(start) ? 1 : 0);
+      }
+      if(index.GetNumEntries() > 0 && !stop.empty())
+      {
+        std::size_t entry = index.FindEntry(std::stod(stop));
+        if(index.GetTime(entry) <= std::stod(stop))
+        {
+          entry++;
+        }
+        selection.end = entry < index.GetNumEntries() ? index.GetRow(entry) : file.GetNumRows();
+      }
+    }
+    else if(vm.count("time"))
+    {
+      ParseRange(vm["time"].as<std::string>(),start,stop);
+      if(!start.empty())
+      {
+        selection.first = file.FindRow(std::stod(start));
+      }
+      if(!stop.empty())
+      {
+        // First row past the stop time
+        selection.end = file.FindRow(std::nextafter(std::stod(stop),INFINITY),selection.first);
+      }
+    }
+    if(vm.count("rows"))
+    {
+      ParseRange(vm["rows"].as<std::string>(),start,stop);
+      uint64_t window_first = selection.first;
+      if(!start.empty())
+      {
+        selection.first = std::min<uint64_t>(window_first + std::stoull(start),selection.end);
+      }
+      if(!stop.empty())
+      {
+        selection.end = std::min<uint64_t>(window_first + std::stoull(stop),selection.end);
+      }
+    }
+    selection.end = std::max(selection.first,selection.end);
+    selections.push_back(selection);
+    num_rows += selection.end - selection.first;
+  }
+
+  std::ofstream f;
+  if(vm.count("output"))
+  {
+    f.open(vm["output"].as<std::string>().c_str(),std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!f.is_open())
+    {
+      throw std::runtime_error("Failed to open output file " + vm["output"].as<std::string>());
+    }
+  }
+  std::ostream & out = vm.count("output") ? f : std::cout;
+  if(format.compare("npy")==0)
+  {
+    WriteNpyHeader(out,num_rows,columns.size());
+  }
+  out << std::setprecision(17);
+
+  // Copy the rows, a block at a time
+  std::vector<double> block;
+  const std::size_t block_rows = 4096;
+  for(std::size_t k=0;k<selections.size();k++)
+  {
+    MappedReader & file = *files[selections[k].file];
+    for(uint64_t i=selections[k].first;i<selections[k].end;)
+    {
+      uint64_t block_end = std::min<uint64_t>(i + block_rows,selections[k].end);
+      if(format.compare("text")==0)
+      {
+        for(;i<block_end;i++)
+        {
+          const double * row = file.GetRow(i);
+          for(std::size_t c=0;c<columns.size();c++)
+          {
+            out << (c > 0 ? "\t" : "") << row[columns[c]];
+          }
+          out << "\n";
+        }
+        continue;
+      }
+      block.clear();
+      for(;i<block_end;i++)
+      {
+        const double * row = file.GetRow(i);
+        for(std::size_t c=0;c<columns.size();c++)
+        {
+          block.push_back(row[columns[c]]);
+        }
+      }
+      out.write(reinterpret_cast<const char *>(block.data()),block.size()*sizeof(double));
+    }
+  }
+  out.flush();
+  if(!out)
+  {
+    throw std::runtime_error("Failed to write output");
+  }
+
+  return 0;
+}